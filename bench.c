@@ -0,0 +1,1413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <math.h>
+
+#include "src/blk.h"
+#include "src/coef.h"
+#include "src/cpu.h"
+#include "src/dct.h"
+#include "src/dct8.h"
+#include "src/enc.h"
+#include "src/hdr.h"
+#include "src/huff.h"
+#include "src/jdec.h"
+#include "src/jpg.h"
+#include "src/pool.h"
+#include "src/ppm.h"
+#include "src/pxb.h"
+#include "src/yuv.h"
+#include "src/rle.h"
+
+#define N 8
+
+typedef struct BenchCase {
+    const char *name;
+    const char *desc;
+    int (*run)(int argc, char *argv[]);
+} BenchCase;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t arg_size(int argc, char *argv[], int i, size_t dflt)
+{
+    return argc > i ? strtoul(argv[i], NULL, 10) : dflt;
+}
+
+static void fill_random(xMat mat, size_t size)
+{
+    srand(42);
+    for (size_t i = 0; i < size; i++) {
+        mat[i] = (xReal)(rand() % 256) - 128;
+    }
+}
+
+// bench dct [width] [height] [rounds] [rigor]
+static int bench_dct(int argc, char *argv[])
+{
+    size_t w = arg_size(argc, argv, 0, 4000);
+    size_t h = arg_size(argc, argv, 1, 3000);
+    size_t rounds = arg_size(argc, argv, 2, 10);
+    size_t nblks = (w / N) * (h / N);
+
+    if (argc > 3 && dct_planner_init(dct_rigor_from_name(argv[3]), NULL) < 0)
+        return -1;
+
+    xMat mat = mat_calloc(w, h);
+    fill_random(mat, w * h);
+
+    // the first round pays for planning
+    double t0 = now();
+    mat_dct_blks(mat, N);
+    mat_idct_blks(mat, N);
+    double first = now() - t0;
+
+    t0 = now();
+    for (size_t i = 0; i < rounds; i++) {
+        mat_dct_blks(mat, N);
+        mat_idct_blks(mat, N);
+    }
+    double elapsed = (now() - t0) / rounds;
+
+    printf("dct %zux%zu [%s]: first round %.3f ms, steady %.3f ms, "
+           "%.2f Mblk/s (dct+idct)\n",
+           w, h, dct8_isa(), first * 1e3, elapsed * 1e3, nblks / elapsed / 1e6);
+
+    mat_free(mat);
+    return 0;
+}
+
+// bench tiled [width] [height] [rounds]
+static int bench_tiled(int argc, char *argv[])
+{
+    size_t w = arg_size(argc, argv, 0, 4000);
+    size_t h = arg_size(argc, argv, 1, 3000);
+    size_t rounds = arg_size(argc, argv, 2, 10);
+
+    xMat mat = mat_calloc(w, h);
+    xTileMat tm = tmat_calloc(w, h, N);
+    fill_random(mat, w * h);
+    dct_planner_warmup(N, w, h);
+
+    double t0 = now();
+    for (size_t i = 0; i < rounds; i++) {
+        mat_dct_blks(mat, N);
+        mat_idct_blks(mat, N);
+    }
+    double t_raster = (now() - t0) / rounds;
+
+    t0 = now();
+    for (size_t i = 0; i < rounds; i++)
+        tmat_from_mat(tm, mat);
+    double t_from = (now() - t0) / rounds;
+
+    t0 = now();
+    for (size_t i = 0; i < rounds; i++) {
+        tmat_dct_blks(tm);
+        tmat_idct_blks(tm);
+    }
+    double t_tiled = (now() - t0) / rounds;
+
+    t0 = now();
+    for (size_t i = 0; i < rounds; i++)
+        tmat_to_mat(mat, tm);
+    double t_to = (now() - t0) / rounds;
+
+    printf("tiled %zux%zu [%s]: raster dct+idct %.3f ms, tiled dct+idct "
+           "%.3f ms, to tiled %.3f ms, to raster %.3f ms\n",
+           w, h, dct8_isa(), t_raster * 1e3, t_tiled * 1e3, t_from * 1e3,
+           t_to * 1e3);
+
+    tmat_free(tm);
+    mat_free(mat);
+    return 0;
+}
+
+// bench mt [width] [height] [rounds] [max threads]
+static int bench_mt(int argc, char *argv[])
+{
+    size_t w = arg_size(argc, argv, 0, 4000);
+    size_t h = arg_size(argc, argv, 1, 3000);
+    size_t rounds = arg_size(argc, argv, 2, 10);
+    int max_threads = arg_size(argc, argv, 3, 32);
+
+    xMat mat = mat_calloc(w, h), ref = NULL;
+    double t_one = 0;
+    int ret = 0;
+
+    for (int n = 1; n <= max_threads; n *= 2) {
+        xPool *pool = pool_new(n);
+
+        fill_random(mat, w * h);
+        mat_dct_blks_mt(pool, mat, N);
+        if (ref == NULL)
+            ref = mat_copy(mat);
+        int same = memcmp(mat, ref, sizeof(xReal) * w * h) == 0;
+
+        double t0 = now();
+        for (size_t i = 0; i < rounds; i++) {
+            mat_idct_blks_mt(pool, mat, N);
+            mat_dct_blks_mt(pool, mat, N);
+        }
+        double elapsed = (now() - t0) / rounds;
+        if (n == 1)
+            t_one = elapsed;
+
+        printf("mt %zux%zu [%s] %2d threads: %.3f ms, x%.2f, %s\n", w, h,
+               dct8_isa(), n, elapsed * 1e3, t_one / elapsed,
+               same ? "identical" : "DIFFERS");
+        ret |= same ? 0 : -1;
+        pool_free(pool);
+    }
+
+    mat_free(ref);
+    mat_free(mat);
+    return ret;
+}
+
+// the per-element callback quantizer main.c used before the block kernels
+static const xReal *cb_tbl;
+
+static xReal cb_quantize(xBlock blk, xReal x, int i, int j, void *_payload)
+{
+    return roundf(x / cb_tbl[i * N + j]);
+}
+
+// bench quant [width] [height] [rounds]
+static int bench_quant(int argc, char *argv[])
+{
+    size_t w = arg_size(argc, argv, 0, 4000);
+    size_t h = arg_size(argc, argv, 1, 3000);
+    size_t rounds = arg_size(argc, argv, 2, 10);
+
+    xReal tbl[N * N], recip[N * N];
+    for (int i = 0; i < N * N; i++)
+        tbl[i] = jpec_qzr[i];
+    blk_quant_recip(recip, tbl, N * N);
+    cb_tbl = tbl;
+
+    // coefficient-like magnitudes
+    xMat mat = mat_calloc(w, h);
+    fill_random(mat, w * h);
+    mat_product_n(mat, 16, mat);
+
+    xTileMat src = tmat_calloc(w, h, N);
+    xTileMat cb = tmat_calloc(w, h, N), kernel = tmat_calloc(w, h, N);
+    size_t nblks = tmat_count_blks(src), size = sizeof(xReal) * nblks * N * N;
+    tmat_from_mat(src, mat);
+
+    double t_cb = 0, t_kernel = 0, t0;
+    for (size_t r = 0; r < rounds; r++) {
+        memcpy(cb.data, src.data, size);
+        t0 = now();
+        for (size_t i = 0; i < nblks; i++)
+            blk_foreachi(tmat_get_blk(cb, i), cb_quantize, NULL);
+        t_cb += now() - t0;
+
+        memcpy(kernel.data, src.data, size);
+        t0 = now();
+        for (size_t i = 0; i < nblks; i++)
+            blk_quantize(tmat_get_blk(kernel, i), recip);
+        t_kernel += now() - t0;
+    }
+
+    size_t diff = 0;
+    for (size_t i = 0; i < nblks * N * N; i++)
+        diff += cb.data[i] != kernel.data[i];
+
+    printf("quant %zux%zu: callback %.3f ms, kernel %.3f ms (%.1f%%), "
+           "%zu of %zu differ\n",
+           w, h, t_cb / rounds * 1e3, t_kernel / rounds * 1e3,
+           100 * t_kernel / t_cb, diff, nblks * N * N);
+
+    tmat_free(kernel);
+    tmat_free(cb);
+    tmat_free(src);
+    mat_free(mat);
+    return 0;
+}
+
+static uint8_t *random_plane(size_t size)
+{
+    uint8_t *plane = malloc(size);
+    srand(42);
+    for (size_t i = 0; i < size; i++) {
+        plane[i] = rand() % 256;
+    }
+    return plane;
+}
+
+// float: level shift, dct and quantize the whole plane pass by pass
+static void float_encode(xMat mat, const uint8_t *plane, size_t w, size_t h)
+{
+    for (size_t i = 0; i < w * h; i++)
+        mat[i] = (xReal)plane[i] - 128;
+    mat_dct_blks(mat, N);
+    for (size_t i = 0; i < w * h; i++)
+        mat[i] = roundf(mat[i] / jpec_qzr[(i / w % N) * N + i % N]);
+}
+
+// bench coef [width] [height] [rounds]
+static int bench_coef(int argc, char *argv[])
+{
+    size_t w = arg_size(argc, argv, 0, 4000);
+    size_t h = arg_size(argc, argv, 1, 3000);
+    size_t rounds = arg_size(argc, argv, 2, 10);
+
+    uint8_t *plane = random_plane(w * h);
+    xMat mat = mat_calloc(w, h);
+    xCoefPlane *cpl = cpl_calloc(w, h);
+    xRLETable tbl = rtb_calloc(N * N);
+    int16_t zz[N * N];
+    xQuant quant;
+    cpl_quant_init(&quant, jpec_qzr);
+
+    double t0 = now();
+    for (size_t i = 0; i < rounds; i++)
+        float_encode(mat, plane, w, h);
+    double t_float = (now() - t0) / rounds;
+
+    t0 = now();
+    for (size_t i = 0; i < rounds; i++)
+        cpl_encode_plane(cpl, plane, w, &quant);
+    double t_int = (now() - t0) / rounds;
+
+    size_t items = 0;
+    t0 = now();
+    for (size_t i = 0; i < cpl->bw * cpl->bh; i++) {
+        cpl_zigzag(cpl->data + i * N * N, zz);
+        items += rtb_parse_i16(tbl, zz);
+    }
+    double t_rle = now() - t0;
+
+    printf("coef %zux%zu: float %.3f ms (%zu MB), int16 %.3f ms (%zu MB), "
+           "%.1f Msample/s, rle %.3f ms (%zu items)\n",
+           w, h, t_float * 1e3, w * h * sizeof(xReal) >> 20, t_int * 1e3,
+           cpl->bw * cpl->bh * N * N * sizeof(int16_t) >> 20,
+           w * h / t_int / 1e6, t_rle * 1e3, items);
+
+    rtb_free(tbl);
+    cpl_free(cpl);
+    mat_free(mat);
+    free(plane);
+    return 0;
+}
+
+// fnv-1a over the symbols of a block, to compare the encoder outputs
+static uint64_t hash_symbols(uint64_t hash, int16_t dc, xRLETable tbl)
+{
+    hash = (hash ^ (uint16_t)dc) * 0x100000001b3ull;
+    for (size_t i = 0; i < rtb_get_size(tbl); i++) {
+        hash = (hash ^ (tbl[i].rs.zeros << 4 | tbl[i].rs.nbits)) *
+               0x100000001b3ull;
+        hash = (hash ^ (uint16_t)tbl[i].amp) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static void hash_sink(size_t bx, size_t by, int16_t dc, xRLETable tbl,
+                      void *payload)
+{
+    uint64_t *hash = payload;
+    *hash = hash_symbols(*hash, dc, tbl);
+}
+
+// bench enc [width] [height] [rounds]
+static int bench_enc(int argc, char *argv[])
+{
+    size_t w = arg_size(argc, argv, 0, 4000);
+    size_t h = arg_size(argc, argv, 1, 3000);
+    size_t rounds = arg_size(argc, argv, 2, 10);
+
+    uint8_t *plane = random_plane(w * h);
+    xCoefPlane *cpl = cpl_calloc(w, h);
+    xRLETable tbl = rtb_calloc(N * N);
+    int16_t zz[N * N];
+    xQuant quant;
+    cpl_quant_init(&quant, jpec_qzr);
+
+    // multi-pass: quantized coefficient plane, then zigzag and rle
+    uint64_t multi = 0;
+    double t0 = now();
+    for (size_t r = 0; r < rounds; r++) {
+        multi = 0xcbf29ce484222325ull;
+        cpl_encode_plane(cpl, plane, w, &quant);
+        for (size_t i = 0; i < cpl->bw * cpl->bh; i++) {
+            cpl_zigzag(cpl->data + i * N * N, zz);
+            rtb_parse_i16(tbl, zz);
+            multi = hash_symbols(multi, zz[0], tbl);
+        }
+    }
+    double t_multi = (now() - t0) / rounds;
+
+    uint64_t fused = 0;
+    xEncoder *enc = enc_new(jpec_qzr, hash_sink, &fused);
+    t0 = now();
+    for (size_t r = 0; r < rounds; r++) {
+        fused = 0xcbf29ce484222325ull;
+        enc_plane(enc, plane, w, h, w);
+    }
+    double t_fused = (now() - t0) / rounds;
+
+    // the plane traffic of each path counted from the sizes of the buffers
+    // it goes through, not measured: both read the pixels, the multi-pass
+    // one also writes the int16 coefficient plane and reads it back. the
+    // per-block scratch of either stays in cache
+    double mpx = w * h / 1e6;
+    double coef = cpl->bw * cpl->bh * N * N * sizeof(int16_t);
+    double mb_multi = (w * h + 2 * coef) / 1e6 / mpx;
+    double mb_fused = w * h / 1e6 / mpx;
+    printf("enc %zux%zu: multi-pass %.3f ms (%.1f Mpx/s, %.1f MB/Mpx "
+           "counted), fused %.3f ms (%.1f Mpx/s, %.1f MB/Mpx counted), fused "
+           "takes x%.2f the time, symbols %s\n",
+           w, h, t_multi * 1e3, mpx / t_multi, mb_multi, t_fused * 1e3,
+           mpx / t_fused, mb_fused, t_fused / t_multi,
+           multi == fused ? "match" : "DIFFER");
+
+    enc_free(enc);
+    rtb_free(tbl);
+    cpl_free(cpl);
+    free(plane);
+    return multi == fused ? 0 : -1;
+}
+
+// the symbols of every block of a plane, kept to be entropy coded alone
+typedef struct SymLog {
+    size_t n;
+    int16_t *dc;
+    xRLETable *tbl;
+} SymLog;
+
+static void sym_sink(size_t bx, size_t by, int16_t dc, xRLETable tbl,
+                     void *payload)
+{
+    SymLog *log = payload;
+    size_t size = rtb_get_size(tbl);
+    xRLETable copy = rtb_calloc(size);
+
+    memcpy(copy, tbl, sizeof(xRLEItem) * size);
+    rtb_set_size(copy, size);
+    log->dc[log->n] = dc;
+    log->tbl[log->n++] = copy;
+}
+
+// the Y plane of a ppm repeated `scale` times in both directions
+static uint8_t *ppm_luma(const char *name, size_t scale, size_t *w, size_t *h)
+{
+    PixelBuffer *ppm = ppm_map_file(name);
+    if (ppm == NULL || ppm->fmt != FMT_RGB24) {
+        pxb_free(ppm);
+        return NULL;
+    }
+
+    // the rows of a mapped ppm are packed
+    size_t pw = ppm->w, ph = ppm->h;
+    uint8_t *yuv = malloc(fmt_get_size(FMT_YUV420, pw, ph));
+    rgb24_to_yuv420(pw, ph, ppm->plane[0], yuv);
+    pxb_free(ppm);
+
+    *w = pw * scale;
+    *h = ph * scale;
+    uint8_t *plane = malloc(*w * *h);
+    for (size_t y = 0; y < *h; y++)
+        for (size_t x = 0; x < *w; x += pw)
+            memcpy(plane + y * *w + x, yuv + (y % ph) * pw, pw);
+
+    free(yuv);
+    return plane;
+}
+
+// bench huff [ppm] [rounds] [scale]
+static int bench_huff(int argc, char *argv[])
+{
+    const char *name = argc > 0 ? argv[0] : "Lenna.ppm";
+    size_t rounds = arg_size(argc, argv, 1, 20);
+    size_t scale = arg_size(argc, argv, 2, 1);
+    size_t w, h;
+
+    uint8_t *plane = ppm_luma(name, scale, &w, &h);
+    if (plane == NULL)
+        return -1;
+
+    // the symbols are made once, the entropy coder is timed on them alone
+    size_t nblks = ((w + N - 1) / N) * ((h + N - 1) / N);
+    SymLog log = {0, malloc(sizeof(int16_t) * nblks),
+                  malloc(sizeof(xRLETable) * nblks)};
+    xEncoder *sym = enc_new(jpec_qzr, NULL, NULL);
+    xEncoder *enc = enc_new(jpec_qzr, sym_sink, &log);
+    enc_plane(enc, plane, w, h, w);
+
+    double t0 = now();
+    for (size_t r = 0; r < rounds; r++)
+        enc_plane(sym, plane, w, h, w);
+    double t_sym = (now() - t0) / rounds;
+
+    xBitWriter bw;
+    bw_init(&bw, w * h);
+    t0 = now();
+    for (size_t r = 0; r < rounds; r++) {
+        int16_t last_dc = 0;
+        bw_reset(&bw);
+        for (size_t i = 0; i < log.n; i++)
+            huff_encode_blk(&bw, huff_std_dc(), huff_std_ac(), log.dc[i],
+                            &last_dc, log.tbl[i]);
+        bw_flush(&bw);
+    }
+    double t_huff = (now() - t0) / rounds;
+
+    printf("huff %s %zux%zu: %zu bytes (%.3f bpp), symbols %.3f ms, "
+           "huffman %.3f ms, %.1f MB/s output, %.1f Mpx/s overall\n",
+           name, w, h, bw.size, 8. * bw.size / (w * h), t_sym * 1e3,
+           t_huff * 1e3, bw.size / t_huff / 1e6,
+           w * h / (t_sym + t_huff) / 1e6);
+
+    for (size_t i = 0; i < log.n; i++)
+        rtb_free(log.tbl[i]);
+    free(log.tbl);
+    free(log.dc);
+    enc_free(enc);
+    enc_free(sym);
+    bw_free(&bw);
+    free(plane);
+    return 0;
+}
+
+// the output is only counted, the writer streams it out row by row
+static int count_write(const uint8_t *data, size_t size, void *payload)
+{
+    *(size_t *)payload += size;
+    return 0;
+}
+
+// a ppm repeated `scale` times in both directions
+static PixelBuffer *ppm_tiled(const char *name, size_t scale)
+{
+    PixelBuffer *ppm = ppm_map_file(name);
+    if (ppm == NULL || ppm->fmt != FMT_RGB24) {
+        pxb_free(ppm);
+        return NULL;
+    }
+
+    size_t pw = ppm->w, ph = ppm->h;
+    size_t w = pw * scale, h = ph * scale;
+    PixelBuffer *pxb = pxb_new(FMT_RGB24, w, h, NULL);
+    for (size_t y = 0; y < h; y++)
+        for (size_t x = 0; x < w; x += pw)
+            memcpy(pxb->plane[0] + y * pxb->stride[0] + x * 3,
+                   ppm->plane[0] + (y % ph) * ppm->stride[0], pw * 3);
+    pxb_free(ppm);
+    return pxb;
+}
+
+// bench jpg [ppm] [rounds] [scale] [quality]
+static int bench_jpg(int argc, char *argv[])
+{
+    const char *name = argc > 0 ? argv[0] : "Lenna.ppm";
+    size_t rounds = arg_size(argc, argv, 1, 20);
+    size_t scale = arg_size(argc, argv, 2, 1);
+    int quality = arg_size(argc, argv, 3, 75);
+
+    PixelBuffer *pxb = ppm_tiled(name, scale);
+    if (pxb == NULL)
+        return -1;
+    size_t w = pxb->w, h = pxb->h;
+
+    // the standard tables, then a gathering pass and optimized tables
+    size_t sizes[2] = {0};
+    int ret = 0;
+    for (int optimize = 0; optimize < 2 && ret == 0; optimize++) {
+        xJpgOptions opt = {quality, optimize, 0};
+        double t0 = now();
+        for (size_t r = 0; r < rounds && ret == 0; r++) {
+            sizes[optimize] = 0;
+            ret = jpg_write_pxb(pxb, &opt, count_write, &sizes[optimize]);
+        }
+        double t = (now() - t0) / rounds, mpx = w * h / 1e6;
+
+        printf("jpg %s %zux%zu q%d %s: %zu bytes (%.3f bpp), %.3f ms, "
+               "%.3f ms/Mpx, %.1f Mpx/s\n",
+               name, w, h, quality, optimize ? "optimized" : "standard",
+               sizes[optimize], 8. * sizes[optimize] / (w * h), t * 1e3,
+               t * 1e3 / mpx, mpx / t);
+    }
+    if (ret == 0)
+        printf("optimized tables save %.2f%%\n",
+               100. * (1. - (double)sizes[1] / sizes[0]));
+
+    pxb_free(pxb);
+    return ret;
+}
+
+// bench gray [ppm] [rounds] [scale] [quality]
+static int bench_gray(int argc, char *argv[])
+{
+    const char *name = argc > 0 ? argv[0] : "Lenna.ppm";
+    size_t rounds = arg_size(argc, argv, 1, 20);
+    size_t scale = arg_size(argc, argv, 2, 1);
+    xJpgOptions opt = JPG_OPTIONS_DEFAULT;
+    opt.quality = arg_size(argc, argv, 3, 75);
+
+    PixelBuffer *rgb = ppm_tiled(name, scale);
+    if (rgb == NULL)
+        return -1;
+    size_t w = rgb->w, h = rgb->h;
+
+    // the luma of the same image, as a pgm would come
+    PixelBuffer *yuv = pxb_new(FMT_YUV420, w, h, NULL);
+    rgb24_to_ycbcr420(YCC_JFIF, w, h, rgb->plane[0], rgb->stride[0],
+                      yuv->plane[0], yuv->stride[0], yuv->plane[1],
+                      yuv->plane[2], yuv->stride[1]);
+    PixelBuffer *gray = pxb_plane_view(yuv, 0);
+
+    PixelBuffer *in[2] = {rgb, gray};
+    double t[2];
+    size_t size[2];
+    int ret = 0;
+    for (int i = 0; i < 2 && ret == 0; i++) {
+        double t0 = now();
+        for (size_t r = 0; r < rounds && ret == 0; r++) {
+            size[i] = 0;
+            ret = jpg_write_pxb(in[i], &opt, count_write, &size[i]);
+        }
+        t[i] = (now() - t0) / rounds;
+    }
+    if (ret == 0)
+        printf("gray %s %zux%zu q%d: rgb %.3f ms %zu bytes, gray %.3f ms "
+               "%zu bytes, x%.2f cheaper\n",
+               name, w, h, opt.quality, t[0] * 1e3, size[0], t[1] * 1e3,
+               size[1], t[0] / t[1]);
+
+    pxb_free(gray);
+    pxb_free(yuv);
+    pxb_free(rgb);
+    return ret;
+}
+
+// bench jdec [jpg] [rounds]
+static int bench_jdec(int argc, char *argv[])
+{
+    const char *name = argc > 0 ? argv[0] : "Lenna.jpg";
+    size_t rounds = arg_size(argc, argv, 1, 50);
+
+    FILE *f = fopen(name, "rb");
+    if (f == NULL)
+        return -1;
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size);
+    size = fread(data, 1, size, f);
+    fclose(f);
+
+    // the file is in memory, only the decoding is timed
+    PixelBuffer *pxb = NULL;
+    double t0 = now();
+    for (size_t r = 0; r < rounds; r++) {
+        pxb_free(pxb);
+        pxb = jdec_decode_mem(data, size);
+        if (pxb == NULL)
+            break;
+    }
+    double t = (now() - t0) / rounds;
+
+    if (pxb) {
+        double mpx = pxb->w * pxb->h / 1e6;
+        printf("jdec %s %zux%zu: %zu bytes, %.3f ms, %.3f ms/Mpx, "
+               "%.1f Mpx/s\n",
+               name, pxb->w, pxb->h, size, t * 1e3, t * 1e3 / mpx, mpx / t);
+    } else {
+        printf("jdec %s: failed to decode\n", name);
+    }
+
+    int ret = pxb ? 0 : -1;
+    pxb_free(pxb);
+    free(data);
+    return ret;
+}
+
+// the encoded file, grown as it streams in
+typedef struct MemOut {
+    uint8_t *buf;
+    size_t size, cap;
+} MemOut;
+
+static int mem_write(const uint8_t *data, size_t size, void *payload)
+{
+    MemOut *out = payload;
+
+    if (out->size + size > out->cap) {
+        out->cap = (out->size + size) * 2;
+        out->buf = realloc(out->buf, out->cap);
+    }
+    memcpy(out->buf + out->size, data, size);
+    out->size += size;
+    return 0;
+}
+
+// bench rst [ppm] [rounds] [scale] [restart rows] [max threads]
+static int bench_rst(int argc, char *argv[])
+{
+    const char *name = argc > 0 ? argv[0] : "Lenna.ppm";
+    size_t rounds = arg_size(argc, argv, 1, 10);
+    size_t scale = arg_size(argc, argv, 2, 4);
+    int restart_rows = arg_size(argc, argv, 3, 1);
+    int max_threads = arg_size(argc, argv, 4, 8);
+
+    PixelBuffer *pxb = ppm_tiled(name, scale);
+    if (pxb == NULL)
+        return -1;
+
+    // the serial streaming writer is the reference for every pool size
+    xJpgOptions opt = {75, 1, restart_rows};
+    MemOut ref = {0}, out = {0};
+    PixelBuffer *ref_dec = NULL;
+    double t_enc = 0, t_dec = 0, mpx = pxb->w * pxb->h / 1e6;
+    int ret = jpg_write_pxb(pxb, &opt, mem_write, &ref);
+    if (ret == 0)
+        ref_dec = jdec_decode_mem(ref.buf, ref.size);
+    if (ref_dec == NULL)
+        ret = -1;
+
+    for (int n = 1; n <= max_threads && ret == 0; n *= 2) {
+        xPool *pool = pool_new(n);
+        PixelBuffer *dec = NULL;
+
+        double t0 = now();
+        for (size_t r = 0; r < rounds && ret == 0; r++) {
+            out.size = 0;
+            ret = jpg_write_pxb_mt(pool, pxb, &opt, mem_write, &out);
+        }
+        double t1 = now();
+        for (size_t r = 0; r < rounds && ret == 0; r++) {
+            pxb_free(dec);
+            dec = jdec_decode_mem_mt(pool, ref.buf, ref.size);
+            ret = dec ? 0 : -1;
+        }
+        double t2 = now();
+
+        double enc = (t1 - t0) / rounds, de = (t2 - t1) / rounds;
+        if (n == 1) {
+            t_enc = enc;
+            t_dec = de;
+        }
+        int same_enc = out.size == ref.size &&
+                       memcmp(out.buf, ref.buf, ref.size) == 0;
+        int same_dec = dec && memcmp(dec->buf, ref_dec->buf, dec->size) == 0;
+
+        printf("rst %s %zux%zu every %d MCU rows %2d threads: %zu bytes, "
+               "encode %.3f ms (%.1f Mpx/s, x%.2f) %s, decode %.3f ms "
+               "(%.1f Mpx/s, x%.2f) %s\n",
+               name, pxb->w, pxb->h, restart_rows, n, out.size, enc * 1e3,
+               mpx / enc, t_enc / enc, same_enc ? "identical" : "DIFFERS",
+               de * 1e3, mpx / de, t_dec / de,
+               same_dec ? "identical" : "DIFFERS");
+        ret |= same_enc && same_dec ? 0 : -1;
+        pxb_free(dec);
+        pool_free(pool);
+    }
+
+    pxb_free(ref_dec);
+    free(ref.buf);
+    free(out.buf);
+    pxb_free(pxb);
+    return ret;
+}
+
+// bench prog [ppm] [rounds] [scale] [quality]
+static int bench_prog(int argc, char *argv[])
+{
+    const char *name = argc > 0 ? argv[0] : "Lenna.ppm";
+    size_t rounds = arg_size(argc, argv, 1, 10);
+    size_t scale = arg_size(argc, argv, 2, 1);
+    int quality = arg_size(argc, argv, 3, 75);
+    static const char *modes[] = {"baseline", "baseline optimized",
+                                  "progressive"};
+
+    PixelBuffer *pxb = ppm_tiled(name, scale);
+    if (pxb == NULL)
+        return -1;
+
+    double mpx = pxb->w * pxb->h / 1e6;
+    size_t sizes[3] = {0};
+    MemOut out = {0};
+    int ret = 0;
+
+    for (int m = 0; m < 3 && ret == 0; m++) {
+        xJpgOptions opt = {quality, m == 1, 0, m == 2, NULL, 0};
+
+        double t0 = now();
+        for (size_t r = 0; r < rounds && ret == 0; r++) {
+            out.size = 0;
+            ret = jpg_write_pxb(pxb, &opt, mem_write, &out);
+        }
+        double t = (now() - t0) / rounds;
+        sizes[m] = out.size;
+
+        printf("prog %s %zux%zu q%d %s: %zu bytes (%.3f bpp), %.3f ms, "
+               "%.1f Mpx/s\n",
+               name, pxb->w, pxb->h, quality, modes[m], out.size,
+               8. * out.size / (pxb->w * pxb->h), t * 1e3, mpx / t);
+    }
+
+    if (ret == 0) {
+        // a decoder can show a first picture once the DC scan is in, and
+        // the coarse luma AC at the start of the next SOS
+        size_t sos[2] = {0}, n = 0;
+        for (size_t i = 0; i + 1 < out.size && n < 3; i++)
+            if (out.buf[i] == 0xFF && out.buf[i + 1] == (JPEG_SOS & 0xFF)) {
+                if (n > 0)
+                    sos[n - 1] = i;
+                n++;
+            }
+        printf("progressive vs baseline optimized %+.2f%%, first picture "
+               "after %zu bytes (%.1f%%), coarse luma after %zu (%.1f%%)\n",
+               100. * ((double)sizes[2] / sizes[1] - 1.), sos[0],
+               100. * sos[0] / sizes[2], sos[1], 100. * sos[1] / sizes[2]);
+    }
+
+    free(out.buf);
+    pxb_free(pxb);
+    return ret;
+}
+
+// the per-pixel double precision converter rgb24_to_yuv420 was, chroma
+// from the top left pixel of each quad
+static void yuv420_per_pixel(size_t w, size_t h, const uint8_t *src,
+                             uint8_t *dst)
+{
+    uint8_t *y = dst, *u = y + w * h, *v = u + w * h / 4;
+
+    for (size_t i = 0; i < h; i++) {
+        for (size_t j = 0; j < w; j++) {
+            const uint8_t *p = src + (i * w + j) * 3;
+            YUV yuv = yuv_from_rgb(p[0], p[1], p[2]);
+
+            y[i * w + j] = yuv.y;
+            if (i % 2 == 0 && j % 2 == 0) {
+                *u++ = yuv.u;
+                *v++ = yuv.v;
+            }
+        }
+    }
+}
+
+// the decoder's conversion before the fused kernels: a row of every chroma
+// plane upsampled by repetition into a buffer, then converted per pixel
+// (4:2:0)
+static void rgb_upsampled_rows(size_t w, size_t h, const uint8_t *y,
+                               const uint8_t *cb, const uint8_t *cr,
+                               uint8_t *dst)
+{
+    size_t cw = (w + 1) / 2;
+    uint8_t *up = malloc(w * 2);
+
+    for (size_t i = 0; i < h; i++) {
+        const uint8_t *c[2] = {cb + i / 2 * cw, cr + i / 2 * cw};
+
+        for (int k = 0; k < 2; k++)
+            for (size_t x = 0; x < w; x++)
+                up[k * w + x] = c[k][x / 2];
+        for (size_t x = 0; x < w; x++) {
+            int l = y[i * w + x], u = up[x] - 128, v = up[w + x] - 128;
+            int rgb[3] = {l + ((91881 * v + 32768) >> 16),
+                          l + ((-22554 * u - 46802 * v + 32768) >> 16),
+                          l + ((116130 * u + 32768) >> 16)};
+
+            for (int k = 0; k < 3; k++)
+                dst[(i * w + x) * 3 + k] =
+                    rgb[k] < 0 ? 0 : rgb[k] > 255 ? 255 : rgb[k];
+        }
+    }
+    free(up);
+}
+
+// bench yuv [width] [height] [rounds] [max threads]
+static int bench_yuv(int argc, char *argv[])
+{
+    size_t w = arg_size(argc, argv, 0, 4000);
+    size_t h = arg_size(argc, argv, 1, 3000);
+    size_t rounds = arg_size(argc, argv, 2, 10);
+    int max_threads = arg_size(argc, argv, 3, 8);
+    size_t cw = (w + 1) / 2, ch = (h + 1) / 2, size = w * h + 2 * cw * ch;
+
+    uint8_t *src = random_plane(w * h * 3);
+    uint8_t *ref = malloc(size), *out = malloc(size);
+    double mpx = w * h / 1e6, t0 = now();
+
+    for (size_t r = 0; r < rounds; r++)
+        yuv420_per_pixel(w, h, src, out);
+    double t_old = (now() - t0) / rounds;
+    printf("yuv %zux%zu per-pixel double: %.3f ms, %.1f Mpx/s\n", w, h,
+           t_old * 1e3, mpx / t_old);
+
+    int ret = 0;
+    for (int range = YCC_JFIF; range <= YCC_BT601; range++) {
+        double t_one = 0;
+
+        rgb24_to_ycbcr420(range, w, h, src, w * 3, ref, w, ref + w * h,
+                          ref + w * h + cw * ch, cw);
+        for (int n = 1; n <= max_threads; n *= 2) {
+            xPool *pool = n > 1 ? pool_new(n) : NULL;
+
+            memset(out, 0, size);
+            t0 = now();
+            for (size_t r = 0; r < rounds; r++)
+                rgb24_to_ycbcr420_mt(pool, range, w, h, src, w * 3, out, w,
+                                     out + w * h, out + w * h + cw * ch, cw);
+            double t = (now() - t0) / rounds;
+            if (n == 1)
+                t_one = t;
+
+            int same = memcmp(out, ref, size) == 0;
+            printf("yuv %zux%zu %s [%s] %2d threads: %.3f ms, %.1f Mpx/s, "
+                   "x%.2f of per-pixel, x%.2f, %s\n",
+                   w, h, range == YCC_JFIF ? "jfif" : "bt601", yuv_isa(), n,
+                   t * 1e3, mpx / t, t_old / t, t_one / t,
+                   same ? "identical" : "DIFFERS");
+            ret |= same ? 0 : -1;
+            pool_free(pool);
+        }
+    }
+
+    free(src);
+    free(ref);
+    free(out);
+    return ret;
+}
+
+// bench ycc [width] [height] [rounds] [max threads]
+static int bench_ycc(int argc, char *argv[])
+{
+    size_t w = arg_size(argc, argv, 0, 4000);
+    size_t h = arg_size(argc, argv, 1, 3000);
+    size_t rounds = arg_size(argc, argv, 2, 10);
+    int max_threads = arg_size(argc, argv, 3, 8);
+    size_t cw = (w + 1) / 2, ch = (h + 1) / 2;
+
+    uint8_t *y = random_plane(w * h), *cb = random_plane(cw * ch);
+    uint8_t *cr = random_plane(cw * ch);
+    uint8_t *ref = malloc(w * h * 4), *out = malloc(w * h * 4);
+    double mpx = w * h / 1e6, t0 = now();
+
+    for (size_t r = 0; r < rounds; r++)
+        rgb_upsampled_rows(w, h, y, cb, cr, ref);
+    double t_old = (now() - t0) / rounds;
+    printf("ycc %zux%zu 4:2:0 upsampled rows: %.3f ms, %.1f Mpx/s\n", w, h,
+           t_old * 1e3, mpx / t_old);
+
+    int ret = 0;
+    for (int up = UPSAMPLE_NEAREST; up <= UPSAMPLE_FANCY; up++) {
+        for (int bpp = 3; bpp <= 4; bpp++) {
+            double t_one = 0;
+
+            for (int n = 1; n <= max_threads; n *= 2) {
+                xPool *pool = n > 1 ? pool_new(n) : NULL;
+
+                t0 = now();
+                for (size_t r = 0; r < rounds; r++)
+                    ycbcr_to_rgb_mt(pool, up, 2, 2, w, h, y, w, cb, cr, cw,
+                                    out, w * bpp, bpp);
+                double t = (now() - t0) / rounds;
+                if (n == 1)
+                    t_one = t;
+
+                // nearest rgb is what the rows gave
+                const char *check = "";
+                if (up == UPSAMPLE_NEAREST && bpp == 3) {
+                    int same = memcmp(out, ref, w * h * 3) == 0;
+                    check = same ? ", identical" : ", DIFFERS";
+                    ret |= same ? 0 : -1;
+                }
+                printf("ycc %zux%zu %s %s [%s] %2d threads: %.3f ms, "
+                       "%.1f Mpx/s, x%.2f of rows, x%.2f%s\n",
+                       w, h, up == UPSAMPLE_FANCY ? "fancy" : "nearest",
+                       bpp == 3 ? "rgb" : "rgba", yuv_isa(), n, t * 1e3,
+                       mpx / t, t_old / t, t_one / t, check);
+                pool_free(pool);
+            }
+        }
+    }
+
+    free(y);
+    free(cb);
+    free(cr);
+    free(ref);
+    free(out);
+    return ret;
+}
+
+// bench view [width] [height] [rounds]
+static int bench_view(int argc, char *argv[])
+{
+    size_t w = arg_size(argc, argv, 0, 4000);
+    size_t h = arg_size(argc, argv, 1, 3000);
+    size_t rounds = arg_size(argc, argv, 2, 100);
+    PixelBuffer *yuv = pxb_new(FMT_YUV420, w, h, NULL);
+    double mpx = w * h / 1e6;
+
+    memset(yuv->buf, 128, yuv->size);
+
+    // the luma of main's preview: a copy with the chroma reset, or a view
+    double t0 = now();
+    for (size_t r = 0; r < rounds; r++)
+        pxb_free(pxb_copy(yuv, CHAN_Y));
+    double t_copy = (now() - t0) / rounds;
+
+    t0 = now();
+    for (size_t r = 0; r < rounds; r++)
+        pxb_free(pxb_plane_view(yuv, 0));
+    double t_view = (now() - t0) / rounds;
+
+    // a centered quarter, copied out or viewed, then written after a copy
+    // on write
+    t0 = now();
+    for (size_t r = 0; r < rounds; r++) {
+        PixelBuffer *crop = pxb_crop(yuv, w / 4 & ~1, h / 4 & ~1, w / 2, h / 2);
+        pxb_make_writable(crop);
+        pxb_free(crop);
+    }
+    double t_cow = (now() - t0) / rounds;
+
+    t0 = now();
+    for (size_t r = 0; r < rounds; r++)
+        pxb_free(pxb_crop(yuv, w / 4 & ~1, h / 4 & ~1, w / 2, h / 2));
+    double t_crop = (now() - t0) / rounds;
+
+    printf("view %zux%zu yuv420 y plane: copy %.3f ms (%.1f Mpx/s), view "
+           "%.6f ms\n",
+           w, h, t_copy * 1e3, mpx / t_copy, t_view * 1e3);
+    printf("view %zux%zu yuv420 quarter crop: copy on write %.3f ms, view "
+           "%.6f ms\n",
+           w, h, t_cow * 1e3, t_crop * 1e3);
+
+    pxb_free(yuv);
+    return 0;
+}
+
+// bench pxk [width] [height] [rounds]
+static int bench_pxk(int argc, char *argv[])
+{
+    size_t w = arg_size(argc, argv, 0, 4000);
+    size_t h = arg_size(argc, argv, 1, 3000);
+    size_t rounds = arg_size(argc, argv, 2, 20);
+    size_t n = w * h;
+    uint8_t *rgb = random_plane(n * 3), *out = malloc(n * 4);
+    uint8_t *p[3] = {malloc(n), malloc(n), malloc(n)};
+    float *f = malloc(n * sizeof(float));
+    int16_t *s = malloc(n * sizeof(int16_t));
+    const uint8_t keep[3] = {0xFF, 0, 0xFF}, set[3] = {0, 128, 0};
+    int ret = 0;
+
+    // the bandwidth to compare with, reading and writing the rgb bytes
+    double t0 = now();
+    for (size_t r = 0; r < rounds; r++)
+        memcpy(out, rgb, n * 3);
+    double t_copy = (now() - t0) / rounds;
+    printf("pxk %zux%zu memcpy: %.3f ms, %.2f GB/s\n", w, h, t_copy * 1e3,
+           n * 6 / t_copy / 1e9);
+
+    // each kernel with the bytes it reads and writes, checked against the
+    // plain loop
+    for (int k = 0; k < 7; k++) {
+        const char *name = "";
+        size_t bytes = 0;
+
+        // masking is done in place, again and again to the same bytes
+        if (k == 0)
+            memcpy(out, rgb, n * 3);
+        t0 = now();
+        for (size_t r = 0; r < rounds; r++) {
+            switch (k) {
+            case 0:
+                pxb_mask_row(out, n, 3, keep, set);
+                name = "mask rgb24", bytes = n * 6;
+                break;
+            case 1:
+                pxb_rgb24_to_planes(rgb, n, p[0], p[1], p[2]);
+                name = "rgb24 to planes", bytes = n * 6;
+                break;
+            case 2:
+                pxb_planes_to_rgb24(p[0], p[1], p[2], n, out);
+                name = "planes to rgb24", bytes = n * 6;
+                break;
+            case 3:
+                pxb_u8_to_f32(rgb, n, f);
+                name = "u8 to f32", bytes = n * 5;
+                break;
+            case 4:
+                pxb_f32_to_u8(f, n, out);
+                name = "f32 to u8", bytes = n * 5;
+                break;
+            case 5:
+                pxb_u8_to_s16(rgb, n, s, -128);
+                name = "u8 to s16", bytes = n * 3;
+                break;
+            case 6:
+                pxb_s16_to_u8(s, n, out, 128);
+                name = "s16 to u8", bytes = n * 3;
+                break;
+            }
+        }
+        double t = (now() - t0) / rounds;
+
+        // the conversions back give the rgb bytes again
+        int same = 1;
+        for (size_t i = 0; i < n * 3; i++) {
+            switch (k) {
+            case 0:
+                same &= out[i] == ((rgb[i] & keep[i % 3]) | set[i % 3]);
+                break;
+            case 1:
+                same &= p[i % 3][i / 3] == rgb[i];
+                break;
+            case 2:
+                same &= out[i] == rgb[i];
+                break;
+            case 3:
+                same &= i >= n || f[i] == rgb[i];
+                break;
+            case 5:
+                same &= i >= n || s[i] == rgb[i] - 128;
+                break;
+            default:
+                same &= i >= n || out[i] == rgb[i];
+                break;
+            }
+        }
+        printf("pxk %zux%zu %s [%s]: %.3f ms, %.2f GB/s, x%.2f of memcpy, "
+               "%s\n",
+               w, h, name, pxb_isa(), t * 1e3, bytes / t / 1e9,
+               (bytes / t) / (n * 6 / t_copy), same ? "identical" : "DIFFERS");
+        ret |= same ? 0 : -1;
+    }
+
+    free(rgb);
+    free(out);
+    for (int i = 0; i < 3; i++)
+        free(p[i]);
+    free(f);
+    free(s);
+    return ret;
+}
+
+// bench ppm [ppm] [rounds]
+static int bench_ppm(int argc, char *argv[])
+{
+    const char *name = argc > 0 ? argv[0] : "Lenna.ppm";
+    size_t rounds = arg_size(argc, argv, 1, 10);
+    double t_read = 0, t_map = 0;
+    int ret = 0;
+
+    // both loaded and converted to 4:2:0 like main does, the mapped pixels
+    // are read for the first time by the conversion
+    for (size_t r = 0; r < rounds; r++) {
+        double t0 = now();
+        PPM *ppm = ppm_read_file(name);
+        if (ppm == NULL)
+            return -1;
+        PixelBuffer *rgb =
+            pxb_new(FMT_RGB24, ppm->width, ppm->height, ppm->data);
+        ppm_free(ppm);
+        PixelBuffer *ref = pxb_new(FMT_YUV420, rgb->w, rgb->h, NULL);
+        rgb24_to_ycbcr420(YCC_BT601, rgb->w, rgb->h, rgb->plane[0],
+                          rgb->stride[0], ref->plane[0], ref->stride[0],
+                          ref->plane[1], ref->plane[2], ref->stride[1]);
+        pxb_free(rgb);
+        t_read += now() - t0;
+
+        t0 = now();
+        rgb = ppm_map_file(name);
+        if (rgb == NULL || rgb->fmt != FMT_RGB24) {
+            pxb_free(rgb);
+            pxb_free(ref);
+            return -1;
+        }
+        PixelBuffer *out = pxb_new(FMT_YUV420, rgb->w, rgb->h, NULL);
+        rgb24_to_ycbcr420(YCC_BT601, rgb->w, rgb->h, rgb->plane[0],
+                          rgb->stride[0], out->plane[0], out->stride[0],
+                          out->plane[1], out->plane[2], out->stride[1]);
+        pxb_free(rgb);
+        t_map += now() - t0;
+
+        ret |= memcmp(out->buf, ref->buf, ref->size) ? -1 : 0;
+        pxb_free(ref);
+        pxb_free(out);
+    }
+    t_read /= rounds;
+    t_map /= rounds;
+
+    printf("ppm %s: read and copy %.3f ms, mapped %.3f ms, x%.2f, %s\n", name,
+           t_read * 1e3, t_map * 1e3, t_read / t_map,
+           ret ? "DIFFERS" : "identical");
+    return ret;
+}
+
+// the samples of an ascii ppm read one `fscanf` at a time, the way the
+// reader did it before
+static uint8_t *scanf_pnm(const char *name, size_t size)
+{
+    FILE *f = fopen(name, "rb");
+    uint8_t *data = malloc(size);
+    unsigned w, h, max, v;
+
+    if (f == NULL || data == NULL ||
+        fscanf(f, "P3 %u %u %u", &w, &h, &max) != 3)
+        goto fail;
+    for (size_t i = 0; i < size; i++) {
+        if (fscanf(f, "%u", &v) != 1)
+            goto fail;
+        data[i] = v;
+    }
+    fclose(f);
+    return data;
+
+fail:
+    if (f)
+        fclose(f);
+    free(data);
+    return NULL;
+}
+
+// all the rows of a ppm through the strip reader
+static uint8_t *read_pnm(const char *name)
+{
+    xPpmReader *r = ppm_reader_open(name);
+    if (r == NULL)
+        return NULL;
+
+    size_t row = fmt_get_row_size(r->fmt, 0, r->w);
+    uint8_t *data = malloc(row * r->h);
+    if (data && ppm_reader_read(r, data, row, r->h) != (long)r->h) {
+        free(data);
+        data = NULL;
+    }
+    ppm_reader_close(r);
+    return data;
+}
+
+// text files every reader has to turn down, the byte ending the last
+// sample included
+static const char *const bad_pnm[] = {
+    "P2 2 1 100\n8#\n8+",
+    "P2 3 1 15\n14 14 1-5 ",
+    "P2 2 1 100\n8 101\n",
+    "P3 1 1 255\n1 2 3x",
+    "P2 2 1 255\n1\n",
+    // the last sample read 64 bytes at a time
+    "P2 2 1 100\n8 8+                                                  "
+    "                              ",
+};
+
+// whether `ppm_read_file`, `ppm_map_file` and the strip reader all reject
+// each of `bad_pnm`, written to `name`
+static int rejects_bad_pnm(const char *name)
+{
+    for (size_t i = 0; i < sizeof(bad_pnm) / sizeof(bad_pnm[0]); i++) {
+        FILE *f = fopen(name, "wb");
+        if (f == NULL || fputs(bad_pnm[i], f) == EOF || fclose(f))
+            return 0;
+
+        PPM *ppm = ppm_read_file(name);
+        PixelBuffer *map = ppm_map_file(name);
+        uint8_t *data = read_pnm(name);
+        int rejected = !ppm && !map && !data;
+        ppm_free(ppm);
+        pxb_free(map);
+        free(data);
+        if (!rejected)
+            return 0;
+    }
+    return 1;
+}
+
+// bench pnm [ppm] [rounds]
+static int bench_pnm(int argc, char *argv[])
+{
+    const char *name = argc > 0 ? argv[0] : "Lenna.ppm";
+    size_t rounds = arg_size(argc, argv, 1, 10);
+    char ascii[] = "/tmp/bench-pnm-XXXXXX";
+    double t_bin = 0, t_ascii = 0, t_scanf = 0;
+    int ret = 0;
+
+    // an ascii copy of the binary ppm
+    PPM *ppm = ppm_read_file(name);
+    int fd = mkstemp(ascii);
+    if (ppm == NULL || fd < 0 || ppm->magic[1] != '6') {
+        ppm_free(ppm);
+        return -1;
+    }
+    close(fd);
+    ppm->magic[1] = '3';
+    ret = ppm_write_file(ppm, ascii);
+    size_t size = ppm->pitch * ppm->height;
+    struct stat st;
+    ret |= stat(ascii, &st);
+
+    // the mapped file is parsed to the same pixels
+    PixelBuffer *map = ret ? NULL : ppm_map_file(ascii);
+    for (size_t y = 0; map && y < map->h; y++)
+        ret |= memcmp(map->plane[0] + y * map->stride[0],
+                      ppm->data + y * ppm->pitch, ppm->pitch)
+                   ? -1
+                   : 0;
+    ret |= map ? 0 : -1;
+    pxb_free(map);
+
+    for (size_t r = 0; r < rounds && ret == 0; r++) {
+        double t0 = now();
+        uint8_t *bin = read_pnm(name);
+        t_bin += now() - t0;
+
+        t0 = now();
+        uint8_t *txt = read_pnm(ascii);
+        t_ascii += now() - t0;
+
+        t0 = now();
+        uint8_t *data = scanf_pnm(ascii, size);
+        t_scanf += now() - t0;
+
+        if (bin == NULL || txt == NULL || data == NULL ||
+            memcmp(bin, ppm->data, size) || memcmp(txt, ppm->data, size) ||
+            memcmp(data, ppm->data, size))
+            ret = -1;
+        free(bin);
+        free(txt);
+        free(data);
+    }
+    int rejects = rejects_bad_pnm(ascii);
+    unlink(ascii);
+    ppm_free(ppm);
+    t_bin /= rounds;
+    t_ascii /= rounds;
+    t_scanf /= rounds;
+
+    printf("pnm %s: binary %.3f ms, ascii %.3f ms (%.0f MB/s of text, x%.2f "
+           "of binary), fscanf %.3f ms (x%.1f slower), %s, malformed "
+           "text %s\n",
+           name, t_bin * 1e3, t_ascii * 1e3, st.st_size / t_ascii / 1e6,
+           t_ascii / t_bin, t_scanf * 1e3, t_scanf / t_ascii,
+           ret ? "DIFFERS" : "identical", rejects ? "rejected" : "ACCEPTED");
+    return ret || !rejects ? -1 : 0;
+}
+
+// the output hashed as it streams out
+typedef struct HashSink {
+    uint64_t hash;
+    size_t size;
+} HashSink;
+
+static int hash_write(const uint8_t *data, size_t size, void *payload)
+{
+    HashSink *sink = payload;
+
+    for (size_t i = 0; i < size; i++)
+        sink->hash = (sink->hash ^ data[i]) * 0x100000001B3ull;
+    sink->size += size;
+    return 0;
+}
+
+// the peak resident memory so far in MB
+static double peak_mb(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024.;
+}
+
+// bench stream [ppm] [quality]
+static int bench_stream(int argc, char *argv[])
+{
+    const char *name = argc > 0 ? argv[0] : "Lenna.ppm";
+    xJpgOptions opt = JPG_OPTIONS_DEFAULT;
+    opt.quality = arg_size(argc, argv, 1, 75);
+
+    // streamed first, the peak only goes up
+    HashSink strips = {0xCBF29CE484222325ull}, whole = strips;
+    double mb0 = peak_mb(), t0 = now();
+    if (jpg_write_ppm(name, &opt, hash_write, &strips) < 0)
+        return -1;
+    double t_strips = now() - t0, mb_strips = peak_mb() - mb0;
+
+    mb0 = peak_mb();
+    t0 = now();
+    PixelBuffer *pxb = ppm_map_file(name);
+    int ret = pxb ? jpg_write_pxb(pxb, &opt, hash_write, &whole) : -1;
+    pxb_free(pxb);
+    double t_whole = now() - t0, mb_whole = peak_mb() - mb0;
+    if (ret < 0)
+        return -1;
+
+    int same = strips.hash == whole.hash && strips.size == whole.size;
+    printf("stream %s: strips %.3f ms, +%.1f MB peak; whole image %.3f ms, "
+           "+%.1f MB peak; %zu bytes, %s\n",
+           name, t_strips * 1e3, mb_strips, t_whole * 1e3, mb_whole,
+           strips.size, same ? "identical" : "DIFFERS");
+    return same ? 0 : -1;
+}
+
+static const BenchCase cases[] = {
+    {"dct", "whole matrix 8x8 dct/idct throughput", bench_dct},
+    {"coef", "float vs int16 fixed-point quantized coefficients", bench_coef},
+    {"tiled", "raster vs block-major matrix dct/idct", bench_tiled},
+    {"enc", "multi-pass vs fused single-pass block encoder time and traffic",
+     bench_enc},
+    {"mt", "thread pool scaling of the whole matrix dct/idct", bench_mt},
+    {"quant", "per-element callback vs block kernel quantizer", bench_quant},
+    {"huff", "huffman coder throughput on a ppm's luma", bench_huff},
+    {"jpg", "baseline jfif encode time per megapixel", bench_jpg},
+    {"gray", "single component vs rgb jfif encode time", bench_gray},
+    {"jdec", "baseline jpeg decode throughput", bench_jdec},
+    {"rst", "restart interval parallel entropy coding and decoding",
+     bench_rst},
+    {"prog", "progressive vs baseline jfif size and encode time", bench_prog},
+    {"yuv", "fixed-point simd rgb to YCbCr 4:2:0 vs per-pixel", bench_yuv},
+    {"ycc", "fused upsampling simd YCbCr 4:2:0 to rgb vs per-row", bench_ycc},
+    {"view", "zero-copy plane and crop views vs copies", bench_view},
+    {"pxk", "simd pixel kernels bandwidth vs memcpy", bench_pxk},
+    {"ppm", "memory mapped vs read and copied ppm to 4:2:0", bench_ppm},
+    {"pnm", "ascii vs binary ppm strip reader, and fscanf", bench_pnm},
+    {"stream", "strip-streamed vs whole image jfif encode", bench_stream},
+};
+
+static void usage(const char *name)
+{
+    printf("usage: [CPU_MASK=<features>] %s <case> [args...]\n", name);
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        printf("  %-10s %s\n", cases[i].name, cases[i].desc);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    // e.g. CPU_MASK=0 runs the scalar kernels, see cpu.h for the bits
+    if (getenv("CPU_MASK"))
+        cpu_set_mask(strtol(getenv("CPU_MASK"), NULL, 0));
+
+    int ret = -1;
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (strcmp(argv[1], cases[i].name) == 0) {
+            ret = cases[i].run(argc - 2, argv + 2);
+            break;
+        }
+    }
+    if (ret < 0 && argc >= 2)
+        usage(argv[0]);
+
+    dct_cleanup();
+    return ret;
+}
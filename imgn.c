@@ -1,6 +1,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "src/blk.h"
 #include "src/dct.h"
@@ -42,12 +43,12 @@ static xReal rescale(xBlock blk, xReal x, int i, int j, void *_payload)
 
 void calculate_min_max(xBlock blk, int w, int h, xReal *minmax)
 {
-    minmax[0] = blk[0][0];
-    minmax[1] = blk[0][0];
+    minmax[0] = blk.data[0];
+    minmax[1] = blk.data[0];
 
     for (int i = 0; i < w * h; i++) {
-        minmax[0] = min(minmax[0], blk[0][i]);
-        minmax[1] = max(minmax[1], blk[0][i]);
+        minmax[0] = min(minmax[0], blk.data[i]);
+        minmax[1] = max(minmax[1], blk.data[i]);
     }
 }
 
@@ -55,8 +56,8 @@ void gen_blk(int formula, xBlock blk, int w, int h)
 {
     for (int i = 0; i < h; ++i) {
         for (int j = 0; j < w; ++j) {
-            blk[i][j] = (sinf(j * w / (2 * M_PI)) + 1) * 128;
-            blk[j][i] = (sinf(i * h / (2 * M_PI)) + 1) * 128;
+            BLK_AT(blk, i, j) = (sinf(j * w / (2 * M_PI)) + 1) * 128;
+            BLK_AT(blk, j, i) = (sinf(i * h / (2 * M_PI)) + 1) * 128;
         }
     }
 }
@@ -64,7 +65,7 @@ void gen_blk(int formula, xBlock blk, int w, int h)
 void blk2uint8(xBlock blk, uint8_t *buf, int w, int h)
 {
     for (int i = 0; i < w * h; i++) {
-        buf[i] = (uint8_t)blk[0][i];
+        buf[i] = (uint8_t)blk.data[i];
     }
 }
 
@@ -85,14 +86,14 @@ int gen_base_blks(int n)
     for (i = 0; i < n; i++) {
         for (j = 0; j < n; j++) {
             blk_clear(blk, 0);
-            blk[i][j] = 255;
+            BLK_AT(blk, i, j) = 255;
             idct(blk, blk, n, n);
             mat_set_blk(mat, blk, i * n + j);
         }
     }
 
-    blk2uint8(&mat, buf, n * n, n * n);
-    write_file(ppm, &mat, "base.pgm");
+    blk2uint8(blk_wrap(mat, n * n, n * n), buf, n * n, n * n);
+    write_file(ppm, blk_wrap(mat, n * n, n * n), "base.pgm");
 
     mat_free(mat);
     blk_free(blk);
@@ -103,6 +104,33 @@ int gen_base_blks(int n)
 
 int main(int argc, char *argv[])
 {
+    int opt;
+    DctPlanRigor rigor = DCT_PLAN_ESTIMATE;
+    const char *wisdom_file = NULL;
+
+    while ((opt = getopt(argc, argv, "p:w:")) != -1) {
+        switch (opt) {
+        case 'p':
+            rigor = dct_rigor_from_name(optarg);
+            break;
+        case 'w':
+            wisdom_file = optarg;
+            break;
+        default:
+            rigor = DCT_PLAN_INVALID;
+            break;
+        }
+    }
+
+    if (rigor == DCT_PLAN_INVALID || dct_planner_init(rigor, wisdom_file) < 0) {
+        printf("usage: %s [-p estimate|measure|patient|exhaustive] "
+               "[-w wisdom_file]\n",
+               argv[0]);
+        return -1;
+    }
+    dct_planner_warmup(N, 0, 0);
+    dct_planner_save();
+
     uint8_t *buf = malloc(sizeof(uint8_t) * N * N);
     xBlock blk_idct = blk_calloc(N, N);
     xBlock blk_dct = blk_copy(blk_idct);
@@ -130,8 +158,8 @@ int main(int argc, char *argv[])
     write_file(ppm, blk_idct, "sin.idct.pgm");
 
     blk_clear(blk_idct, 0);
-    blk_idct[5][0] = 255;
-    blk_idct[0][5] = 255;
+    BLK_AT(blk_idct, 5, 0) = 255;
+    BLK_AT(blk_idct, 0, 5) = 255;
     blk_print("test idct", blk_idct, 0);
     write_file(ppm, blk_idct, "test.idct.pgm");
 
@@ -149,5 +177,7 @@ int main(int argc, char *argv[])
     blk_free(blk_idct);
     free(buf);
 
+    dct_cleanup();
+
     printf("bye!\n");
 }
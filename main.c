@@ -1,5 +1,8 @@
 #include <limits.h>
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_rect.h>
@@ -10,6 +13,8 @@
 #include "src/blk.h"
 #include "src/dct.h"
 #include "src/huff.h"
+#include "src/jdec.h"
+#include "src/jpg.h"
 #include "src/ppm.h"
 #include "src/pxb.h"
 #include "src/rle.h"
@@ -79,6 +84,8 @@ static const xReal QUANTIZE_TBLS[][8][8] = {
 
 static int interrupted = 0;
 static int QF = 1;
+// reciprocals of QUANTIZE_TBLS[QF]
+static xReal quant_recip[N * N];
 
 static int handle_mouse_click(SDL_Window *w, SDL_Event ev)
 {
@@ -168,45 +175,20 @@ void draw_raster(uint8_t *pixels, size_t w, size_t h)
     }
 }
 
-void float_from_uint8_t(float *dst, uint8_t *src, size_t size)
+// between a packed `w*h` float matrix and a plane of `stride` byte rows
+void float_from_uint8_t(float *dst, const uint8_t *src, size_t w, size_t h,
+                        size_t stride)
 {
-    for (int i = 0; i < size; i++) {
-        dst[i] = (float)src[i];
-    }
-}
-
-void float_to_uint8_t(uint8_t *dst, float *src, size_t size)
-{
-    for (int i = 0; i < size; i++) {
-        dst[i] = (uint8_t)(src[i]);
-    }
-}
-
-static inline xReal min(xReal x, xReal y) { return x > y ? y : x; }
-static inline xReal max(xReal x, xReal y) { return x < y ? y : x; }
-
-static xReal lshift128(xBlock blk, xReal x, int i, int j, void *payload)
-{
-    return x - 128;
-}
-
-static xReal rshift128(xBlock blk, xReal x, int i, int j, void *payload)
-{
-    return x + 128;
+    for (size_t y = 0; y < h; y++)
+        pxb_u8_to_f32(src + y * stride, w, dst + y * w);
 }
 
-static xReal normalize(xBlock blk, xReal x, int i, int j, void *payload)
+void float_to_uint8_t(uint8_t *dst, const float *src, size_t w, size_t h,
+                      size_t stride)
 {
-
-    xReal *minmax = payload;
-    xReal minv = minmax[0], maxv = minmax[1];
-
-    return 255. * (x - minv) / (maxv - minv);
-}
-
-static xReal quantize(xBlock blk, xReal x, int i, int j, void *_payload)
-{
-    return roundf(x / QUANTIZE_TBLS[QF][i][j]);
+    // rounded and saturated, the idct and the diff overshoot 0..255
+    for (size_t y = 0; y < h; y++)
+        pxb_f32_to_u8(src + y * w, w, dst + y * stride);
 }
 
 static xReal reverse(xBlock blk, xReal x, int i, int j, void *_payload)
@@ -214,51 +196,51 @@ static xReal reverse(xBlock blk, xReal x, int i, int j, void *_payload)
     return 128. - (x > 0 ? x : -x);
 }
 
-static xReal dequantize(xBlock blk, xReal x, int i, int j, void *_payload)
+static void lshift128_block(xTileMat tm, xBlock blk, size_t idx,
+                            void *_payload)
 {
-    return roundf(x * QUANTIZE_TBLS[QF][i][j]);
+    blk_shift(blk, -128);
 }
 
-static xBlock lshift128_block(xMat mat, xBlock blk, int idx, void *_payload)
+static void rshift128_block(xTileMat tm, xBlock blk, size_t idx,
+                            void *_payload)
 {
-    blk_foreachi(blk, lshift128, NULL);
-    return blk;
+    blk_shift(blk, 128);
 }
 
-static xBlock rshift128_block(xMat mat, xBlock blk, int idx, void *_payload)
+static void reverse_block(xTileMat tm, xBlock blk, size_t idx, void *_payload)
 {
-    blk_foreachi(blk, rshift128, NULL);
-    return blk;
+    blk_foreachi(blk, reverse, NULL);
 }
 
-static xBlock reverse_block(xMat mat, xBlock blk, int idx, void *_payload)
+static void normalize_block(xTileMat tm, xBlock blk, size_t idx,
+                            void *_payload)
 {
-    blk_foreachi(blk, reverse, NULL);
-    return blk;
+    blk_normalize(blk, 0, 255);
 }
 
-static xBlock normalize_block(xMat mat, xBlock blk, int idx, void *_payload)
+static void quantize_block(xTileMat tm, xBlock blk, size_t idx,
+                           void *_payload)
 {
-    xReal minmax[2] = {blk[0][0], blk[0][0]};
-
-    for (int i = 0; i < N * N; i++) {
-        minmax[0] = min(minmax[0], blk[0][i]);
-        minmax[1] = max(minmax[1], blk[0][i]);
-    }
-    blk_foreachi(blk, normalize, minmax);
-    return blk;
+    blk_quantize(blk, quant_recip);
 }
 
-static xBlock quantize_block(xMat mat, xBlock blk, int idx, void *_payload)
+static void dequantize_block(xTileMat tm, xBlock blk, size_t idx,
+                             void *_payload)
 {
-    blk_foreachi(blk, quantize, NULL);
-    return blk;
+    blk_dequantize(blk, QUANTIZE_TBLS[QF][0]);
 }
 
-static xBlock dequantize_block(xMat mat, xBlock blk, int idx, void *_payload)
+// a ppm or pgm, or a jpeg by its extension
+static PixelBuffer *load_image(const char *name)
 {
-    blk_foreachi(blk, dequantize, NULL);
-    return blk;
+    const char *ext = strrchr(name, '.');
+    if (ext && (strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0))
+        return jdec_decode_file(name);
+
+    // the pixels stay in the mapped file, the conversion reads them once. a
+    // graymap comes as FMT_GRAY8
+    return ppm_map_file(name);
 }
 
 /*
@@ -271,14 +253,62 @@ static xBlock dequantize_block(xMat mat, xBlock blk, int idx, void *_payload)
  */
 int main(int argc, char *argv[])
 {
-    if (argc < 2) {
-        printf("usage: %s <ppm_file>\n", argv[0]);
+    int opt;
+    DctPlanRigor rigor = DCT_PLAN_ESTIMATE;
+    const char *wisdom_file = NULL;
+    const char *jpg_file = NULL;
+    int stream = 0;
+
+    while ((opt = getopt(argc, argv, "p:w:o:s")) != -1) {
+        switch (opt) {
+        case 'p':
+            rigor = dct_rigor_from_name(optarg);
+            break;
+        case 'w':
+            wisdom_file = optarg;
+            break;
+        case 'o':
+            jpg_file = optarg;
+            break;
+        case 's':
+            stream = 1;
+            break;
+        default:
+            rigor = DCT_PLAN_INVALID;
+            break;
+        }
+    }
+
+    if (optind >= argc || rigor == DCT_PLAN_INVALID ||
+        (stream && jpg_file == NULL)) {
+        printf("usage: %s [-p estimate|measure|patient|exhaustive] "
+               "[-w wisdom_file] [-o jpg_file] <ppm_file|jpg_file>\n"
+               "       %s -s -o jpg_file <ppm_file>\n",
+               argv[0], argv[0]);
         return -1;
     }
 
-    const char *file_name = argv[1];
+    const char *file_name = argv[optind];
+
+    // a strip at a time straight to the jpeg, no preview: the memory grows
+    // with the width only, for images too large to hold
+    if (stream) {
+        xJpgOptions jpg_opt = {75, 1};
+        if (jpg_write_ppm_file(file_name, &jpg_opt, jpg_file) < 0) {
+            fprintf(stderr, "failed to encode %s to %s\n", file_name,
+                    jpg_file);
+            return -1;
+        }
+        return 0;
+    }
 
     int ret;
+    ret = dct_planner_init(rigor, wisdom_file);
+    if (ret < 0) {
+        fprintf(stderr, "failed to init dct planner\n");
+        exit(-1);
+    }
+
     ret = SDL_Init(SDL_INIT_VIDEO);
     if (ret < 0) {
         fprintf(stderr, "failed to init sdl2: %s\n", SDL_GetError());
@@ -286,54 +316,67 @@ int main(int argc, char *argv[])
     }
 
     printf("\n======== origin ========\n");
-    PPM *ppm = ppm_read_file(file_name);
-    size_t w = ppm->width, h = ppm->height;
-
-    PixelBuffer *rgb_buf = pxb_new(FMT_RGB24, w, h, ppm->data);
-    PixelBuffer *yuv_buf = pxb_new(FMT_YUV420, w, h, NULL);
+    PixelBuffer *src_buf = load_image(file_name);
+    if (src_buf == NULL) {
+        fprintf(stderr, "failed to read %s\n", file_name);
+        exit(-1);
+    }
+    size_t w = src_buf->w, h = src_buf->h;
+    int gray = src_buf->fmt == FMT_GRAY8;
 
-    ppm_free(ppm);
+    // plan ahead for this image size, then keep the plans for next runs
+    dct_planner_warmup(N, w, h);
+    dct_planner_save();
 
     printf("\n========encoding========\n");
-    // rgb to yuv and subsampling
-    rgb24_to_yuv420(w, h, rgb_buf->buf, yuv_buf->buf);
+    blk_quant_recip(quant_recip, QUANTIZE_TBLS[QF][0], N * N);
+
+    // rgb to yuv and subsampling, a graymap already is the luma
+    PixelBuffer *yuv_buf;
+    if (gray) {
+        yuv_buf = pxb_view(src_buf);
+    } else {
+        yuv_buf = pxb_new(FMT_YUV420, w, h, NULL);
+        rgb24_to_ycbcr420(YCC_BT601, w, h, src_buf->plane[0],
+                          src_buf->stride[0], yuv_buf->plane[0],
+                          yuv_buf->stride[0], yuv_buf->plane[1],
+                          yuv_buf->plane[2], yuv_buf->stride[1]);
+    }
 
-    // extract y plane
-    PixelBuffer *yplane = pxb_copy(yuv_buf, CHAN_Y);
-    PixelBuffer *dctplane = pxb_copy(yplane, CHAN_Y);
-    PixelBuffer *idctplane = pxb_copy(yplane, CHAN_Y);
-    PixelBuffer *diffplane = pxb_copy(yplane, CHAN_Y);
+    // view the y plane in place, the planes drawn from the matrices below
+    // get buffers of their own
+    PixelBuffer *yplane = pxb_plane_view(yuv_buf, 0);
+    PixelBuffer *dctplane = pxb_new(FMT_GRAY8, w, h, NULL);
+    PixelBuffer *idctplane = pxb_new(FMT_GRAY8, w, h, NULL);
+    PixelBuffer *diffplane = pxb_new(FMT_GRAY8, w, h, NULL);
 
-    xMat mat = mat_calloc(w, h), orig_mat, dct_mat, idct_mat, diff_mat;
-    xBlock blk = blk_calloc(N, N);
+    // the blocks are processed in place on block-major matrices padded to
+    // whole blocks, so the image size needn't be a multiple of N
+    xMat mat = mat_calloc(w, h);
+    xTileMat tm = tmat_calloc(w, h, N), orig_tm, dct_tm, idct_tm, diff_tm;
+    xBlock blk = tmat_get_blk(tm, BLKID);
 
-    float_from_uint8_t(mat, yplane->buf, w * h);
-    orig_mat = mat_copy(mat);
-    diff_mat = mat_copy(mat);
+    float_from_uint8_t(mat, yplane->plane[0], w, h, yplane->stride[0]);
+    tmat_from_mat(tm, mat);
+    orig_tm = tmat_copy(tm);
+    diff_tm = tmat_copy(tm);
 
     // raw blk
-    mat_get_blk(mat, blk, BLKID);
     blk_print("raw", blk, BLKID);
 
     // left shift 128
-    mat_foreach_blk(mat, N, lshift128_block, NULL);
-    mat_get_blk(mat, blk, BLKID);
+    tmat_foreach_blk(tm, lshift128_block, NULL);
     blk_print("lshift raw", blk, BLKID);
 
     // DCT
-    mat_dct_blks(mat, N);
-#ifdef USE_FFTW3
-    mat_product_n(mat, 2. / (N * N), mat);
-#endif
-    mat_get_blk(mat, blk, BLKID);
+    tmat_dct_blks(tm);
     blk_print("dct", blk, BLKID);
 
-    idct_mat = mat_copy(mat);
-    dct_mat = mat_copy(mat);
+    idct_tm = tmat_copy(tm);
+    dct_tm = tmat_copy(tm);
 
     // quantize
-    mat_foreach_blk(mat, N, quantize_block, NULL);
-    mat_get_blk(mat, blk, BLKID);
+    tmat_foreach_blk(tm, quantize_block, NULL);
     blk_print("quantized", blk, BLKID);
 
     // zigzag
@@ -341,51 +384,59 @@ int main(int argc, char *argv[])
     blk_zigzag(blk, zigzag_blk);
     blk_print("zigzag", zigzag_blk, BLKID);
 
-    // TODO: diff DC encoding
-
     // run-length
     xRLETable tbl = rtb_calloc(N * N);
     int tbl_len = rtb_parse(tbl, zigzag_blk);
     rtb_print(tbl, tbl_len);
 
-    // huffman
-    huff_encode_tbl(NULL, tbl);
+    // huffman, the DC of every block coded as the difference to the last one
+    xBitWriter bw;
+    int16_t last_dc = 0;
+    bw_init(&bw, w * h / 4);
+    for (size_t i = 0; i < tmat_count_blks(tm); i++) {
+        blk_zigzag(tmat_get_blk(tm, i), zigzag_blk);
+        rtb_parse(tbl, zigzag_blk);
+        huff_encode_blk(&bw, huff_std_dc(), huff_std_ac(),
+                        (int16_t)zigzag_blk.data[0], &last_dc, tbl);
+    }
+    bw_flush(&bw);
+    printf("huffman: %zu bytes, %.3f bits/pixel\n", bw.size,
+           8. * bw.size / (w * h));
+
+    xJpgOptions jpg_opt = {75, 1};
+    if (jpg_file && jpg_write_file(src_buf, &jpg_opt, jpg_file) < 0)
+        fprintf(stderr, "failed to write %s\n", jpg_file);
 
     printf("\n========decoding========\n");
 
     // normalize DCT for showing
-    mat_foreach_blk(dct_mat, N, normalize_block, NULL);
-    mat_get_blk(dct_mat, blk, BLKID);
-    blk_print("normalized dct", blk, BLKID);
+    tmat_foreach_blk(dct_tm, normalize_block, NULL);
+    blk_print("normalized dct", tmat_get_blk(dct_tm, BLKID), BLKID);
 
     // inverse DCT
-    mat_foreach_blk(idct_mat, N, quantize_block, NULL);
-    mat_foreach_blk(idct_mat, N, dequantize_block, NULL);
-
-#ifdef USE_FFTW3
-    mat_product_n(idct_mat, N * N / 2., idct_mat);
-#endif
-    mat_idct_blks(idct_mat, N);
-#ifdef USE_FFTW3
-    mat_product_n(idct_mat, 1. / (4. * N * N), idct_mat);
-#endif
-    mat_get_blk(idct_mat, blk, BLKID);
-    blk_print("idct", blk, BLKID);
+    tmat_foreach_blk(idct_tm, quantize_block, NULL);
+    tmat_foreach_blk(idct_tm, dequantize_block, NULL);
+
+    tmat_idct_blks(idct_tm);
+    blk_print("idct", tmat_get_blk(idct_tm, BLKID), BLKID);
 
     // right shift 128
-    mat_foreach_blk(idct_mat, N, rshift128_block, NULL);
-    mat_get_blk(idct_mat, blk, BLKID);
-    blk_print("rshift idct", blk, BLKID);
+    tmat_foreach_blk(idct_tm, rshift128_block, NULL);
+    blk_print("rshift idct", tmat_get_blk(idct_tm, BLKID), BLKID);
 
-    mat_diff(orig_mat, idct_mat, diff_mat);
-    mat_get_blk(diff_mat, blk, BLKID);
-    mat_foreach_blk(diff_mat, N, reverse_block, NULL);
-    blk_print("diff idct", blk, BLKID);
+    for (size_t i = 0; i < tmat_count_blks(diff_tm); i++)
+        blk_diff(tmat_get_blk(orig_tm, i), tmat_get_blk(idct_tm, i),
+                 tmat_get_blk(diff_tm, i));
+    blk_print("diff idct", tmat_get_blk(diff_tm, BLKID), BLKID);
+    tmat_foreach_blk(diff_tm, reverse_block, NULL);
 
     // copy back to uint8 buffer for showing
-    float_to_uint8_t(dctplane->buf, dct_mat, w * h);
-    float_to_uint8_t(idctplane->buf, idct_mat, w * h);
-    float_to_uint8_t(diffplane->buf, diff_mat, w * h);
+    tmat_to_mat(mat, dct_tm);
+    float_to_uint8_t(dctplane->plane[0], mat, w, h, dctplane->stride[0]);
+    tmat_to_mat(mat, idct_tm);
+    float_to_uint8_t(idctplane->plane[0], mat, w, h, idctplane->stride[0]);
+    tmat_to_mat(mat, diff_tm);
+    float_to_uint8_t(diffplane->plane[0], mat, w, h, diffplane->stride[0]);
 
     /* draw_raster(yplane->buf, w, h); */
     /* draw_raster(idctplane->buf, w, h); */
@@ -402,19 +453,22 @@ int main(int argc, char *argv[])
     }
 
     // EXIT:
+    bw_free(&bw);
     rtb_free(tbl);
     mat_free(mat);
-    mat_free(dct_mat);
-    mat_free(idct_mat);
+    tmat_free(tm);
+    tmat_free(orig_tm);
+    tmat_free(dct_tm);
+    tmat_free(idct_tm);
+    tmat_free(diff_tm);
     blk_free(zigzag_blk);
-    blk_free(blk);
 
     pxb_free(diffplane);
     pxb_free(idctplane);
     pxb_free(dctplane);
     pxb_free(yplane);
     pxb_free(yuv_buf);
-    pxb_free(rgb_buf);
+    pxb_free(src_buf);
 
     destroy_preview_window(diff_win);
     destroy_preview_window(idct_win);
@@ -422,5 +476,7 @@ int main(int argc, char *argv[])
     destroy_preview_window(y_win);
     destroy_preview_window(yuv_win);
 
+    dct_cleanup();
+
     printf("bye\n");
 }
@@ -1,138 +1,196 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "blk.h"
+#include "pool.h"
 
-static inline int min(int x, int y) { return x > y ? y : x; }
+static inline size_t min_sz(size_t x, size_t y) { return x > y ? y : x; }
 // static inline int max(int x, int y) { return x > y ? x : y; } // NOLINT
 
 xBlock blk_calloc(size_t dimX, size_t dimY)
 {
-    xReal **m = calloc(dimX, sizeof(xReal *));
-    xReal *data = calloc(dimX * dimY + 2, sizeof(xReal));
-    xReal *head = data + 2;
+    // aligned_alloc wants a multiple of the alignment
+    size_t size = sizeof(xReal) * dimX * dimY;
+    size = (size + BLK_ALIGN - 1) / BLK_ALIGN * BLK_ALIGN;
 
-    data[0] = (xReal)dimX;
-    data[1] = (xReal)dimY;
+    xReal *data = aligned_alloc(BLK_ALIGN, size);
+    memset(data, 0, size);
+    return blk_wrap(data, dimX, dimY);
+}
 
-    for (int i = 0; i < dimX; i++) {
-        m[i] = &head[i * dimY];
-    }
-    return m;
+xBlock blk_wrap(xReal *data, size_t w, size_t h)
+{
+    return (xBlock){data, w, h};
 }
 
 xBlock blk_copy(xBlock blk)
 {
-    size_t w = blk_get_width(blk);
-    size_t h = blk_get_height(blk);
-
-    xBlock copy = blk_calloc(w, h);
-    memcpy(copy[0], blk[0], w * h);
+    xBlock copy = blk_calloc(blk.w, blk.h);
+    memcpy(copy.data, blk.data, sizeof(xReal) * blk.w * blk.h);
     return copy;
 }
 
-void blk_free(xBlock blk)
-{
-    free(blk[0] - 2);
-    free((xReal **)blk);
-}
+void blk_free(xBlock blk) { free(blk.data); }
 
-size_t blk_get_width(xBlock blk) { return blk[0][-2]; }
+size_t blk_get_width(xBlock blk) { return blk.w; }
 
-size_t blk_get_height(xBlock blk) { return blk[0][-1]; }
+size_t blk_get_height(xBlock blk) { return blk.h; }
 
 void blk_foreachi(xBlock blk, xBlkIterFn iter_func, void *payload)
 {
     if (iter_func == NULL)
         return;
 
-    int w = blk_get_width(blk);
-    int h = blk_get_height(blk);
+    int w = blk.w, h = blk.h;
 
     for (int i = 0; i < h; i++) {
         for (int j = 0; j < w; j++) {
-            blk[i][j] = iter_func(blk, blk[i][j], i, j, payload);
+            xReal *v = &BLK_AT(blk, i, j);
+            *v = iter_func(blk, *v, i, j, payload);
         }
     }
 }
 
+#define BLK_MAP_LOOP(size, expr)                                               \
+    for (size_t i = 0; i < (size); i++) {                                      \
+        xReal x = p[i];                                                        \
+        p[i] = (expr);                                                         \
+    }
+
+// an inplace kernel specialized on `expr` of the element `x` at index `i`, a
+// plain loop without calls the compiler can inline and vectorize. the 8x8
+// case gets its own copy with a constant trip count, which vectorizes
+// without loop versioning even at -O2
+#define BLK_MAP(name, params, expr)                                            \
+    void name params                                                           \
+    {                                                                          \
+        xReal *restrict p = blk.data;                                          \
+        size_t size = (size_t)blk.w * blk.h;                                   \
+        if (size == 64) {                                                      \
+            BLK_MAP_LOOP(64, expr);                                            \
+        } else {                                                               \
+            BLK_MAP_LOOP(size, expr);                                          \
+        }                                                                      \
+    }
+
+// `roundf` without the libm call, halves away from zero
+static inline xReal round_half(xReal x)
+{
+    return (xReal)(int32_t)(x + copysignf(0.5f, x));
+}
+
+BLK_MAP(blk_shift, (xBlock blk, xReal n), x + n)
+BLK_MAP(blk_clamp, (xBlock blk, xReal lo, xReal hi),
+        x < lo ? lo : (x > hi ? hi : x))
+BLK_MAP(blk_scale, (xBlock blk, xReal a, xReal b), x * a + b)
+BLK_MAP(blk_quantize, (xBlock blk, const xReal *restrict recip),
+        round_half(x * recip[i]))
+BLK_MAP(blk_dequantize, (xBlock blk, const xReal *restrict tbl), x * tbl[i])
+
+void blk_quant_recip(xReal *recip, const xReal *tbl, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        recip[i] = 1 / tbl[i];
+}
+
+void blk_minmax(xBlock blk, xReal *lo, xReal *hi)
+{
+    const xReal *p = blk.data;
+    size_t n = (size_t)blk.w * blk.h;
+    xReal minv = p[0], maxv = p[0];
+
+    for (size_t i = 1; i < n; i++) {
+        minv = p[i] < minv ? p[i] : minv;
+        maxv = p[i] > maxv ? p[i] : maxv;
+    }
+    *lo = minv;
+    *hi = maxv;
+}
+
+void blk_normalize(xBlock blk, xReal lo, xReal hi)
+{
+    xReal minv, maxv;
+
+    blk_minmax(blk, &minv, &maxv);
+    if (maxv == minv) {
+        blk_clear(blk, lo);
+        return;
+    }
+
+    xReal a = (hi - lo) / (maxv - minv);
+    blk_scale(blk, a, lo - minv * a);
+}
+
 void blk_add(xBlock a, xBlock b, xBlock c)
 {
-    int w = blk_get_width(a);
-    int h = blk_get_height(a);
+    int w = a.w, h = a.h;
     for (int i = 0; i < w * h; i++) {
-        c[0][i] = a[0][i] + b[0][i];
+        c.data[i] = a.data[i] + b.data[i];
     }
 }
 
 void blk_diff(xBlock a, xBlock b, xBlock c)
 {
 
-    int w = blk_get_width(a);
-    int h = blk_get_height(a);
+    int w = a.w, h = a.h;
     for (int i = 0; i < w * h; i++) {
-        c[0][i] = a[0][i] - b[0][i];
+        c.data[i] = a.data[i] - b.data[i];
     }
 }
 
 void blk_product(xBlock a, xBlock b, xBlock c)
 {
 
-    int w = blk_get_width(a);
-    int h = blk_get_height(a);
+    int w = a.w, h = a.h;
     for (int i = 0; i < w * h; i++) {
-        c[0][i] = a[0][i] * b[0][i];
+        c.data[i] = a.data[i] * b.data[i];
     }
 }
 
 void blk_devide(xBlock a, xBlock b, xBlock c)
 {
 
-    int w = blk_get_width(a);
-    int h = blk_get_height(a);
+    int w = a.w, h = a.h;
     for (int i = 0; i < w * h; i++) {
-        c[0][i] = a[0][i] / b[0][i]; // devide by zero?
+        c.data[i] = a.data[i] / b.data[i]; // devide by zero?
     }
 }
 
 void blk_add_n(xBlock in, xReal n, xBlock out)
 {
-    int w = blk_get_width(in);
-    int h = blk_get_height(in);
+    int w = in.w, h = in.h;
     for (int i = 0; i < w * h; i++) {
-        out[0][i] = in[0][i] + n;
+        out.data[i] = in.data[i] + n;
     }
 }
 
 void blk_product_n(xBlock in, xReal n, xBlock out)
 {
-    int w = blk_get_width(in);
-    int h = blk_get_height(in);
+    int w = in.w, h = in.h;
     for (int i = 0; i < w * h; i++) {
-        out[0][i] = in[0][i] * n;
+        out.data[i] = in.data[i] * n;
     }
 }
 
 void blk_clear(xBlock blk, xReal n)
 {
-    int w = blk_get_width(blk);
-    int h = blk_get_height(blk);
+    int w = blk.w, h = blk.h;
 
     // don't use memset for float point
     for (int i = 0; i < w * h; i++)
-        blk[0][i] = n;
+        blk.data[i] = n;
 }
 
-void blk_print(const char *name, xBlock blk, int idx)
+void blk_print(const char *name, xBlock blk, size_t idx)
 {
-    int w = blk_get_width(blk);
-    int h = blk_get_height(blk);
+    int w = blk.w, h = blk.h;
 
-    printf("%s blk [%d][%d] idx=%d \n", name, h, w, idx);
+    printf("%s blk [%d][%d] idx=%zu \n", name, h, w, idx);
     for (int i = 0; i < h; i++) {
         for (int j = 0; j < w; j++) {
-            printf("%+3.8f\t", blk[i][j]);
+            printf("%+3.8f\t", BLK_AT(blk, i, j));
         }
         printf("\n");
     }
@@ -140,12 +198,13 @@ void blk_print(const char *name, xBlock blk, int idx)
 
 void blk_zigzag(xBlock in, xBlock out)
 {
-    int m = blk_get_width(in);
+    int m = in.w;
     int n, i, j;
 
     for (i = n = 0; i < m * 2; i++)
         for (j = (i < m) ? 0 : i - m + 1; j <= i && j < m; j++)
-            out[0][n++] = in[0][(i & 1) ? j * (m - 1) + i : (i - j) * m + j];
+            out.data[n++] =
+                in.data[(i & 1) ? j * (m - 1) + i : (i - j) * m + j];
 }
 
 xMat mat_calloc(size_t w, size_t h)
@@ -170,114 +229,241 @@ size_t mat_get_width(xMat mat) { return (size_t)mat[-2]; }
 
 size_t mat_get_height(xMat mat) { return (size_t)mat[-1]; }
 
+size_t mat_count_blks(xMat mat, int dim)
+{
+    size_t w = mat_get_width(mat), h = mat_get_height(mat);
+    return ((w + dim - 1) / dim) * ((h + dim - 1) / dim);
+}
+
 void mat_foreach_blk(xMat mat, int dim, xMatIterFn iter_func, void *payload)
 {
     if (iter_func == NULL)
         return;
 
-    size_t w = mat_get_width(mat), h = mat_get_height(mat);
-
-    xBlock blk = blk_calloc(dim, dim);
+    // the common 8x8 case needs no allocation, smaller blocks use a corner
+    // of the same storage
+    BLK_DECLARE(scratch, 8, 8);
+    xBlock blk = dim * dim <= 64 ? blk_wrap(scratch.data, dim, dim)
+                                 : blk_calloc(dim, dim);
 
-    for (int i = 0; i < w * h / (dim * dim); i++) {
+    for (size_t i = 0; i < mat_count_blks(mat, dim); i++) {
         mat_get_blk(mat, blk, i);
         iter_func(mat, blk, i, payload);
         mat_set_blk(mat, blk, i);
     }
 
-    blk_free(blk);
+    if (blk.data != scratch.data)
+        blk_free(blk);
 }
 
-void mat_get_blk(const xMat mat, xBlock blk, int idx)
+typedef struct ForeachJob {
+    xPool *pool;
+    xMat mat;
+    int dim;
+    xMatIterFn iter_func;
+    void *payload;
+} ForeachJob;
+
+static void foreach_task(void *arg, size_t begin, size_t end, int worker)
+{
+    ForeachJob *job = arg;
+    size_t dim = job->dim;
+    size_t bw = (mat_get_width(job->mat) + dim - 1) / dim;
+    xReal *data = pool_scratch(job->pool, worker, sizeof(xReal) * dim * dim);
+    xBlock blk = blk_wrap(data, dim, dim);
+
+    for (size_t i = begin * bw; i < end * bw; i++) {
+        mat_get_blk(job->mat, blk, i);
+        job->iter_func(job->mat, blk, i, job->payload);
+        mat_set_blk(job->mat, blk, i);
+    }
+}
+
+void mat_foreach_blk_mt(xPool *pool, xMat mat, int dim, xMatIterFn iter_func,
+                        void *payload)
+{
+    if (iter_func == NULL)
+        return;
+    if (pool == NULL) {
+        mat_foreach_blk(mat, dim, iter_func, payload);
+        return;
+    }
+
+    ForeachJob job = {pool, mat, dim, iter_func, payload};
+    size_t bh = (mat_get_height(mat) + dim - 1) / dim;
+    pool_for(pool, bh, 1, foreach_task, &job);
+}
+
+// top left corner of block `idx`, the blocks of a row include the partial
+// one at the right edge
+static void mat_blk_origin(size_t w, size_t dim, size_t idx, size_t *y,
+                           size_t *x)
+{
+    size_t bw = (w + dim - 1) / dim;
+    *y = idx / bw * dim;
+    *x = idx % bw * dim;
+}
+
+// the part of an edge block outside the matrix replicates the last row and
+// column
+void mat_get_blk(const xMat mat, xBlock blk, size_t idx)
 {
     size_t w = mat_get_width(mat), h = mat_get_height(mat);
-    size_t dim = blk_get_height(blk);
+    size_t dim = blk.h, y, x;
 
-    int rows = min(h - idx / (w / dim) * dim, dim);
-    int cols = min(w - idx % (w / dim) * dim, dim);
+    mat_blk_origin(w, dim, idx, &y, &x);
+    size_t cols = min_sz(w - x, dim);
 
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            blk[i][j] = mat[(idx / (w / dim) * dim + i) * w +
-                            (idx % (w / dim) * dim + j)];
-        }
+    for (size_t i = 0; i < dim; i++) {
+        const xReal *row = mat + min_sz(y + i, h - 1) * w + x;
+        memcpy(&BLK_AT(blk, i, 0), row, sizeof(xReal) * cols);
+        for (size_t j = cols; j < dim; j++)
+            BLK_AT(blk, i, j) = row[cols - 1];
     }
 }
 
-void mat_set_blk(xMat mat, xBlock blk, int idx)
+void mat_set_blk(xMat mat, xBlock blk, size_t idx)
 {
     size_t w = mat_get_width(mat), h = mat_get_height(mat);
-    size_t dim = blk_get_height(blk);
+    size_t dim = blk.h, y, x;
 
-    int rows = min(h - idx / (w / dim) * dim, dim);
-    int cols = min(w - idx % (w / dim) * dim, dim);
+    mat_blk_origin(w, dim, idx, &y, &x);
+    size_t rows = min_sz(h - y, dim);
+    size_t cols = min_sz(w - x, dim);
 
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            mat[(idx / (w / dim) * dim + i) * w + (idx % (w / dim) * dim + j)] =
-                blk[i][j];
-        }
-    }
+    for (size_t i = 0; i < rows; i++)
+        memcpy(mat + (y + i) * w + x, &BLK_AT(blk, i, 0),
+               sizeof(xReal) * cols);
 }
 
 void mat_add(xMat a, xMat b, xMat c)
 {
-    int w = mat_get_width(a);
-    int h = mat_get_height(a);
+    size_t size = mat_get_width(a) * mat_get_height(a);
 
-    for (int i = 0; i < w * h; i++) {
+    for (size_t i = 0; i < size; i++) {
         c[i] = a[i] + b[i];
     }
 }
 
 void mat_diff(xMat a, xMat b, xMat c)
 {
-    int w = mat_get_width(a);
-    int h = mat_get_height(a);
+    size_t size = mat_get_width(a) * mat_get_height(a);
 
-    for (int i = 0; i < w * h; i++) {
+    for (size_t i = 0; i < size; i++) {
         c[i] = a[i] - b[i];
     }
 };
 
 void mat_product(xMat a, xMat b, xMat c)
 {
-    int w = mat_get_width(a);
-    int h = mat_get_height(a);
+    size_t size = mat_get_width(a) * mat_get_height(a);
 
-    for (int i = 0; i < w * h; i++) {
+    for (size_t i = 0; i < size; i++) {
         c[i] = a[i] * b[i];
     }
 }
 
 void mat_devide(xMat a, xMat b, xMat c)
 {
-    int w = mat_get_width(a);
-    int h = mat_get_height(a);
+    size_t size = mat_get_width(a) * mat_get_height(a);
 
-    for (int i = 0; i < w * h; i++) {
+    for (size_t i = 0; i < size; i++) {
         c[i] = a[i] / b[i]; // devide by zero?
     }
 }
 
 void mat_add_n(xMat in, xReal n, xMat out)
 {
+    size_t size = mat_get_width(in) * mat_get_height(in);
 
-    int w = mat_get_width(in);
-    int h = mat_get_height(in);
-
-    for (int i = 0; i < w * h; i++) {
+    for (size_t i = 0; i < size; i++) {
         out[i] = in[i] + n;
     }
 }
 
 void mat_product_n(xMat in, xReal n, xMat out)
 {
+    size_t size = mat_get_width(in) * mat_get_height(in);
 
-    int w = mat_get_width(in);
-    int h = mat_get_height(in);
-
-    for (int i = 0; i < w * h; i++) {
+    for (size_t i = 0; i < size; i++) {
         out[i] = in[i] * n;
     }
 }
+
+xTileMat tmat_calloc(size_t w, size_t h, size_t dim)
+{
+    xTileMat tm = {w, h, (w + dim - 1) / dim, (h + dim - 1) / dim, dim, NULL};
+
+    size_t size = sizeof(xReal) * tm.bw * tm.bh * dim * dim;
+    size = (size + BLK_ALIGN - 1) / BLK_ALIGN * BLK_ALIGN;
+
+    tm.data = aligned_alloc(BLK_ALIGN, size);
+    memset(tm.data, 0, size);
+    return tm;
+}
+
+void tmat_free(xTileMat tm) { free(tm.data); }
+
+xTileMat tmat_copy(xTileMat tm)
+{
+    xTileMat copy = tmat_calloc(tm.w, tm.h, tm.dim);
+    memcpy(copy.data, tm.data,
+           sizeof(xReal) * tmat_count_blks(tm) * tm.dim * tm.dim);
+    return copy;
+}
+
+size_t tmat_count_blks(xTileMat tm) { return tm.bw * tm.bh; }
+
+xBlock tmat_get_blk(xTileMat tm, size_t idx)
+{
+    return blk_wrap(tm.data + idx * tm.dim * tm.dim, tm.dim, tm.dim);
+}
+
+void tmat_foreach_blk(xTileMat tm, xTileMatIterFn iter_func, void *payload)
+{
+    if (iter_func == NULL)
+        return;
+
+    for (size_t i = 0; i < tmat_count_blks(tm); i++)
+        iter_func(tm, tmat_get_blk(tm, i), i, payload);
+}
+
+// one source row is scattered over the `bw` blocks of its block row, the
+// last one padded with the last column
+void tmat_from_mat(xTileMat tm, const xMat mat)
+{
+    size_t dim = tm.dim, blk_size = dim * dim;
+    size_t full = tm.w / dim, rem = tm.w % dim;
+
+    for (size_t by = 0; by < tm.bh; by++) {
+        xReal *blk_row = tm.data + by * tm.bw * blk_size;
+        for (size_t i = 0; i < dim; i++) {
+            const xReal *src = mat + min_sz(by * dim + i, tm.h - 1) * tm.w;
+            xReal *dst = blk_row + i * dim;
+            for (size_t bx = 0; bx < full; bx++, src += dim, dst += blk_size)
+                memcpy(dst, src, sizeof(xReal) * dim);
+            if (rem) {
+                memcpy(dst, src, sizeof(xReal) * rem);
+                for (size_t j = rem; j < dim; j++)
+                    dst[j] = src[rem - 1];
+            }
+        }
+    }
+}
+
+// the inverse of `tmat_from_mat`, the padding is dropped
+void tmat_to_mat(xMat mat, xTileMat tm)
+{
+    size_t dim = tm.dim, blk_size = dim * dim;
+    size_t full = tm.w / dim, rem = tm.w % dim;
+
+    for (size_t y = 0; y < tm.h; y++) {
+        const xReal *src =
+            tm.data + y / dim * tm.bw * blk_size + y % dim * dim;
+        xReal *dst = mat + y * tm.w;
+        for (size_t bx = 0; bx < full; bx++, src += blk_size, dst += dim)
+            memcpy(dst, src, sizeof(xReal) * dim);
+        if (rem)
+            memcpy(dst, src, sizeof(xReal) * rem);
+    }
+}
@@ -8,23 +8,44 @@ extern "C" {
 #include <stddef.h>
 #include <stdint.h>
 
+#include "pool.h"
+
 // float for now
 typedef float xReal;
-// an 8x8 2d hybrid `xReal` array
-typedef xReal *const *xBlock;
+
+#define BLK_ALIGN 64
+
+// an 8x8 (or `w*h`) block of `xReal`, passed by value. the coefficients are
+// contiguous row-major, `BLK_ALIGN` aligned when allocated by `blk_calloc`
+// or declared by `BLK_DECLARE`
+typedef struct xBlock {
+    xReal *data;
+    uint32_t w, h;
+} xBlock;
+
+// a block on the stack, e.g. `BLK_DECLARE(blk, 8, 8);`, never freed
+#define BLK_DECLARE(name, W, H)                                                \
+    _Alignas(BLK_ALIGN) xReal name##_data[(W) * (H)] = {0};                    \
+    xBlock name = {name##_data, (W), (H)}
+
+// element `(i, j)`, row i column j
+#define BLK_AT(blk, i, j) ((blk).data[(i) * (blk).w + (j)])
+
 // a `sqrt(size)*sqrt(size)` continuous `xReal` array
 typedef xReal *xMat;
 
 // TODO: define callback payload and return value
 typedef xReal (*xBlkIterFn)(xBlock, xReal, int i, int j, void *);
-typedef xBlock (*xMatIterFn)(xMat, xBlock, int i, void *);
+typedef xBlock (*xMatIterFn)(xMat, xBlock, size_t i, void *);
 
 xBlock blk_calloc(size_t w, size_t h);
+// a block on caller-provided storage of `w*h` reals, never freed
+xBlock blk_wrap(xReal *data, size_t w, size_t h);
 xBlock blk_copy(xBlock blk);
 void blk_free(xBlock blk);
 size_t blk_get_width(xBlock blk);
 size_t blk_get_height(xBlock blk);
-void blk_print(const char *name, xBlock blk, int idx);
+void blk_print(const char *name, xBlock blk, size_t idx);
 
 // outplace mathematical operators
 void blk_add(xBlock a, xBlock b, xBlock c);
@@ -37,7 +58,22 @@ void blk_clear(xBlock blk, xReal n);
 void blk_zigzag(xBlock in, xBlock out);
 // TODO: convolution
 
-// inplace iteration, poor man's closure
+// specialized inplace kernels, loops the compiler vectorizes
+// level shift, `x + n`
+void blk_shift(xBlock blk, xReal n);
+void blk_clamp(xBlock blk, xReal lo, xReal hi);
+// `x * a + b`
+void blk_scale(xBlock blk, xReal a, xReal b);
+// `round(x / tbl[i])` through the reciprocals from `blk_quant_recip`
+void blk_quantize(xBlock blk, const xReal *recip);
+void blk_dequantize(xBlock blk, const xReal *tbl);
+void blk_quant_recip(xReal *recip, const xReal *tbl, size_t n);
+void blk_minmax(xBlock blk, xReal *lo, xReal *hi);
+// stretch the values of a block to `[lo, hi]`
+void blk_normalize(xBlock blk, xReal lo, xReal hi);
+
+// inplace iteration, poor man's closure. a call per element, the slow
+// generic escape hatch for what the kernels above don't cover
 void blk_foreachi(xBlock blk, xBlkIterFn iter_func, void *payload);
 // outplace iteration
 void blk_foreacho(xBlock in, xBlock out, xBlkIterFn iter_func, void *payload);
@@ -48,10 +84,19 @@ void mat_free(xMat mat);
 xMat mat_copy(xMat mat);
 size_t mat_get_width(xMat mat);
 size_t mat_get_height(xMat mat);
-void mat_get_blk(const xMat mat, xBlock blk, int idx);
-void mat_set_blk(xMat mat, xBlock blk, int idx);
+// blocks of `dim`, partial blocks at the right and bottom edges included
+size_t mat_count_blks(xMat mat, int dim);
+// block `idx` in raster order, `get` replicates the edges into the part of
+// a partial block outside the matrix, `set` drops it. the indices and
+// offsets are 64-bit, matrices may be past 2^31 elements
+void mat_get_blk(const xMat mat, xBlock blk, size_t idx);
+void mat_set_blk(xMat mat, xBlock blk, size_t idx);
 // inplace iteration, poor man's closure
 void mat_foreach_blk(xMat mat, int dim, xMatIterFn, void *payload);
+// the same on the workers of `pool`, one block row at a time, `iter_func`
+// must be thread-safe. serial when `pool` is NULL
+void mat_foreach_blk_mt(xPool *pool, xMat mat, int dim, xMatIterFn iter_func,
+                        void *payload);
 // outplace mathematical operators
 void mat_add(xMat a, xMat b, xMat c);
 void mat_diff(xMat a, xMat b, xMat c);
@@ -60,6 +105,30 @@ void mat_devide(xMat a, xMat b, xMat c);
 void mat_add_n(xMat in, xReal n, xMat out);
 void mat_product_n(xMat in, xReal n, xMat out);
 
+// block-major matrix: `w*h` padded to whole `dim*dim` blocks, each block
+// contiguous, blocks in raster order. getting a block is a pointer offset
+typedef struct xTileMat {
+    size_t w, h;
+    // blocks per row and per column
+    size_t bw, bh;
+    size_t dim;
+    xReal *data;
+} xTileMat;
+
+typedef void (*xTileMatIterFn)(xTileMat, xBlock, size_t i, void *);
+
+xTileMat tmat_calloc(size_t w, size_t h, size_t dim);
+void tmat_free(xTileMat tm);
+xTileMat tmat_copy(xTileMat tm);
+size_t tmat_count_blks(xTileMat tm);
+// a view into the matrix, no copy
+xBlock tmat_get_blk(xTileMat tm, size_t idx);
+// inplace iteration over the views
+void tmat_foreach_blk(xTileMat tm, xTileMatIterFn iter_func, void *payload);
+// raster to tiled with the padding replicating the edges, and back
+void tmat_from_mat(xTileMat tm, const xMat mat);
+void tmat_to_mat(xMat mat, xTileMat tm);
+
 #ifdef __cplusplus
 }
 #endif
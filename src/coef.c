@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "coef.h"
+#include "huff.h"
+
+// the islow integer DCT: 13-bit fixed-point constants, the row pass keeps
+// two extra bits of precision which the column pass removes
+#define CONST_BITS 13
+#define PASS1_BITS 2
+
+#define FIX_0_298631336 2446
+#define FIX_0_390180644 3196
+#define FIX_0_541196100 4433
+#define FIX_0_765366865 6270
+#define FIX_0_899976223 7373
+#define FIX_1_175875602 9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+
+#define DESCALE(x, n) (((x) + (1 << ((n)-1))) >> (n))
+
+// one 8-point pass over `p[0], p[s], .., p[7s]`, the even outputs of the row
+// pass are upscaled by `PASS1_BITS` and every other output is descaled by
+// `bits`, the column pass descales the even outputs by `PASS1_BITS` instead
+static inline void fdct_1d(int32_t *p, int s, int bits, int row)
+{
+    int32_t tmp0 = p[0 * s] + p[7 * s], tmp7 = p[0 * s] - p[7 * s];
+    int32_t tmp1 = p[1 * s] + p[6 * s], tmp6 = p[1 * s] - p[6 * s];
+    int32_t tmp2 = p[2 * s] + p[5 * s], tmp5 = p[2 * s] - p[5 * s];
+    int32_t tmp3 = p[3 * s] + p[4 * s], tmp4 = p[3 * s] - p[4 * s];
+
+    // even part
+    int32_t tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+    int32_t tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+
+    if (row) {
+        p[0 * s] = (tmp10 + tmp11) * (1 << PASS1_BITS);
+        p[4 * s] = (tmp10 - tmp11) * (1 << PASS1_BITS);
+    } else {
+        p[0 * s] = DESCALE(tmp10 + tmp11, PASS1_BITS);
+        p[4 * s] = DESCALE(tmp10 - tmp11, PASS1_BITS);
+    }
+
+    int32_t z1 = (tmp12 + tmp13) * FIX_0_541196100;
+    p[2 * s] = DESCALE(z1 + tmp13 * FIX_0_765366865, bits);
+    p[6 * s] = DESCALE(z1 - tmp12 * FIX_1_847759065, bits);
+
+    // odd part
+    z1 = tmp4 + tmp7;
+    int32_t z2 = tmp5 + tmp6, z3 = tmp4 + tmp6, z4 = tmp5 + tmp7;
+    int32_t z5 = (z3 + z4) * FIX_1_175875602;
+
+    tmp4 *= FIX_0_298631336;
+    tmp5 *= FIX_2_053119869;
+    tmp6 *= FIX_3_072711026;
+    tmp7 *= FIX_1_501321110;
+    z1 *= -FIX_0_899976223;
+    z2 *= -FIX_2_562915447;
+    z3 = z3 * -FIX_1_961570560 + z5;
+    z4 = z4 * -FIX_0_390180644 + z5;
+
+    p[7 * s] = DESCALE(tmp4 + z1 + z3, bits);
+    p[5 * s] = DESCALE(tmp5 + z2 + z4, bits);
+    p[3 * s] = DESCALE(tmp6 + z2 + z3, bits);
+    p[1 * s] = DESCALE(tmp7 + z1 + z4, bits);
+}
+
+void cpl_fdct(int32_t *blk)
+{
+    for (int i = 0; i < 8; i++)
+        fdct_1d(blk + i * 8, 1, CONST_BITS - PASS1_BITS, 1);
+    for (int i = 0; i < 8; i++)
+        fdct_1d(blk + i, 8, CONST_BITS + PASS1_BITS, 0);
+}
+
+// the quantizer inputs stay below 2^15, with `shift` = 15 + bitlen(div) the
+// reciprocal product is exact and fits 32 bits
+void cpl_quant_init(xQuant *quant, const uint8_t *tbl)
+{
+    for (int i = 0; i < 64; i++) {
+        uint32_t div = 8 * (tbl[i] ? tbl[i] : 1);
+        int bits = 32 - __builtin_clz(div);
+
+        quant->div[i] = div;
+        quant->shift[i] = 15 + bits;
+        quant->recip[i] = ((1ull << (15 + bits)) + div - 1) / div;
+    }
+}
+
+// branch-free sign handling keeps the loop vectorizable
+void cpl_quantize(const int32_t *blk, int16_t *out, const xQuant *quant)
+{
+    for (int i = 0; i < 64; i++)
+        out[i] = cpl_quantize_coef(blk[i], quant, i);
+}
+
+void cpl_encode_blk(int16_t *out, const uint8_t *src, size_t stride,
+                    const xQuant *quant)
+{
+    int32_t blk[64];
+
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < 8; j++)
+            blk[i * 8 + j] = (int32_t)src[i * stride + j] - 128;
+
+    cpl_fdct(blk);
+    cpl_quantize(blk, out, quant);
+}
+
+xCoefPlane *cpl_calloc(size_t w, size_t h)
+{
+    xCoefPlane *cpl = malloc(sizeof(xCoefPlane));
+    cpl->w = w;
+    cpl->h = h;
+    cpl->bw = (w + 7) / 8;
+    cpl->bh = (h + 7) / 8;
+    cpl->data = calloc(cpl->bw * cpl->bh * 64, sizeof(int16_t));
+    return cpl;
+}
+
+void cpl_free(xCoefPlane *cpl)
+{
+    if (cpl) {
+        free(cpl->data);
+        free(cpl);
+    }
+}
+
+int16_t *cpl_get_blk(const xCoefPlane *cpl, size_t bx, size_t by)
+{
+    return cpl->data + (by * cpl->bw + bx) * 64;
+}
+
+void cpl_load_edge(uint8_t *out, const uint8_t *src, size_t stride, size_t x,
+                   size_t y, size_t w, size_t h)
+{
+    for (int i = 0; i < 8; i++) {
+        size_t sy = y + i < h ? y + i : h - 1;
+        for (int j = 0; j < 8; j++) {
+            size_t sx = x + j < w ? x + j : w - 1;
+            out[i * 8 + j] = src[sy * stride + sx];
+        }
+    }
+}
+
+void cpl_encode_plane(xCoefPlane *cpl, const uint8_t *src, size_t stride,
+                      const xQuant *quant)
+{
+    uint8_t edge[64];
+
+    for (size_t by = 0; by < cpl->bh; by++) {
+        for (size_t bx = 0; bx < cpl->bw; bx++) {
+            size_t x = bx * 8, y = by * 8;
+            int16_t *out = cpl_get_blk(cpl, bx, by);
+
+            if (x + 8 <= cpl->w && y + 8 <= cpl->h) {
+                cpl_encode_blk(out, src + y * stride + x, stride, quant);
+                continue;
+            }
+
+            cpl_load_edge(edge, src, stride, x, y, cpl->w, cpl->h);
+            cpl_encode_blk(out, edge, 8, quant);
+        }
+    }
+}
+
+void cpl_zigzag(const int16_t *in, int16_t *out)
+{
+    for (int i = 0; i < 64; i++)
+        out[i] = in[jpec_zz[i]];
+}
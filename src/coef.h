@@ -0,0 +1,64 @@
+#ifndef _COEF_H_
+#define _COEF_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stddef.h>
+#include <stdint.h>
+
+// a plane of quantized DCT coefficients: 64 int16 per 8x8 block in natural
+// (row-major) order, blocks in raster order, padded to whole blocks
+typedef struct xCoefPlane {
+    size_t w, h;   // size in samples
+    size_t bw, bh; // size in blocks
+    int16_t *data;
+} xCoefPlane;
+
+// a quantization table with its integer reciprocals, the quantizer rounds
+// half away from zero like `roundf(x / q)` does
+typedef struct xQuant {
+    uint16_t div[64];    // 8 * q, the islow DCT output is scaled by 8
+    uint32_t recip[64];  // ceil(2^shift / div)
+    uint8_t shift[64];
+} xQuant;
+
+void cpl_quant_init(xQuant *quant, const uint8_t *tbl);
+
+xCoefPlane *cpl_calloc(size_t w, size_t h);
+void cpl_free(xCoefPlane *cpl);
+int16_t *cpl_get_blk(const xCoefPlane *cpl, size_t bx, size_t by);
+
+// integer forward DCT of 64 level-shifted samples, the result is the JPEG DCT
+// scaled by 8, `blk` is transformed inplace
+void cpl_fdct(int32_t *blk);
+// quantize coefficient `x` by entry `i` of `quant`, inline so a caller
+// walking the block in another order keeps the loop unrolled
+static inline int16_t cpl_quantize_coef(int32_t x, const xQuant *quant, int i)
+{
+    int32_t sign = x >> 31;
+    uint32_t mag = (uint32_t)((x ^ sign) - sign) + (quant->div[i] >> 1);
+    int32_t q = (int32_t)((mag * quant->recip[i]) >> quant->shift[i]);
+    return (int16_t)((q ^ sign) - sign);
+}
+
+// quantize a `cpl_fdct` result into int16 coefficients
+void cpl_quantize(const int32_t *blk, int16_t *out, const xQuant *quant);
+// level shift, transform and quantize the 8x8 block at `src`
+void cpl_encode_blk(int16_t *out, const uint8_t *src, size_t stride,
+                    const xQuant *quant);
+// copy the partial 8x8 block at `(x, y)` of a `w*h` plane into `out`,
+// replicating the last column/row
+void cpl_load_edge(uint8_t *out, const uint8_t *src, size_t stride, size_t x,
+                   size_t y, size_t w, size_t h);
+// the same for every block of a `cpl->w * cpl->h` 8-bit plane, partial
+// blocks at the right and bottom edges replicate the last column/row
+void cpl_encode_plane(xCoefPlane *cpl, const uint8_t *src, size_t stride,
+                      const xQuant *quant);
+// reorder a natural order block in zigzag order
+void cpl_zigzag(const int16_t *in, int16_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
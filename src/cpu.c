@@ -0,0 +1,22 @@
+#include "cpu.h"
+
+static int cpu_mask = ~0;
+
+int cpu_get_features(void)
+{
+    int features = 0;
+
+#if !defined(NO_SIMD) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        features |= CPU_SSE2;
+    if (__builtin_cpu_supports("avx2"))
+        features |= CPU_AVX2;
+    if (__builtin_cpu_supports("avx512f"))
+        features |= CPU_AVX512;
+#endif
+
+    return features & cpu_mask;
+}
+
+void cpu_set_mask(int mask) { cpu_mask = mask; }
@@ -0,0 +1,25 @@
+#ifndef _CPU_H_
+#define _CPU_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// vector instruction sets the kernels can dispatch on
+typedef enum CpuFeature {
+    CPU_SSE2 = 0x01,
+    CPU_AVX2 = 0x02,
+    CPU_AVX512 = 0x04, // AVX-512 F
+} CpuFeature;
+
+// features of the running cpu, masked by `cpu_set_mask`,
+// always 0 when built with `NO_SIMD` or for non-x86 targets
+int cpu_get_features(void);
+// restrict the reported features, e.g. to benchmark the fallback kernels,
+// must be called before the first kernel runs
+void cpu_set_mask(int mask);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
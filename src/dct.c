@@ -1,120 +1,772 @@
 #include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #ifdef USE_FFTW3
 #include <fftw3.h>
 #endif
 
 #include "dct.h"
+#include "dct8.h"
+
+static const char *const rigor_names[] = {
+    [DCT_PLAN_ESTIMATE] = "estimate",
+    [DCT_PLAN_MEASURE] = "measure",
+    [DCT_PLAN_PATIENT] = "patient",
+    [DCT_PLAN_EXHAUSTIVE] = "exhaustive",
+};
+
+DctPlanRigor dct_rigor_from_name(const char *name)
+{
+    for (int i = 0; i < sizeof(rigor_names) / sizeof(rigor_names[0]); i++) {
+        if (strcmp(name, rigor_names[i]) == 0)
+            return i;
+    }
+    return DCT_PLAN_INVALID;
+}
 
 #ifdef USE_FFTW3
-void dct(xBlock dct_blk, xBlock blk, int dimX, int dimY)
+// fftw plans are expensive to create, so they are kept in a small cache keyed
+// by the transform shape and reused through the new-array execute interface
+#define PLAN_CACHE_SIZE 16
+
+typedef struct DctPlan {
+    fftw_r2r_kind kind;
+    int dimX, dimY;
+    // the matrix size for batched whole-matrix plans, the block count and 0
+    // for batched tiled plans, 0 for single blocks
+    size_t w, h;
+    int inplace;
+    fftwf_plan plan;
+} DctPlan;
+
+static DctPlan plan_cache[PLAN_CACHE_SIZE];
+static int plan_cache_next;
+
+// the fftw planner isn't thread-safe, the cache and the planner calls are
+// serialized here. executing a plan is safe from any thread, as long as no
+// more than `PLAN_CACHE_SIZE` plans are in use at once so none gets evicted
+static pthread_mutex_t planner_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static DctPlan *plan_lookup(fftw_r2r_kind kind, int dimX, int dimY, size_t w,
+                            size_t h, int inplace)
 {
-    fftwf_plan plan =
-        fftwf_plan_r2r_2d(dimX, dimY, blk[0], dct_blk[0], FFTW_REDFT10,
-                          FFTW_REDFT10, FFTW_ESTIMATE);
-    fftwf_execute(plan);
-    fftwf_destroy_plan(plan);
+    for (int i = 0; i < PLAN_CACHE_SIZE; i++) {
+        DctPlan *p = &plan_cache[i];
+        if (p->plan && p->kind == kind && p->dimX == dimX &&
+            p->dimY == dimY && p->w == w && p->h == h &&
+            p->inplace == inplace) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static DctPlan *plan_insert(fftw_r2r_kind kind, int dimX, int dimY, size_t w,
+                            size_t h, int inplace, fftwf_plan plan)
+{
+    // round-robin eviction, the working set is usually one or two entries
+    DctPlan *p = &plan_cache[plan_cache_next];
+    plan_cache_next = (plan_cache_next + 1) % PLAN_CACHE_SIZE;
+
+    if (p->plan)
+        fftwf_destroy_plan(p->plan);
+
+    *p = (DctPlan){kind, dimX, dimY, w, h, inplace, plan};
+    return p;
+}
+
+// FFTW_ESTIMATE by default, set by `dct_planner_init`
+static unsigned plan_rigor = FFTW_ESTIMATE;
+static char wisdom_path[256];
+
+static const unsigned rigor_flags[] = {
+    [DCT_PLAN_ESTIMATE] = FFTW_ESTIMATE,
+    [DCT_PLAN_MEASURE] = FFTW_MEASURE,
+    [DCT_PLAN_PATIENT] = FFTW_PATIENT,
+    [DCT_PLAN_EXHAUSTIVE] = FFTW_EXHAUSTIVE,
+};
+
+// only FFTW_ESTIMATE leaves the arrays untouched while planning, any other
+// rigor plans on scratch arrays so the caller's data survives
+static int plan_needs_scratch(void) { return plan_rigor != FFTW_ESTIMATE; }
+
+// a single `dimX*dimY` block transform, `FFTW_UNALIGNED` makes it executable
+// on any block later on
+static fftwf_plan blk_plan(fftw_r2r_kind kind, xReal *out, xReal *in,
+                           int dimX, int dimY)
+{
+    int inplace = out == in;
+
+    pthread_mutex_lock(&planner_lock);
+    DctPlan *p = plan_lookup(kind, dimX, dimY, 0, 0, inplace);
+    if (p == NULL) {
+        xReal *scratch = NULL;
+        if (in == NULL || plan_needs_scratch()) {
+            scratch = fftwf_alloc_real(dimX * dimY * 2);
+            in = scratch;
+            out = inplace ? scratch : scratch + dimX * dimY;
+        }
+
+        fftwf_plan plan = fftwf_plan_r2r_2d(dimX, dimY, in, out, kind, kind,
+                                            plan_rigor | FFTW_UNALIGNED);
+        fftwf_free(scratch);
+        p = plan_insert(kind, dimX, dimY, 0, 0, inplace, plan);
+    }
+    pthread_mutex_unlock(&planner_lock);
+    return p->plan;
+}
+
+// one batched inplace plan covering every `dim*dim` block of a row-major
+// `w*h` matrix: the inner dims walk a block, the howmany dims walk the grid
+static fftwf_plan mat_plan(fftw_r2r_kind kind, xMat mat, int dim, size_t w,
+                           size_t h)
+{
+    const fftw_iodim dims[2] = {
+        {dim, w, w},
+        {dim, 1, 1},
+    };
+    const fftw_iodim grid[2] = {
+        {h / dim, dim * w, dim * w},
+        {w / dim, dim, dim},
+    };
+    const fftw_r2r_kind kinds[2] = {kind, kind};
+
+    pthread_mutex_lock(&planner_lock);
+    DctPlan *p = plan_lookup(kind, dim, dim, w, h, 1);
+    if (p == NULL) {
+        xReal *scratch = NULL;
+        if (mat == NULL || plan_needs_scratch()) {
+            scratch = fftwf_alloc_real(w * h);
+            mat = scratch;
+        }
+
+        fftwf_plan plan = fftwf_plan_guru_r2r(2, dims, 2, grid, mat, mat,
+                                              kinds,
+                                              plan_rigor | FFTW_UNALIGNED);
+        fftwf_free(scratch);
+        p = plan_insert(kind, dim, dim, w, h, 1, plan);
+    }
+    pthread_mutex_unlock(&planner_lock);
+    return p->plan;
+}
+
+// one batched inplace plan over the `n` contiguous `dim*dim` blocks of a
+// tiled matrix
+static fftwf_plan tmat_plan(fftw_r2r_kind kind, xReal *data, int dim, size_t n)
+{
+    const fftw_iodim dims[2] = {
+        {dim, dim, dim},
+        {dim, 1, 1},
+    };
+    const fftw_iodim grid = {n, dim * dim, dim * dim};
+    const fftw_r2r_kind kinds[2] = {kind, kind};
+
+    pthread_mutex_lock(&planner_lock);
+    DctPlan *p = plan_lookup(kind, dim, dim, n, 0, 1);
+    if (p == NULL) {
+        xReal *scratch = NULL;
+        if (data == NULL || plan_needs_scratch()) {
+            scratch = fftwf_alloc_real(n * dim * dim);
+            data = scratch;
+        }
+
+        fftwf_plan plan = fftwf_plan_guru_r2r(2, dims, 1, &grid, data, data,
+                                              kinds,
+                                              plan_rigor | FFTW_UNALIGNED);
+        fftwf_free(scratch);
+        p = plan_insert(kind, dim, dim, n, 0, 1, plan);
+    }
+    pthread_mutex_unlock(&planner_lock);
+    return p->plan;
+}
+
+int dct_planner_init(DctPlanRigor rigor, const char *wisdom_file)
+{
+    if (rigor < DCT_PLAN_ESTIMATE || rigor > DCT_PLAN_EXHAUSTIVE)
+        return -1;
+
+    plan_rigor = rigor_flags[rigor];
+    wisdom_path[0] = '\0';
+
+    if (wisdom_file == NULL)
+        return 0;
+
+    snprintf(wisdom_path, sizeof(wisdom_path), "%s", wisdom_file);
+    // a missing wisdom file is fine, it is created by `dct_planner_save`
+    pthread_mutex_lock(&planner_lock);
+    int ret = fftwf_import_wisdom_from_filename(wisdom_path) ? 1 : 0;
+    pthread_mutex_unlock(&planner_lock);
+    return ret;
+}
+
+void dct_planner_warmup(int dim, size_t w, size_t h)
+{
+    // `dct`/`idct` run out-of-place, on separate buffers as fftw aligns them,
+    // the threaded matrix transforms in place
+    xReal *in = fftwf_alloc_real(dim * dim);
+    xReal *out = fftwf_alloc_real(dim * dim);
+    blk_plan(FFTW_REDFT10, out, in, dim, dim);
+    blk_plan(FFTW_REDFT01, out, in, dim, dim);
+    fftwf_free(in);
+    fftwf_free(out);
+    blk_plan(FFTW_REDFT10, NULL, NULL, dim, dim);
+    blk_plan(FFTW_REDFT01, NULL, NULL, dim, dim);
+
+    if (w == 0 || h == 0)
+        return;
+
+    size_t n = ((w + dim - 1) / dim) * ((h + dim - 1) / dim);
+    tmat_plan(FFTW_REDFT10, NULL, dim, n);
+    tmat_plan(FFTW_REDFT01, NULL, dim, n);
+
+    if (w % dim != 0 || h % dim != 0)
+        return;
+
+    mat_plan(FFTW_REDFT10, NULL, dim, w, h);
+    mat_plan(FFTW_REDFT01, NULL, dim, w, h);
+}
+
+int dct_planner_save(void)
+{
+    if (wisdom_path[0] == '\0')
+        return 0;
+    pthread_mutex_lock(&planner_lock);
+    int ret = fftwf_export_wisdom_to_filename(wisdom_path) ? 0 : -1;
+    pthread_mutex_unlock(&planner_lock);
+    return ret;
+}
+
+static void mat_transform(fftw_r2r_kind kind, xMat mat, int dim)
+{
+    size_t w = mat_get_width(mat), h = mat_get_height(mat);
+    fftwf_execute_r2r(mat_plan(kind, mat, dim, w, h), mat, mat);
+}
+
+static void tmat_transform(fftw_r2r_kind kind, xTileMat tm)
+{
+    size_t n = tmat_count_blks(tm);
+    fftwf_execute_r2r(tmat_plan(kind, tm.data, tm.dim, n), tm.data, tm.data);
+}
 
-    // rescale
-    // blk_product_n(dct_blk, 2.f / (dimX * dimY), dct_blk);
+void dct_cleanup(void)
+{
+    pthread_mutex_lock(&planner_lock);
+    for (int i = 0; i < PLAN_CACHE_SIZE; i++) {
+        if (plan_cache[i].plan)
+            fftwf_destroy_plan(plan_cache[i].plan);
+        plan_cache[i] = (DctPlan){0};
+    }
+    plan_cache_next = 0;
+    fftwf_cleanup();
+    pthread_mutex_unlock(&planner_lock);
 }
 
-void idct(xBlock dct_blk, xBlock blk, int dimX, int dimY)
+static void backend_dct(xBlock dct_blk, xBlock blk, int dimX, int dimY)
 {
     fftwf_plan plan =
-        fftwf_plan_r2r_2d(dimX, dimY, blk[0], dct_blk[0], FFTW_REDFT01,
-                          FFTW_REDFT01, FFTW_ESTIMATE);
-    fftwf_execute(plan);
-    fftwf_destroy_plan(plan);
+        blk_plan(FFTW_REDFT10, dct_blk.data, blk.data, dimX, dimY);
+    fftwf_execute_r2r(plan, blk.data, dct_blk.data);
+}
 
-    // rescale
-    // blk_product_n(dct_blk, 1.f / (4.f * dimX * dimY), dct_blk);
+static void backend_idct(xBlock dct_blk, xBlock blk, int dimX, int dimY)
+{
+    fftwf_plan plan =
+        blk_plan(FFTW_REDFT01, dct_blk.data, blk.data, dimX, dimY);
+    fftwf_execute_r2r(plan, blk.data, dct_blk.data);
 }
 
 #else
-void dct(xBlock out, xBlock in, int dimX, int dimY)
+void dct_cleanup(void) {}
+
+// without fftw there is nothing to plan, the rigor is only checked
+int dct_planner_init(DctPlanRigor rigor, const char *wisdom_file)
+{
+    return rigor < DCT_PLAN_ESTIMATE || rigor > DCT_PLAN_EXHAUSTIVE ? -1 : 0;
+}
+void dct_planner_warmup(int dim, size_t w, size_t h) {}
+int dct_planner_save(void) { return 0; }
+
+// cosine tables of the separable fallback, computed once per size:
+// forward `2 * cos(pi * (2j + 1) * k / 2n)` at [k * n + j], inverse the same
+// with the k = 0 row halved at [j * n + k]
+#define COS_TBL_MAX 64
+
+static xReal *cos_tbls[2][COS_TBL_MAX + 1];
+
+static xReal *cos_tbl_new(int n, int inverse)
 {
-    int x, y, u, v;
-    xReal Cu, Cv;
-    for (v = 0; v < dimY; ++v) {
-        for (u = 0; u < dimX; ++u) {
-            out[v][u] = 0.f;
-            Cu = v == 0 ? 1.f / sqrtf(2.f) : 1.f;
-            Cv = u == 0 ? 1.f / sqrtf(2.f) : 1.f;
-
-            for (y = 0; y < dimY; y++) {
-                for (x = 0; x < dimX; x++) {
-                    out[v][u] +=
-                        in[y][x] *
-                        cosf(M_PI * (2 * y + 1.f) * v / (2 * (xReal)dimY)) *
-                        cosf(M_PI * (2 * x + 1.f) * u / (2 * (xReal)dimX));
-                }
-            }
-
-            out[v][u] *= Cu * Cv * 1.f / 4.f;
+    xReal *tbl = malloc(sizeof(xReal) * n * n);
+
+    for (int k = 0; k < n; k++) {
+        for (int j = 0; j < n; j++) {
+            xReal c = 2. * cos(M_PI * (2 * j + 1) * k / (2. * n));
+            if (inverse)
+                tbl[j * n + k] = k == 0 ? c / 2 : c;
+            else
+                tbl[k * n + j] = c;
         }
     }
+    return tbl;
 }
 
-void idct(xBlock out, xBlock in, int dimX, int dimY)
+static const xReal *cos_tbl_get(int n, int inverse)
 {
-    int x, y, u, v;
-    xReal Cu, Cv;
-
-    for (y = 0; y < dimX; ++y) {
-        for (x = 0; x < dimY; ++x) {
-            out[y][x] = 0.f;
-
-            for (v = 0; v < dimY; v++) {
-                for (u = 0; u < dimX; u++) {
-                    Cu = v == 0 ? 1.f / sqrtf(2.f) : 1.f;
-                    Cv = u == 0 ? 1.f / sqrtf(2.f) : 1.f;
-                    out[y][x] +=
-                        in[v][u] * Cu * Cv *
-                        cosf(M_PI * (2 * y + 1.f) * v / (2 * (xReal)dimY)) *
-                        cosf(M_PI * (2 * x + 1.f) * u / (2 * (xReal)dimX));
-                }
-            }
-
-            out[y][x] *= 1.f / 4.f;
+    if (n > COS_TBL_MAX)
+        return cos_tbl_new(n, inverse);
+    if (cos_tbls[inverse][n] == NULL)
+        cos_tbls[inverse][n] = cos_tbl_new(n, inverse);
+    return cos_tbls[inverse][n];
+}
+
+static void cos_tbl_put(const xReal *tbl, int n)
+{
+    if (n > COS_TBL_MAX)
+        free((xReal *)tbl);
+}
+
+// `dimX` rows of `dimY` samples, same as fftw's row-major 2d plans. both
+// passes are O(N^3) matrix products against the tables
+static void separable(xReal *out, const xReal *in, int dimX, int dimY,
+                      int inverse)
+{
+    const xReal *rt = cos_tbl_get(dimX, inverse);
+    const xReal *ct = cos_tbl_get(dimY, inverse);
+    xReal *tmp = malloc(sizeof(xReal) * dimX * dimY);
+
+    // along rows
+    for (int r = 0; r < dimX; r++) {
+        for (int k = 0; k < dimY; k++) {
+            xReal acc = 0;
+            for (int j = 0; j < dimY; j++)
+                acc += in[r * dimY + j] * ct[k * dimY + j];
+            tmp[r * dimY + k] = acc;
         }
     }
+
+    // along columns
+    for (int k = 0; k < dimX; k++) {
+        for (int c = 0; c < dimY; c++)
+            out[k * dimY + c] = 0;
+        for (int r = 0; r < dimX; r++) {
+            xReal t = rt[k * dimX + r];
+            for (int c = 0; c < dimY; c++)
+                out[k * dimY + c] += tmp[r * dimY + c] * t;
+        }
+    }
+
+    free(tmp);
+    cos_tbl_put(rt, dimX);
+    cos_tbl_put(ct, dimY);
+}
+
+// fill the tables before worker threads share them
+static void backend_prepare(int dim)
+{
+    if (dim > COS_TBL_MAX)
+        return;
+    cos_tbl_get(dim, 0);
+    cos_tbl_get(dim, 1);
+}
+
+static void backend_dct(xBlock out, xBlock in, int dimX, int dimY)
+{
+    separable(out.data, in.data, dimX, dimY, 0);
+}
+
+static void backend_idct(xBlock out, xBlock in, int dimX, int dimY)
+{
+    separable(out.data, in.data, dimX, dimY, 1);
 }
 #endif
 
-// static xReal normalize(xReal x, void *_payload) { return x; }
-// static xReal rescale(xReal x, void *_payload) { return x / (4 * N * N); }
+// the 8x8 kernels replace fftw when they are vectorized, and always replace
+// the separable fallback
+static int use_dct8(int dimX, int dimY)
+{
+    if (dimX != 8 || dimY != 8)
+        return 0;
+#ifdef USE_FFTW3
+    return dct8_accelerated();
+#else
+    return 1;
+#endif
+}
 
-// the result won't normalize values, e.g. values may (likely) larger 255.0 or
-// negative to visualize, perform normalize for each block
-void mat_dct_blks(xMat mat, int dim)
+// the raw REDFT10/REDFT01 scales of the 8x8 kernels
+static xReal dct8_raw[64], idct8_raw[64];
+static int dct8_raw_ready;
+
+static void dct8_raw_init(void)
+{
+    if (dct8_raw_ready)
+        return;
+    dct8_fwd_scale(dct8_raw, 1.f);
+    dct8_inv_scale(idct8_raw, 1.f);
+    dct8_raw_ready = 1;
+}
+
+void dct(xBlock out, xBlock in, int dimX, int dimY)
+{
+    if (use_dct8(dimX, dimY)) {
+        dct8_raw_init();
+        dct8_fwd(in.data, out.data, dct8_raw);
+        return;
+    }
+    backend_dct(out, in, dimX, dimY);
+}
+
+void idct(xBlock out, xBlock in, int dimX, int dimY)
+{
+    if (use_dct8(dimX, dimY)) {
+        dct8_raw_init();
+        dct8_inv(in.data, out.data, idct8_raw);
+        return;
+    }
+    backend_idct(out, in, dimX, dimY);
+}
+
+static int mat_is_tiled(xMat mat, int dim)
+{
+    return mat_get_width(mat) % dim == 0 && mat_get_height(mat) % dim == 0;
+}
+
+typedef void (*Dct8Kernel)(const xReal *, xReal *, const xReal *, size_t);
+
+// run an 8x8 kernel over the blocks of block rows `[by0, by1)` of a matrix
+// whose width is a multiple of 8, one block row at a time gathered into
+// contiguous blocks at `strip`. the scale table carries the whole
+// normalization
+static void mat_dct8_rows(xMat mat, Dct8Kernel kernel, const xReal *scale,
+                          xReal *strip, size_t by0, size_t by1)
+{
+    size_t w = mat_get_width(mat), n = w / 8;
+
+    for (size_t by = by0; by < by1; by++) {
+        xReal *row = mat + by * 8 * w;
+        for (size_t b = 0; b < n; b++)
+            for (int i = 0; i < 8; i++)
+                memcpy(strip + b * 64 + i * 8, row + i * w + b * 8,
+                       sizeof(xReal) * 8);
+        kernel(strip, strip, scale, n);
+        for (size_t b = 0; b < n; b++)
+            for (int i = 0; i < 8; i++)
+                memcpy(row + i * w + b * 8, strip + b * 64 + i * 8,
+                       sizeof(xReal) * 8);
+    }
+}
+
+static void mat_dct8_apply(xMat mat, Dct8Kernel kernel, const xReal *scale)
 {
     size_t w = mat_get_width(mat), h = mat_get_height(mat);
-    xBlock blk = blk_calloc(dim, dim), dct_blk = blk_calloc(dim, dim);
+    xReal *strip = aligned_alloc(64, sizeof(xReal) * 64 * (w / 8));
+
+    mat_dct8_rows(mat, kernel, scale, strip, 0, h / 8);
+    free(strip);
+}
 
-    for (int i = 0; i < w * h / (dim * dim); i++) {
+// transform block by block, used when the batched path doesn't apply
+static void mat_blks_apply(xMat mat, int dim,
+                           void (*fn)(xBlock, xBlock, int, int))
+{
+    xBlock blk = blk_calloc(dim, dim), out_blk = blk_calloc(dim, dim);
+
+    for (size_t i = 0; i < mat_count_blks(mat, dim); i++) {
         mat_get_blk(mat, blk, i);
-        dct(dct_blk, blk, dim, dim);
-        mat_set_blk(mat, dct_blk, i);
+        fn(out_blk, blk, dim, dim);
+        mat_set_blk(mat, out_blk, i);
     }
 
     blk_free(blk);
-    blk_free(dct_blk);
+    blk_free(out_blk);
+}
+
+// forward coefficients are the raw transform scaled by 2/(N*N), the inverse
+// of those is 8 times the samples whatever N is, both scales are applied here
+#define DCT_SCALE(dim) (2.f / ((dim) * (dim)))
+#define IDCT_SCALE (1.f / 8.f)
+
+static const xReal *dct8_mat_scale(void)
+{
+    static xReal scale[64];
+    if (scale[0] == 0)
+        dct8_fwd_scale(scale, DCT_SCALE(8));
+    return scale;
+}
+
+static const xReal *idct8_mat_scale(void)
+{
+    static xReal scale[64];
+    if (scale[0] == 0)
+        dct8_inv_scale(scale, IDCT_SCALE);
+    return scale;
 }
 
-// the result is scaled by 4*N*N, N is block width/height
-// to visualize, perform normalize(value/(4*N*N)) for each block
+// the result won't normalize values, e.g. values may (likely) larger 255.0 or
+// negative, to visualize perform normalize for each block
+void mat_dct_blks(xMat mat, int dim)
+{
+    if (use_dct8(dim, dim) && mat_is_tiled(mat, dim)) {
+        mat_dct8_apply(mat, dct8_fwd_n, dct8_mat_scale());
+        return;
+    }
+
+#ifdef USE_FFTW3
+    if (mat_is_tiled(mat, dim))
+        mat_transform(FFTW_REDFT10, mat, dim);
+    else
+#endif
+        mat_blks_apply(mat, dim, dct);
+    mat_product_n(mat, DCT_SCALE(dim), mat);
+}
+
+// the inverse of `mat_dct_blks`, the result is the samples
 void mat_idct_blks(xMat mat, int dim)
 {
+    if (use_dct8(dim, dim) && mat_is_tiled(mat, dim)) {
+        mat_dct8_apply(mat, dct8_inv_n, idct8_mat_scale());
+        return;
+    }
+
+#ifdef USE_FFTW3
+    if (mat_is_tiled(mat, dim))
+        mat_transform(FFTW_REDFT01, mat, dim);
+    else
+#endif
+        mat_blks_apply(mat, dim, idct);
+    mat_product_n(mat, IDCT_SCALE, mat);
+}
+
+static void tmat_scale(xTileMat tm, xReal n)
+{
+    xReal *data = tm.data;
+    for (size_t i = 0; i < tmat_count_blks(tm) * tm.dim * tm.dim; i++)
+        data[i] *= n;
+}
+
+// the blocks are already contiguous, so the batched kernels run over the
+// whole matrix in place without gathering
+void tmat_dct_blks(xTileMat tm)
+{
+    size_t dim = tm.dim, n = tmat_count_blks(tm);
+
+    if (use_dct8(dim, dim)) {
+        dct8_fwd_n(tm.data, tm.data, dct8_mat_scale(), n);
+        return;
+    }
+
+#ifdef USE_FFTW3
+    tmat_transform(FFTW_REDFT10, tm);
+#else
+    for (size_t i = 0; i < n; i++) {
+        xBlock blk = tmat_get_blk(tm, i);
+        dct(blk, blk, dim, dim);
+    }
+#endif
+    tmat_scale(tm, DCT_SCALE(dim));
+}
+
+void tmat_idct_blks(xTileMat tm)
+{
+    size_t dim = tm.dim, n = tmat_count_blks(tm);
+
+    if (use_dct8(dim, dim)) {
+        dct8_inv_n(tm.data, tm.data, idct8_mat_scale(), n);
+        return;
+    }
+
+#ifdef USE_FFTW3
+    tmat_transform(FFTW_REDFT01, tm);
+#else
+    for (size_t i = 0; i < n; i++) {
+        xBlock blk = tmat_get_blk(tm, i);
+        idct(blk, blk, dim, dim);
+    }
+#endif
+    tmat_scale(tm, IDCT_SCALE);
+}
+
+// a parallel transform over block rows, everything shared is created before
+// the workers start so they never touch lazily initialized state
+typedef struct MatJob {
+    xPool *pool;
+    xMat mat;
+    xTileMat tm;
+    int dim, inverse;
+    // the 8x8 kernels, or the generic path when NULL
+    Dct8Kernel kernel;
+    const xReal *scale;
+    xReal factor;
+#ifdef USE_FFTW3
+    // one block row of a tiled raster matrix or of a tiled matrix, and
+    // a single inplace block
+    fftwf_plan row_plan, blk_plan;
+#endif
+} MatJob;
+
+// the rows are chunked the same way whatever the pool size, so the result
+// doesn't depend on the number of threads
+#define MT_GRAIN 1
+
+static void job_blk_transform(const MatJob *job, xBlock blk)
+{
+#ifdef USE_FFTW3
+    if (job->blk_plan) {
+        fftwf_execute_r2r(job->blk_plan, blk.data, blk.data);
+        return;
+    }
+#endif
+    if (job->inverse)
+        idct(blk, blk, job->dim, job->dim);
+    else
+        dct(blk, blk, job->dim, job->dim);
+}
+
+static void mat_rows_task(void *arg, size_t begin, size_t end, int worker)
+{
+    MatJob *job = arg;
+    xMat mat = job->mat;
     size_t w = mat_get_width(mat), h = mat_get_height(mat);
-    xBlock blk = blk_calloc(dim, dim), idct_blk = blk_calloc(dim, dim);
+    int dim = job->dim;
+
+    if (job->kernel) {
+        xReal *strip = pool_scratch(job->pool, worker,
+                                    sizeof(xReal) * 64 * (w / 8));
+        mat_dct8_rows(mat, job->kernel, job->scale, strip, begin, end);
+        return;
+    }
+
+#ifdef USE_FFTW3
+    if (job->row_plan) {
+        for (size_t by = begin; by < end; by++) {
+            xReal *row = mat + by * dim * w;
+            fftwf_execute_r2r(job->row_plan, row, row);
+            for (size_t i = 0; i < dim * w; i++)
+                row[i] *= job->factor;
+        }
+        return;
+    }
+#endif
+
+    // partial edge blocks, one by one
+    xBlock blk = blk_wrap(pool_scratch(job->pool, worker,
+                                       sizeof(xReal) * dim * dim),
+                          dim, dim);
+    size_t bw = (w + dim - 1) / dim, bh = (h + dim - 1) / dim;
 
-    for (int i = 0; i < w * h / (dim * dim); i++) {
+    for (size_t i = begin * bw; i < end * bw && i < bw * bh; i++) {
         mat_get_blk(mat, blk, i);
-        idct(idct_blk, blk, dim, dim);
-        mat_set_blk(mat, idct_blk, i);
+        job_blk_transform(job, blk);
+        blk_product_n(blk, job->factor, blk);
+        mat_set_blk(mat, blk, i);
     }
+}
 
-    blk_free(blk);
-    blk_free(idct_blk);
+static void mat_transform_mt(xPool *pool, xMat mat, int dim, int inverse)
+{
+    size_t h = mat_get_height(mat);
+    MatJob job = {.pool = pool, .mat = mat, .dim = dim, .inverse = inverse};
+
+    job.factor = inverse ? IDCT_SCALE : DCT_SCALE(dim);
+    if (use_dct8(dim, dim) && mat_is_tiled(mat, dim)) {
+        job.kernel = inverse ? dct8_inv_n : dct8_fwd_n;
+        job.scale = inverse ? idct8_mat_scale() : dct8_mat_scale();
+    } else {
+        // partial blocks of 8x8 still go through the 8x8 kernels
+        dct8_raw_init();
+#ifdef USE_FFTW3
+        fftw_r2r_kind kind = inverse ? FFTW_REDFT01 : FFTW_REDFT10;
+        if (mat_is_tiled(mat, dim))
+            job.row_plan = mat_plan(kind, NULL, dim, mat_get_width(mat), dim);
+        else if (!use_dct8(dim, dim))
+            job.blk_plan = blk_plan(kind, NULL, NULL, dim, dim);
+#else
+        backend_prepare(dim);
+#endif
+    }
+
+    pool_for(pool, (h + dim - 1) / dim, MT_GRAIN, mat_rows_task, &job);
+}
+
+void mat_dct_blks_mt(xPool *pool, xMat mat, int dim)
+{
+    if (pool == NULL) {
+        mat_dct_blks(mat, dim);
+        return;
+    }
+    mat_transform_mt(pool, mat, dim, 0);
+}
+
+void mat_idct_blks_mt(xPool *pool, xMat mat, int dim)
+{
+    if (pool == NULL) {
+        mat_idct_blks(mat, dim);
+        return;
+    }
+    mat_transform_mt(pool, mat, dim, 1);
+}
+
+static void tmat_rows_task(void *arg, size_t begin, size_t end, int worker)
+{
+    MatJob *job = arg;
+    xTileMat tm = job->tm;
+    size_t row_size = tm.bw * tm.dim * tm.dim;
+
+    for (size_t by = begin; by < end; by++) {
+        xReal *row = tm.data + by * row_size;
+        if (job->kernel) {
+            job->kernel(row, row, job->scale, tm.bw);
+            continue;
+        }
+#ifdef USE_FFTW3
+        fftwf_execute_r2r(job->row_plan, row, row);
+#else
+        for (size_t i = 0; i < tm.bw; i++)
+            job_blk_transform(
+                job, blk_wrap(row + i * tm.dim * tm.dim, tm.dim, tm.dim));
+#endif
+        for (size_t i = 0; i < row_size; i++)
+            row[i] *= job->factor;
+    }
+}
+
+static void tmat_transform_mt(xPool *pool, xTileMat tm, int inverse)
+{
+    int dim = tm.dim;
+    MatJob job = {.pool = pool, .tm = tm, .dim = dim, .inverse = inverse};
+
+    job.factor = inverse ? IDCT_SCALE : DCT_SCALE(dim);
+    if (use_dct8(dim, dim)) {
+        job.kernel = inverse ? dct8_inv_n : dct8_fwd_n;
+        job.scale = inverse ? idct8_mat_scale() : dct8_mat_scale();
+    } else {
+#ifdef USE_FFTW3
+        fftw_r2r_kind kind = inverse ? FFTW_REDFT01 : FFTW_REDFT10;
+        job.row_plan = tmat_plan(kind, NULL, dim, tm.bw);
+#else
+        backend_prepare(dim);
+#endif
+    }
+
+    pool_for(pool, tm.bh, MT_GRAIN, tmat_rows_task, &job);
+}
+
+void tmat_dct_blks_mt(xPool *pool, xTileMat tm)
+{
+    if (pool == NULL) {
+        tmat_dct_blks(tm);
+        return;
+    }
+    tmat_transform_mt(pool, tm, 0);
+}
+
+void tmat_idct_blks_mt(xPool *pool, xTileMat tm)
+{
+    if (pool == NULL) {
+        tmat_idct_blks(tm);
+        return;
+    }
+    tmat_transform_mt(pool, tm, 1);
 }
@@ -2,21 +2,62 @@
 #define _DCT_H_
 
 #include "blk.h"
+#include "pool.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// planning rigor of the fftw backend, higher rigor plans take longer to
+// create but run faster, persist them with a wisdom file
+typedef enum DctPlanRigor {
+    // an unknown name
+    DCT_PLAN_INVALID = -1,
+    DCT_PLAN_ESTIMATE = 0,
+    DCT_PLAN_MEASURE,
+    DCT_PLAN_PATIENT,
+    DCT_PLAN_EXHAUSTIVE,
+} DctPlanRigor;
+
+// select the planning rigor and import wisdom from `wisdom_file` if given,
+// returns 1 if wisdom was imported, 0 if not, negative value on error
+int dct_planner_init(DctPlanRigor rigor, const char *wisdom_file);
+// create the block plans of `dim`, and the whole-matrix (raster and tiled)
+// plans if `w*h` > 0
+void dct_planner_warmup(int dim, size_t w, size_t h);
+// export the accumulated wisdom to the file passed to `dct_planner_init`
+int dct_planner_save(void);
+// "estimate", "measure", "patient" or "exhaustive", DCT_PLAN_INVALID if
+// unknown
+DctPlanRigor dct_rigor_from_name(const char *name);
+
+// blockwise transforms of a whole matrix, normalized: the forward result is
+// the raw transform scaled by 2/(N*N), the inverse takes such coefficients
+// and gives back the samples. the coefficients of partial edge blocks don't
+// fit a raster matrix, transform those on a tiled one
 void mat_dct_blks(xMat mat, int dim);
 void mat_idct_blks(xMat mat, int dim);
+// same on a tiled matrix, the padding blocks are transformed as well
+void tmat_dct_blks(xTileMat tm);
+void tmat_idct_blks(xTileMat tm);
+// the same split in block rows over `pool`, the serial functions when `pool`
+// is NULL. the result is the same whatever the pool size
+void mat_dct_blks_mt(xPool *pool, xMat mat, int dim);
+void mat_idct_blks_mt(xPool *pool, xMat mat, int dim);
+void tmat_dct_blks_mt(xPool *pool, xTileMat tm);
+void tmat_idct_blks_mt(xPool *pool, xTileMat tm);
 
+// raw transforms with fftw's REDFT10/REDFT01 scaling in every build,
 // result should be normalize by user-self
 void dct(xBlock out, xBlock in, int w, int h);
-// inverser transform in fftw3 is scaled by 2N^2, eg, 4*N*N
+// inverser transform is scaled by 2N*2N, eg, 4*N*N
 void idct(xBlock out, xBlock in, int w, int h);
 
 void convolution(xBlock out, xBlock kernel);
 
+// release the cached transform plans
+void dct_cleanup(void);
+
 #ifdef _cplusplus
 }
 #endif
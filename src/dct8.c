@@ -0,0 +1,457 @@
+#include <math.h>
+#include <stddef.h>
+
+#if !defined(NO_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#define DCT8_X86
+#include <immintrin.h>
+#endif
+
+#include "cpu.h"
+#include "dct8.h"
+
+// avx-512 comes with fma, keep multiply-adds separate so every kernel
+// rounds exactly like the scalar one
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+// AAN scale factors: s[0] = 1, s[k] = sqrt(2) * cos(k * pi / 16)
+static const double aan_scale[8] = {
+    1.0,         1.387039845, 1.306562965, 1.175875602,
+    1.0,         0.785694958, 0.541196100, 0.275899379,
+};
+
+// the JPEG normalization C(0) = 1/sqrt(2), C(k) = 1
+static double jpeg_c(int k) { return k == 0 ? M_SQRT1_2 : 1.0; }
+
+// the AAN forward kernel yields `8 * s[u] * s[v] * F(u, v)` where F is the
+// JPEG DCT `1/4 * C(u) * C(v) * sum`, and REDFT10 is `16 * F / (C(u) * C(v))`
+void dct8_fwd_scale(xReal *scale, xReal factor)
+{
+    for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+            scale[v * 8 + u] = factor * 2.0 /
+                               (jpeg_c(u) * jpeg_c(v) * aan_scale[u] *
+                                aan_scale[v]);
+        }
+    }
+}
+
+// REDFT01 weights X(0) by 1 and X(k) by 2, the AAN inverse kernel expects
+// `s[u] * s[v] * F(u, v)` and yields 8 times the samples
+void dct8_inv_scale(xReal *scale, xReal factor)
+{
+    for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+            double cu = u == 0 ? 1.0 : 2.0, cv = v == 0 ? 1.0 : 2.0;
+            scale[v * 8 + u] = factor * cu * cv * aan_scale[u] *
+                               aan_scale[v] / (2.0 * jpeg_c(u) * jpeg_c(v));
+        }
+    }
+}
+
+// the 8-point butterflies are written once against an accessor `AT(k)` so the
+// scalar and vector kernels perform the very same operations in the same
+// order, `T` is either `xReal` or a vector of them
+#define FWD_1D(T, AT)                                                          \
+    do {                                                                       \
+        T tmp0 = AT(0) + AT(7), tmp7 = AT(0) - AT(7);                          \
+        T tmp1 = AT(1) + AT(6), tmp6 = AT(1) - AT(6);                          \
+        T tmp2 = AT(2) + AT(5), tmp5 = AT(2) - AT(5);                          \
+        T tmp3 = AT(3) + AT(4), tmp4 = AT(3) - AT(4);                          \
+                                                                               \
+        /* even part */                                                        \
+        T tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;                            \
+        T tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;                            \
+                                                                               \
+        AT(0) = tmp10 + tmp11;                                                 \
+        AT(4) = tmp10 - tmp11;                                                 \
+                                                                               \
+        T z1 = (tmp12 + tmp13) * 0.707106781f;                                 \
+        AT(2) = tmp13 + z1;                                                    \
+        AT(6) = tmp13 - z1;                                                    \
+                                                                               \
+        /* odd part */                                                         \
+        tmp10 = tmp4 + tmp5;                                                   \
+        tmp11 = tmp5 + tmp6;                                                   \
+        tmp12 = tmp6 + tmp7;                                                   \
+                                                                               \
+        T z5 = (tmp10 - tmp12) * 0.382683433f;                                 \
+        T z2 = tmp10 * 0.541196100f + z5;                                      \
+        T z4 = tmp12 * 1.306562965f + z5;                                      \
+        T z3 = tmp11 * 0.707106781f;                                           \
+                                                                               \
+        T z11 = tmp7 + z3, z13 = tmp7 - z3;                                    \
+                                                                               \
+        AT(5) = z13 + z2;                                                      \
+        AT(3) = z13 - z2;                                                      \
+        AT(1) = z11 + z4;                                                      \
+        AT(7) = z11 - z4;                                                      \
+    } while (0)
+
+#define INV_1D(T, AT)                                                          \
+    do {                                                                       \
+        /* even part */                                                        \
+        T tmp10 = AT(0) + AT(4), tmp11 = AT(0) - AT(4);                        \
+        T tmp13 = AT(2) + AT(6);                                               \
+        T tmp12 = (AT(2) - AT(6)) * 1.414213562f - tmp13;                      \
+                                                                               \
+        T tmp0 = tmp10 + tmp13, tmp3 = tmp10 - tmp13;                          \
+        T tmp1 = tmp11 + tmp12, tmp2 = tmp11 - tmp12;                          \
+                                                                               \
+        /* odd part */                                                         \
+        T z13 = AT(5) + AT(3), z10 = AT(5) - AT(3);                            \
+        T z11 = AT(1) + AT(7), z12 = AT(1) - AT(7);                            \
+                                                                               \
+        T tmp7 = z11 + z13;                                                    \
+        tmp11 = (z11 - z13) * 1.414213562f;                                    \
+                                                                               \
+        T z5 = (z10 + z12) * 1.847759065f;                                     \
+        tmp10 = z12 * 1.082392200f - z5;                                       \
+        tmp12 = z10 * -2.613125930f + z5;                                      \
+                                                                               \
+        T tmp6 = tmp12 - tmp7;                                                 \
+        T tmp5 = tmp11 - tmp6;                                                 \
+        T tmp4 = tmp10 + tmp5;                                                 \
+                                                                               \
+        AT(0) = tmp0 + tmp7;                                                   \
+        AT(7) = tmp0 - tmp7;                                                   \
+        AT(1) = tmp1 + tmp6;                                                   \
+        AT(6) = tmp1 - tmp6;                                                   \
+        AT(2) = tmp2 + tmp5;                                                   \
+        AT(5) = tmp2 - tmp5;                                                   \
+        AT(4) = tmp3 + tmp4;                                                   \
+        AT(3) = tmp3 - tmp4;                                                   \
+    } while (0)
+
+// one 8-point butterfly over `p[0], p[s], .., p[7s]`
+#define AT_STRIDED(k) p[(k)*s]
+static inline void fwd_1d(xReal *p, int s) { FWD_1D(xReal, AT_STRIDED); }
+static inline void inv_1d(xReal *p, int s) { INV_1D(xReal, AT_STRIDED); }
+
+// the scalar kernels: rows then columns forward, columns then rows inverse
+static void fwd_scalar(const xReal *in, xReal *out, const xReal *scale,
+                       size_t n)
+{
+    xReal tmp[64];
+
+    for (size_t b = 0; b < n; b++, in += 64, out += 64) {
+        for (int i = 0; i < 64; i++)
+            tmp[i] = in[i];
+        for (int i = 0; i < 8; i++)
+            fwd_1d(tmp + i * 8, 1);
+        for (int i = 0; i < 8; i++)
+            fwd_1d(tmp + i, 8);
+        for (int i = 0; i < 64; i++)
+            out[i] = tmp[i] * scale[i];
+    }
+}
+
+static void inv_scalar(const xReal *in, xReal *out, const xReal *scale,
+                       size_t n)
+{
+    xReal tmp[64];
+
+    for (size_t b = 0; b < n; b++, in += 64, out += 64) {
+        for (int i = 0; i < 64; i++)
+            tmp[i] = in[i] * scale[i];
+        for (int i = 0; i < 8; i++)
+            inv_1d(tmp + i, 8);
+        for (int i = 0; i < 8; i++)
+            inv_1d(tmp + i * 8, 1);
+        for (int i = 0; i < 64; i++)
+            out[i] = tmp[i];
+    }
+}
+
+#ifdef DCT8_X86
+// the vector kernels keep one block row per register (two halves for sse2,
+// two blocks per register for avx-512), a butterfly across the registers
+// transforms the columns, rows are transformed between two transposes
+#define AT_REG(k) r[k]
+
+static inline void fwd_1d_sse2(__m128 *r) { FWD_1D(__m128, AT_REG); }
+static inline void inv_1d_sse2(__m128 *r) { INV_1D(__m128, AT_REG); }
+
+// sse2: `lo[i]`/`hi[i]` hold columns 0-3/4-7 of row i
+static inline void transpose_sse2(__m128 *lo, __m128 *hi)
+{
+    __m128 t;
+    _MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+    _MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+    _MM_TRANSPOSE4_PS(lo[4], lo[5], lo[6], lo[7]);
+    _MM_TRANSPOSE4_PS(hi[4], hi[5], hi[6], hi[7]);
+    for (int i = 0; i < 4; i++) {
+        t = hi[i];
+        hi[i] = lo[i + 4];
+        lo[i + 4] = t;
+    }
+}
+
+static void fwd_sse2(const xReal *in, xReal *out, const xReal *scale,
+                     size_t n)
+{
+    __m128 lo[8], hi[8];
+
+    for (size_t b = 0; b < n; b++, in += 64, out += 64) {
+        for (int i = 0; i < 8; i++) {
+            lo[i] = _mm_loadu_ps(in + i * 8);
+            hi[i] = _mm_loadu_ps(in + i * 8 + 4);
+        }
+        transpose_sse2(lo, hi);
+        fwd_1d_sse2(lo);
+        fwd_1d_sse2(hi);
+        transpose_sse2(lo, hi);
+        fwd_1d_sse2(lo);
+        fwd_1d_sse2(hi);
+        for (int i = 0; i < 8; i++) {
+            _mm_storeu_ps(out + i * 8, lo[i] * _mm_loadu_ps(scale + i * 8));
+            _mm_storeu_ps(out + i * 8 + 4,
+                          hi[i] * _mm_loadu_ps(scale + i * 8 + 4));
+        }
+    }
+}
+
+static void inv_sse2(const xReal *in, xReal *out, const xReal *scale,
+                     size_t n)
+{
+    __m128 lo[8], hi[8];
+
+    for (size_t b = 0; b < n; b++, in += 64, out += 64) {
+        for (int i = 0; i < 8; i++) {
+            lo[i] = _mm_loadu_ps(in + i * 8) * _mm_loadu_ps(scale + i * 8);
+            hi[i] = _mm_loadu_ps(in + i * 8 + 4) *
+                    _mm_loadu_ps(scale + i * 8 + 4);
+        }
+        inv_1d_sse2(lo);
+        inv_1d_sse2(hi);
+        transpose_sse2(lo, hi);
+        inv_1d_sse2(lo);
+        inv_1d_sse2(hi);
+        transpose_sse2(lo, hi);
+        for (int i = 0; i < 8; i++) {
+            _mm_storeu_ps(out + i * 8, lo[i]);
+            _mm_storeu_ps(out + i * 8 + 4, hi[i]);
+        }
+    }
+}
+
+__attribute__((target("avx2"))) static inline void transpose_avx2(__m256 *r)
+{
+    __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+    __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+    __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+    __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+    __m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+    __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+    __m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+
+    __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+    r[0] = _mm256_permute2f128_ps(u0, u4, 0x20);
+    r[1] = _mm256_permute2f128_ps(u1, u5, 0x20);
+    r[2] = _mm256_permute2f128_ps(u2, u6, 0x20);
+    r[3] = _mm256_permute2f128_ps(u3, u7, 0x20);
+    r[4] = _mm256_permute2f128_ps(u0, u4, 0x31);
+    r[5] = _mm256_permute2f128_ps(u1, u5, 0x31);
+    r[6] = _mm256_permute2f128_ps(u2, u6, 0x31);
+    r[7] = _mm256_permute2f128_ps(u3, u7, 0x31);
+}
+
+__attribute__((target("avx2"))) static void
+fwd_avx2(const xReal *in, xReal *out, const xReal *scale, size_t n)
+{
+    __m256 r[8];
+
+    for (size_t b = 0; b < n; b++, in += 64, out += 64) {
+        for (int i = 0; i < 8; i++)
+            r[i] = _mm256_loadu_ps(in + i * 8);
+        transpose_avx2(r);
+        FWD_1D(__m256, AT_REG);
+        transpose_avx2(r);
+        FWD_1D(__m256, AT_REG);
+        for (int i = 0; i < 8; i++)
+            _mm256_storeu_ps(out + i * 8,
+                             r[i] * _mm256_loadu_ps(scale + i * 8));
+    }
+}
+
+__attribute__((target("avx2"))) static void
+inv_avx2(const xReal *in, xReal *out, const xReal *scale, size_t n)
+{
+    __m256 r[8];
+
+    for (size_t b = 0; b < n; b++, in += 64, out += 64) {
+        for (int i = 0; i < 8; i++)
+            r[i] = _mm256_loadu_ps(in + i * 8) *
+                   _mm256_loadu_ps(scale + i * 8);
+        INV_1D(__m256, AT_REG);
+        transpose_avx2(r);
+        INV_1D(__m256, AT_REG);
+        transpose_avx2(r);
+        for (int i = 0; i < 8; i++)
+            _mm256_storeu_ps(out + i * 8, r[i]);
+    }
+}
+
+// avx-512: register i holds row i of block `b` in the low half and row i of
+// block `b + 1` in the high half, the in-lane steps of the transpose are the
+// avx2 ones, the cross-lane step becomes a two-source permute
+__attribute__((target("avx512f"))) static inline void
+transpose_avx512(__m512 *r)
+{
+    const __m512i lo = _mm512_setr_epi32(0, 1, 2, 3, 16, 17, 18, 19, 8, 9,
+                                         10, 11, 24, 25, 26, 27);
+    const __m512i hi = _mm512_setr_epi32(4, 5, 6, 7, 20, 21, 22, 23, 12, 13,
+                                         14, 15, 28, 29, 30, 31);
+    __m512 t[8], u[8];
+
+    for (int i = 0; i < 4; i++) {
+        t[i * 2] = _mm512_unpacklo_ps(r[i * 2], r[i * 2 + 1]);
+        t[i * 2 + 1] = _mm512_unpackhi_ps(r[i * 2], r[i * 2 + 1]);
+    }
+    for (int i = 0; i < 2; i++) {
+        u[i * 4 + 0] = _mm512_shuffle_ps(t[i * 4], t[i * 4 + 2], 0x44);
+        u[i * 4 + 1] = _mm512_shuffle_ps(t[i * 4], t[i * 4 + 2], 0xee);
+        u[i * 4 + 2] = _mm512_shuffle_ps(t[i * 4 + 1], t[i * 4 + 3], 0x44);
+        u[i * 4 + 3] = _mm512_shuffle_ps(t[i * 4 + 1], t[i * 4 + 3], 0xee);
+    }
+    for (int i = 0; i < 4; i++) {
+        r[i] = _mm512_permutex2var_ps(u[i], lo, u[i + 4]);
+        r[i + 4] = _mm512_permutex2var_ps(u[i], hi, u[i + 4]);
+    }
+}
+
+__attribute__((target("avx512f"))) static inline __m512
+load_pair(const xReal *a, const xReal *b)
+{
+    __m512d v = _mm512_castpd256_pd512(_mm256_castps_pd(_mm256_loadu_ps(a)));
+    v = _mm512_insertf64x4(v, _mm256_castps_pd(_mm256_loadu_ps(b)), 1);
+    return _mm512_castpd_ps(v);
+}
+
+__attribute__((target("avx512f"))) static inline void
+store_pair(xReal *a, xReal *b, __m512 v)
+{
+    __m512d d = _mm512_castps_pd(v);
+    _mm256_storeu_ps(a, _mm256_castpd_ps(_mm512_castpd512_pd256(d)));
+    _mm256_storeu_ps(b, _mm256_castpd_ps(_mm512_extractf64x4_pd(d, 1)));
+}
+
+__attribute__((target("avx512f"))) static void
+fwd_avx512(const xReal *in, xReal *out, const xReal *scale, size_t n)
+{
+    __m512 r[8];
+    size_t b;
+
+    for (b = 0; b + 2 <= n; b += 2, in += 128, out += 128) {
+        for (int i = 0; i < 8; i++)
+            r[i] = load_pair(in + i * 8, in + 64 + i * 8);
+        transpose_avx512(r);
+        FWD_1D(__m512, AT_REG);
+        transpose_avx512(r);
+        FWD_1D(__m512, AT_REG);
+        for (int i = 0; i < 8; i++)
+            store_pair(out + i * 8, out + 64 + i * 8,
+                       r[i] * load_pair(scale + i * 8, scale + i * 8));
+    }
+    if (b < n)
+        fwd_avx2(in, out, scale, n - b);
+}
+
+__attribute__((target("avx512f"))) static void
+inv_avx512(const xReal *in, xReal *out, const xReal *scale, size_t n)
+{
+    __m512 r[8];
+    size_t b;
+
+    for (b = 0; b + 2 <= n; b += 2, in += 128, out += 128) {
+        for (int i = 0; i < 8; i++)
+            r[i] = load_pair(in + i * 8, in + 64 + i * 8) *
+                   load_pair(scale + i * 8, scale + i * 8);
+        INV_1D(__m512, AT_REG);
+        transpose_avx512(r);
+        INV_1D(__m512, AT_REG);
+        transpose_avx512(r);
+        for (int i = 0; i < 8; i++)
+            store_pair(out + i * 8, out + 64 + i * 8, r[i]);
+    }
+    if (b < n)
+        inv_avx2(in, out, scale, n - b);
+}
+#endif
+
+typedef void (*Dct8Fn)(const xReal *, xReal *, const xReal *, size_t);
+
+static struct {
+    const char *isa;
+    Dct8Fn fwd, inv;
+} kernels;
+
+// resolved on first use, the race of two threads resolving at once is
+// harmless as both store the same pointers
+static void dct8_dispatch(void)
+{
+    if (kernels.fwd)
+        return;
+
+    const char *isa = "scalar";
+    Dct8Fn fwd = fwd_scalar, inv = inv_scalar;
+#ifdef DCT8_X86
+    int features = cpu_get_features();
+    if (features & CPU_AVX512) {
+        isa = "avx512", fwd = fwd_avx512, inv = inv_avx512;
+    } else if (features & CPU_AVX2) {
+        isa = "avx2", fwd = fwd_avx2, inv = inv_avx2;
+    } else if (features & CPU_SSE2) {
+        isa = "sse2", fwd = fwd_sse2, inv = inv_sse2;
+    }
+#endif
+    kernels.isa = isa;
+    kernels.inv = inv;
+    kernels.fwd = fwd;
+}
+
+const char *dct8_isa(void)
+{
+    dct8_dispatch();
+    return kernels.isa;
+}
+
+int dct8_accelerated(void)
+{
+    dct8_dispatch();
+    return kernels.fwd != fwd_scalar;
+}
+
+void dct8_fwd(const xReal *in, xReal *out, const xReal *scale)
+{
+    dct8_fwd_n(in, out, scale, 1);
+}
+
+void dct8_inv(const xReal *in, xReal *out, const xReal *scale)
+{
+    dct8_inv_n(in, out, scale, 1);
+}
+
+void dct8_fwd_n(const xReal *in, xReal *out, const xReal *scale, size_t n)
+{
+    dct8_dispatch();
+    kernels.fwd(in, out, scale, n);
+}
+
+void dct8_inv_n(const xReal *in, xReal *out, const xReal *scale, size_t n)
+{
+    dct8_dispatch();
+    kernels.inv(in, out, scale, n);
+}
@@ -0,0 +1,38 @@
+#ifndef _DCT8_H_
+#define _DCT8_H_
+
+#include "blk.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// separable AAN 8x8 kernels on contiguous row-major blocks, `in` and `out`
+// may alias. the per-coefficient `scale` table is folded into the transform,
+// build it with `dct8_fwd_scale`/`dct8_inv_scale`.
+//
+// sse2, avx2 and avx-512 kernels are picked at runtime from the cpu features
+// (see cpu.h), `NO_SIMD` builds only have the scalar one. all of them run the
+// same operations in the same order with fp contraction disabled, so they
+// match the scalar kernel exactly. other compilers may fuse multiply-adds,
+// which keeps the results within 1e-6 of the block's largest magnitude
+void dct8_fwd(const xReal *in, xReal *out, const xReal *scale);
+void dct8_inv(const xReal *in, xReal *out, const xReal *scale);
+// the same over `n` consecutive blocks, i.e. `64*n` reals
+void dct8_fwd_n(const xReal *in, xReal *out, const xReal *scale, size_t n);
+void dct8_inv_n(const xReal *in, xReal *out, const xReal *scale, size_t n);
+
+// the kernel set in use: "scalar", "sse2", "avx2" or "avx512"
+const char *dct8_isa(void);
+// non-zero if a vector kernel set is in use
+int dct8_accelerated(void);
+
+// forward output equals the fftw REDFT10 2d transform multiplied by `factor`
+void dct8_fwd_scale(xReal *scale, xReal factor);
+// inverse output equals the fftw REDFT01 2d transform multiplied by `factor`
+void dct8_inv_scale(xReal *scale, xReal factor);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+
+#include "enc.h"
+#include "huff.h"
+
+xEncoder *enc_new(const uint8_t *qtbl, xEncSink sink, void *payload)
+{
+    xEncoder *enc = malloc(sizeof(xEncoder));
+    xQuant quant;
+
+    cpl_quant_init(&quant, qtbl);
+    for (int i = 0; i < 64; i++) {
+        enc->zquant.div[i] = quant.div[jpec_zz[i]];
+        enc->zquant.recip[i] = quant.recip[jpec_zz[i]];
+        enc->zquant.shift[i] = quant.shift[jpec_zz[i]];
+    }
+
+    enc->tbl = rtb_calloc(64);
+    enc->sink = sink;
+    enc->payload = payload;
+    return enc;
+}
+
+void enc_free(xEncoder *enc)
+{
+    if (enc) {
+        rtb_free(enc->tbl);
+        free(enc);
+    }
+}
+
+// `cpl_quantize` reading the coefficients in zigzag order, so the output
+// needs no separate reordering pass
+static void quantize_zz(const int32_t *blk, int16_t *zz, const xQuant *zquant)
+{
+    for (int i = 0; i < 64; i++)
+        zz[i] = cpl_quantize_coef(blk[jpec_zz[i]], zquant, i);
+}
+
+void enc_blk(xEncoder *enc, const uint8_t *src, size_t stride, size_t bx,
+             size_t by)
+{
+    int32_t blk[64];
+    int16_t zz[64];
+
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < 8; j++)
+            blk[i * 8 + j] = (int32_t)src[i * stride + j] - 128;
+
+    cpl_fdct(blk);
+    quantize_zz(blk, zz, &enc->zquant);
+    rtb_parse_i16(enc->tbl, zz);
+
+    if (enc->sink)
+        enc->sink(bx, by, zz[0], enc->tbl, enc->payload);
+}
+
+void enc_plane(xEncoder *enc, const uint8_t *src, size_t w, size_t h,
+               size_t stride)
+{
+    uint8_t edge[64];
+    size_t bw = (w + 7) / 8, bh = (h + 7) / 8;
+
+    for (size_t by = 0; by < bh; by++) {
+        for (size_t bx = 0; bx < bw; bx++) {
+            size_t x = bx * 8, y = by * 8;
+
+            if (x + 8 <= w && y + 8 <= h) {
+                enc_blk(enc, src + y * stride + x, stride, bx, by);
+                continue;
+            }
+
+            cpl_load_edge(edge, src, stride, x, y, w, h);
+            enc_blk(enc, edge, 8, bx, by);
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef _ENC_H_
+#define _ENC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stddef.h>
+#include <stdint.h>
+
+#include "coef.h"
+#include "rle.h"
+
+// receives the symbols of block `(bx, by)`: the quantized DC coefficient,
+// not differenced, and the zigzagged AC run-length items. `tbl` is reused
+// by the next block
+typedef void (*xEncSink)(size_t bx, size_t by, int16_t dc, xRLETable tbl,
+                         void *payload);
+
+// single pass block encoder: gather, level shift, DCT, quantize in zigzag
+// order and run-length encode one 8x8 block while it is hot in cache, no
+// intermediate plane is written
+typedef struct xEncoder {
+    // `xQuant` permuted in zigzag order
+    xQuant zquant;
+    xRLETable tbl;
+    xEncSink sink;
+    void *payload;
+} xEncoder;
+
+// `qtbl` is a natural order quantization table
+xEncoder *enc_new(const uint8_t *qtbl, xEncSink sink, void *payload);
+void enc_free(xEncoder *enc);
+// encode the 8x8 block at `src` and pass it to the sink as `(bx, by)`
+void enc_blk(xEncoder *enc, const uint8_t *src, size_t stride, size_t bx,
+             size_t by);
+// every block of a `w*h` plane in raster order, partial blocks at the right
+// and bottom edges replicate the last column/row
+void enc_plane(xEncoder *enc, const uint8_t *src, size_t w, size_t h,
+               size_t stride);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
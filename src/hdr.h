@@ -19,8 +19,23 @@ ECS:     | <MCU0> <MCU1> <MCU2> ... <MCUn>
 
 clang-format on */
 
-struct JPEG {
-};
+/*
+Marker codes, a marker is 0xFF followed by its code
+*/
+
+#define JPEG_SOI 0xFFD8
+#define JPEG_EOI 0xFFD9
+#define JPEG_SOF0 0xFFC0
+#define JPEG_SOF1 0xFFC1
+#define JPEG_SOF2 0xFFC2
+#define JPEG_DHT 0xFFC4
+#define JPEG_RST0 0xFFD0
+#define JPEG_RST7 0xFFD7
+#define JPEG_SOS 0xFFDA
+#define JPEG_DQT 0xFFDB
+#define JPEG_DRI 0xFFDD
+#define JPEG_APP0 0xFFE0
+
 
 /*
 
@@ -66,6 +81,41 @@ struct ScanHeader {
     uint8_t al : 4;
 };
 
+/*
+Table definitions
+
+Quantization table:
+    | DQT | Lq | Pq,Tq | Q0 .. Q63 (zigzag) |
+
+Huffman table:
+    | DHT | Lh | Tc,Th | L1 .. L16 | V1,1 .. V16,L16 |
+*/
+
+struct HuffTableSpec {
+    uint8_t cls : 4; // 0 for DC, 1 for AC
+    uint8_t idx : 4;
+    // counts of codes of length 1..16 at `nodes[1..16]`
+    const uint8_t *nodes;
+    // the symbols in code order
+    const uint8_t *vals;
+};
+
+// a single scan sequential file
+struct JPEG {
+    struct FrameHeader frame;
+    struct ScanHeader scan;
+
+    int quantize_tables;
+    // natural order
+    uint8_t quantize_tbls[4][64];
+
+    int huffman_tables;
+    struct HuffTableSpec huffman_tbls[8];
+
+    // MCUs between restart markers, 0 for none
+    uint16_t restart_interval;
+};
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,3 +1,6 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "huff.h"
 
 // clang-format off
@@ -12,11 +15,6 @@ const uint8_t jpec_qzr[64] = {
 	72, 92, 95, 98,112,100,103, 99
 };
 
-const float jpec_dct[7] = {
-	0.49039, 0.46194, 0.41573, 0.35355,
-	0.27779, 0.19134, 0.09755
-};
-
 const int jpec_zz[64] = {
 	 0,  1,  8, 16,  9,  2,  3, 10,
 	17, 24, 32, 25, 18, 11,  4,  5,
@@ -58,6 +56,35 @@ const uint8_t jpec_ac_vals[162] = {
 	0xf9,0xfa
 };
 
+const uint8_t jpec_chroma_qzr[64] = {
+	17, 18, 24, 47, 99, 99, 99, 99,
+	18, 21, 26, 66, 99, 99, 99, 99,
+	24, 26, 56, 99, 99, 99, 99, 99,
+	47, 66, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99
+};
+
+const uint8_t jpec_chroma_dc_nodes[17] = { 0,0,3,1,1,1,1,1,1,1,1,1,0,0,0,0,0 };
+const uint8_t jpec_chroma_dc_vals[12] = { 0,1,2,3,4,5,6,7,8,9,10,11 };
+
+const uint8_t jpec_chroma_ac_nodes[17] = { 0,0,2,1,2,4,4,3,4,7,5,4,4,0,1,2,0x77 };
+const uint8_t jpec_chroma_ac_vals[162] = {
+	0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,
+	0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91,0xa1,0xb1,0xc1,0x09,0x23,0x33,0x52,0xf0,
+	0x15,0x62,0x72,0xd1,0x0a,0x16,0x24,0x34,0xe1,0x25,0xf1,0x17,0x18,0x19,0x1a,0x26,
+	0x27,0x28,0x29,0x2a,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,
+	0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,
+	0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x82,0x83,0x84,0x85,0x86,0x87,
+	0x88,0x89,0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,
+	0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,
+	0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,
+	0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,
+	0xf9,0xfa
+};
+
 const uint8_t jpec_dc_len[12] = { 2,3,3,3,3,3,4,5,6,7,8,9 };
 const int jpec_dc_code[12] = { 
 	0x000,0x002,0x003,0x004,0x005,0x006,
@@ -135,27 +162,319 @@ const int jpec_ac_code[256] = {
 };
 // clang-format on
 
-int huff_encode_tbl(uint32_t *bitbuf, xRLETable tbl)
+void bw_init(xBitWriter *bw, size_t cap)
 {
+    bw->acc = 0;
+    bw->free = 64;
+    bw->cap = cap < 64 ? 64 : cap;
+    bw->buf = malloc(bw->cap);
+    bw->size = 0;
+}
 
-    size_t tbl_len = rtb_get_size(tbl);
-    for (int i = 0; i < tbl_len; i++) {
-        uint8_t rs = *(uint8_t *)(&tbl[i].rs);
-        int8_t rs_len = jpec_ac_len[rs];
-        int rs_code = jpec_ac_code[rs];
-        huff_encode_bits(NULL, rs_len, rs_code);
-        int16_t amp = tbl[i].amp;
-        if (amp < 0) {
-            amp -= 1;
-        }
+void bw_free(xBitWriter *bw)
+{
+    free(bw->buf);
+    bw->buf = NULL;
+    bw->size = bw->cap = 0;
+}
+
+void bw_reset(xBitWriter *bw)
+{
+    bw->acc = 0;
+    bw->free = 64;
+    bw->size = 0;
+}
+
+// a word stuffed in the worst case takes 16 bytes
+static void bw_reserve(xBitWriter *bw, size_t n)
+{
+    if (bw->size + n <= bw->cap)
+        return;
+    while (bw->size + n > bw->cap)
+        bw->cap *= 2;
+    bw->buf = realloc(bw->buf, bw->cap);
+}
+
+// the zero byte test on `~word`
+static inline int has_ff_byte(uint64_t word)
+{
+    return ((~word - 0x0101010101010101ull) & word & 0x8080808080808080ull) !=
+           0;
+}
+
+static void bw_write_word(xBitWriter *bw, uint64_t word)
+{
+    bw_reserve(bw, 16);
+
+    // the common case has no 0xFF byte and is a single big endian store
+    if (!has_ff_byte(word)) {
+        uint64_t be = __builtin_bswap64(word);
+        memcpy(bw->buf + bw->size, &be, 8);
+        bw->size += 8;
+        return;
+    }
 
-        huff_encode_bits(bitbuf, tbl[i].rs.nbits, amp);
+    for (int i = 56; i >= 0; i -= 8) {
+        uint8_t byte = word >> i;
+        bw->buf[bw->size++] = byte;
+        if (byte == 0xFF)
+            bw->buf[bw->size++] = 0;
     }
+}
+
+// `bits` has no bits set above `n`, `n` is at most 32
+static inline void bw_put(xBitWriter *bw, uint32_t bits, int n)
+{
+    if (n < bw->free) {
+        bw->acc = (bw->acc << n) | bits;
+        bw->free -= n;
+        return;
+    }
+
+    // fill the word, what doesn't fit starts the next one. the stale high
+    // bits left in `acc` are shifted out before they are written
+    int rest = n - bw->free;
+    bw_write_word(bw, (bw->acc << bw->free) | ((uint64_t)bits >> rest));
+    bw->acc = bits;
+    bw->free = 64 - rest;
+}
+
+void bw_flush(xBitWriter *bw)
+{
+    int pad = (8 - (64 - bw->free) % 8) % 8;
+    bw_put(bw, (1u << pad) - 1, pad);
+
+    int pending = 64 - bw->free;
+    bw_reserve(bw, 16);
+    for (int i = pending - 8; i >= 0; i -= 8) {
+        uint8_t byte = bw->acc >> i;
+        bw->buf[bw->size++] = byte;
+        if (byte == 0xFF)
+            bw->buf[bw->size++] = 0;
+    }
+    bw->acc = 0;
+    bw->free = 64;
+}
+
+void bw_marker(xBitWriter *bw, uint16_t marker)
+{
+    bw_flush(bw);
+    bw_reserve(bw, 2);
+    bw->buf[bw->size++] = marker >> 8;
+    bw->buf[bw->size++] = marker;
+}
 
+void huff_table_from_codes(xHuffTable *t, const int *code, const uint8_t *len,
+                           int n)
+{
+    memset(t, 0, sizeof(*t));
+    for (int i = 0; i < n; i++) {
+        if (len[i] > 0)
+            t->sym[i] = (uint32_t)code[i] << 8 | len[i];
+    }
+}
+
+void huff_table_from_spec(xHuffTable *t, const uint8_t *nodes,
+                          const uint8_t *vals)
+{
+    uint32_t code = 0;
+    int k = 0;
+
+    memset(t, 0, sizeof(*t));
+    for (int len = 1; len <= 16; len++) {
+        for (int i = 0; i < nodes[len]; i++)
+            t->sym[vals[k++]] = code++ << 8 | len;
+        code <<= 1;
+    }
+}
+
+static xHuffTable std_dc, std_ac, std_chroma_dc, std_chroma_ac;
+static int std_ready;
+
+static void std_init(void)
+{
+    if (std_ready)
+        return;
+    huff_table_from_codes(&std_dc, jpec_dc_code, jpec_dc_len, 12);
+    huff_table_from_codes(&std_ac, jpec_ac_code, (const uint8_t *)jpec_ac_len,
+                          256);
+    huff_table_from_spec(&std_chroma_dc, jpec_chroma_dc_nodes,
+                         jpec_chroma_dc_vals);
+    huff_table_from_spec(&std_chroma_ac, jpec_chroma_ac_nodes,
+                         jpec_chroma_ac_vals);
+    std_ready = 1;
+}
+
+const xHuffTable *huff_std_dc(void)
+{
+    std_init();
+    return &std_dc;
+}
+
+const xHuffTable *huff_std_ac(void)
+{
+    std_init();
+    return &std_ac;
+}
+
+const xHuffTable *huff_std_chroma_dc(void)
+{
+    std_init();
+    return &std_chroma_dc;
+}
+
+const xHuffTable *huff_std_chroma_ac(void)
+{
+    std_init();
+    return &std_chroma_ac;
+}
+
+// the magnitude category, i.e. the bit length of `|n|`
+static inline int category(int n)
+{
+    int m = n < 0 ? -n : n;
+    return m == 0 ? 0 : 32 - __builtin_clz(m);
+}
+
+// the code of `sym` followed by the `nbits` amplitude bits as one word,
+// negative amplitudes are sent as `amp - 1` in their low bits
+static inline void put_sym(xBitWriter *bw, const xHuffTable *t, int sym,
+                           int amp, int nbits)
+{
+    uint32_t entry = t->sym[sym];
+    uint32_t mask = (1u << nbits) - 1;
+    uint32_t bits = (uint32_t)(amp < 0 ? amp - 1 : amp) & mask;
+
+    bw_put(bw, (entry >> 8) << nbits | bits, (entry & 0xFF) + nbits);
+}
+
+int huff_encode_bits(xBitWriter *bw, uint16_t nbits, uint16_t bits)
+{
+    bw_put(bw, bits & ((1u << nbits) - 1), nbits);
+    return nbits;
+}
+
+int huff_encode_sym(xBitWriter *bw, const xHuffTable *t, int sym, int amp,
+                    int nbits)
+{
+    put_sym(bw, t, sym, amp, nbits);
     return 0;
 }
 
-int huff_encode_bits(uint32_t *bitbuf, uint16_t nbits, uint16_t bits)
+int huff_encode_dc(xBitWriter *bw, const xHuffTable *dc, int diff)
 {
+    int nbits = category(diff);
+    put_sym(bw, dc, nbits, diff, nbits);
     return 0;
 }
+
+int huff_encode_tbl(xBitWriter *bw, const xHuffTable *ac, xRLETable tbl)
+{
+    size_t tbl_len = rtb_get_size(tbl);
+
+    for (int i = 0; i < tbl_len; i++) {
+        // JPEG's RS byte is `run << 4 | size`
+        int rs = tbl[i].rs.zeros << 4 | tbl[i].rs.nbits;
+        put_sym(bw, ac, rs, tbl[i].amp, tbl[i].rs.nbits);
+    }
+
+    return 0;
+}
+
+int huff_encode_blk(xBitWriter *bw, const xHuffTable *dc,
+                    const xHuffTable *ac, int16_t dc_val, int16_t *last_dc,
+                    xRLETable tbl)
+{
+    huff_encode_dc(bw, dc, dc_val - *last_dc);
+    *last_dc = dc_val;
+    return huff_encode_tbl(bw, ac, tbl);
+}
+
+void huff_count_blk(uint32_t *dc_freq, uint32_t *ac_freq, int16_t dc_val,
+                    int16_t *last_dc, xRLETable tbl)
+{
+    size_t tbl_len = rtb_get_size(tbl);
+
+    dc_freq[category(dc_val - *last_dc)]++;
+    *last_dc = dc_val;
+    for (size_t i = 0; i < tbl_len; i++)
+        ac_freq[tbl[i].rs.zeros << 4 | tbl[i].rs.nbits]++;
+}
+
+// the code length of every symbol from repeatedly merging the two least
+// frequent subtrees, then moved down to 16 bits (Annex K.2, figures K.1 to
+// K.3). a reserved symbol 256 with the lowest frequency takes the all ones
+// code of the longest length, no real code may consist of ones only
+int huff_spec_from_freq(uint8_t *nodes, uint8_t *vals, const uint32_t *freq)
+{
+    uint64_t f[257];
+    int size[257], others[257], bits[257] = {0};
+    int n = 0;
+
+    for (int i = 0; i < 256; i++)
+        f[i] = freq[i];
+    f[256] = 1;
+    for (int i = 0; i < 257; i++) {
+        size[i] = 0;
+        others[i] = -1;
+    }
+
+    for (;;) {
+        // the least frequent, ties go to the larger symbol
+        int c1 = -1, c2 = -1;
+        for (int i = 0; i < 257; i++)
+            if (f[i] && (c1 < 0 || f[i] <= f[c1]))
+                c1 = i;
+        for (int i = 0; i < 257; i++)
+            if (f[i] && i != c1 && (c2 < 0 || f[i] <= f[c2]))
+                c2 = i;
+        if (c2 < 0)
+            break;
+
+        f[c1] += f[c2];
+        f[c2] = 0;
+
+        // one bit more for everything in both subtrees, then chain them
+        for (size[c1]++; others[c1] >= 0; size[c1]++)
+            c1 = others[c1];
+        others[c1] = c2;
+        for (size[c2]++; others[c2] >= 0; size[c2]++)
+            c2 = others[c2];
+    }
+
+    for (int i = 0; i < 257; i++)
+        if (size[i])
+            bits[size[i]]++;
+
+    // a pair of codes at length i becomes one at i - 1 and the other takes
+    // the place of a shorter code, which moves one bit down with a sibling
+    for (int i = 256; i > 16; i--) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (bits[j] == 0)
+                j--;
+            bits[i] -= 2;
+            bits[i - 1]++;
+            bits[j + 1] += 2;
+            bits[j]--;
+        }
+    }
+
+    // drop the reserved code from the longest length
+    int last = 16;
+    while (last > 0 && bits[last] == 0)
+        last--;
+    if (last > 0)
+        bits[last]--;
+
+    nodes[0] = 0;
+    for (int i = 1; i <= 16; i++)
+        nodes[i] = bits[i];
+
+    // the symbols by their unlimited code length, the canonical order
+    for (int len = 1; len <= 256; len++)
+        for (int i = 0; i < 256; i++)
+            if (size[i] == len)
+                vals[n++] = i;
+    return n;
+}
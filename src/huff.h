@@ -5,10 +5,18 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "rle.h"
 
+/** JPEG standard luminance quantization table, natural order */
+extern const uint8_t jpec_qzr[64];
+/** JPEG standard chrominance quantization table, natural order */
+extern const uint8_t jpec_chroma_qzr[64];
+/** zigzag position -> natural order index */
+extern const int jpec_zz[64];
+
 /** JPEG standard Huffman tables */
 /** Luminance (Y) - DC */
 extern const uint8_t jpec_dc_nodes[17];
@@ -18,6 +26,12 @@ extern const uint8_t jpec_dc_vals[12];
 extern const uint8_t jpec_ac_nodes[17];
 extern const int jpec_ac_nb_vals;
 extern const uint8_t jpec_ac_vals[162];
+/** Chrominance (Cb/Cr) - DC */
+extern const uint8_t jpec_chroma_dc_nodes[17];
+extern const uint8_t jpec_chroma_dc_vals[12];
+/** Chrominance (Cb/Cr) - AC */
+extern const uint8_t jpec_chroma_ac_nodes[17];
+extern const uint8_t jpec_chroma_ac_vals[162];
 
 /** Huffman inverted tables */
 /** Luminance (Y) - DC */
@@ -27,10 +41,69 @@ extern const int jpec_dc_code[12];
 extern const int8_t jpec_ac_len[256];
 extern const int jpec_ac_code[256];
 
-// encode a run-length encoded table into buffer
-int huff_encode_tbl(uint32_t *bitbuf, xRLETable tbl);
-// encode `nbits` of bits into buffer
-int huff_encode_bits(uint32_t *bitbuf, uint16_t nbits, uint16_t bits);
+// a 64-bit accumulator bit writer, msb first. whole words are flushed to a
+// growing byte buffer with a 0x00 stuffed after every 0xFF
+typedef struct xBitWriter {
+    uint64_t acc;
+    // room left in `acc`, the pending bits are its low `64 - free` bits
+    int free;
+    uint8_t *buf;
+    size_t size, cap;
+} xBitWriter;
+
+void bw_init(xBitWriter *bw, size_t cap);
+void bw_free(xBitWriter *bw);
+// drop the output but keep the buffer
+void bw_reset(xBitWriter *bw);
+// pad the last byte with 1 bits and write out everything pending
+void bw_flush(xBitWriter *bw);
+// flush and append a marker, e.g. RSTn, unstuffed
+void bw_marker(xBitWriter *bw, uint16_t marker);
+
+// an encoding table, every entry packs the code and its length as
+// `code << 8 | len` so one load gives both, 0 for symbols without a code
+typedef struct xHuffTable {
+    uint32_t sym[256];
+} xHuffTable;
+
+// from inverted `code`/`len` tables like `jpec_ac_code`/`jpec_ac_len`
+void huff_table_from_codes(xHuffTable *t, const int *code, const uint8_t *len,
+                           int n);
+// from a DHT style spec, counts of codes of length 1..16 at `nodes[1..16]`
+// and the symbols in code order (JPEG Annex C)
+void huff_table_from_spec(xHuffTable *t, const uint8_t *nodes,
+                          const uint8_t *vals);
+// the standard luminance tables of Annex K
+const xHuffTable *huff_std_dc(void);
+const xHuffTable *huff_std_ac(void);
+// and the chrominance ones
+const xHuffTable *huff_std_chroma_dc(void);
+const xHuffTable *huff_std_chroma_ac(void);
+
+// encode `nbits` low bits of `bits`
+int huff_encode_bits(xBitWriter *bw, uint16_t nbits, uint16_t bits);
+// encode `sym` through `t` followed by the `nbits` amplitude bits of `amp`,
+// a negative amplitude is sent as `amp - 1`
+int huff_encode_sym(xBitWriter *bw, const xHuffTable *t, int sym, int amp,
+                    int nbits);
+// encode a DC difference, its category through `dc` and the amplitude
+int huff_encode_dc(xBitWriter *bw, const xHuffTable *dc, int diff);
+// encode the AC items of a run-length encoded table
+int huff_encode_tbl(xBitWriter *bw, const xHuffTable *ac, xRLETable tbl);
+// encode a whole block, the DC coefficient as the difference to `*last_dc`
+// which is updated
+int huff_encode_blk(xBitWriter *bw, const xHuffTable *dc,
+                    const xHuffTable *ac, int16_t dc_val, int16_t *last_dc,
+                    xRLETable tbl);
+
+// gather the symbols `huff_encode_blk` would code into the frequencies of a
+// DC and an AC table
+void huff_count_blk(uint32_t *dc_freq, uint32_t *ac_freq, int16_t dc_val,
+                    int16_t *last_dc, xRLETable tbl);
+// an optimal code of at most 16 bits for the 256 symbol `freq` as a DHT
+// style spec, symbols that never occur get no code. returns the number of
+// symbols in `vals`
+int huff_spec_from_freq(uint8_t *nodes, uint8_t *vals, const uint32_t *freq);
 
 #ifdef __cplusplus
 }
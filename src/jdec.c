@@ -0,0 +1,727 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dct8.h"
+#include "hdr.h"
+#include "huff.h"
+#include "jdec.h"
+#include "yuv.h"
+
+// a canonical Huffman code, the lookup table resolves codes of up to
+// `JDEC_LUT_BITS` bits at once and longer ones are searched by length
+typedef struct JdecHuff {
+    // `len << 8 | symbol`, 0 where the code is longer than the table
+    uint16_t lut[1 << JDEC_LUT_BITS];
+    // the largest code of every length, -1 if there is none
+    int32_t maxcode[17];
+    // `vals` index of a code of every length, minus the code
+    int32_t valoff[17];
+    uint8_t vals[256];
+    int ready;
+} JdecHuff;
+
+// msb first, the next bit is the top bit of `acc`. the reader stops at a
+// marker and feeds zero bits from there
+typedef struct BitReader {
+    const uint8_t *p, *end;
+    uint64_t acc;
+    int bits;
+    int marker;
+} BitReader;
+
+typedef struct JdecComp {
+    int id, hf, vf, tq;
+    // the plane covers whole MCUs
+    size_t stride, rows;
+    uint8_t *plane;
+    const JdecHuff *dc, *ac;
+    // the idct scale with the dequantization folded in, and the sample
+    // value of a unit DC coefficient
+    xReal scale[64];
+    xReal dc_gain;
+} JdecComp;
+
+typedef struct Jdec {
+    struct JPEG jpeg;
+    const uint8_t *p, *end;
+    // restart intervals are decoded on its workers, may be NULL
+    xPool *pool;
+    JdecHuff huff[2][4];
+    JdecComp comp[3];
+    int ncomp, hmax, vmax;
+    // MCUs of an interleaved scan
+    size_t mx, my;
+} Jdec;
+
+static unsigned get16(const uint8_t *p) { return p[0] << 8 | p[1]; }
+
+static int huff_build(JdecHuff *h, const uint8_t *nodes, const uint8_t *vals)
+{
+    int32_t code = 0;
+    int k = 0;
+
+    memset(h, 0, sizeof(*h));
+    for (int len = 1; len <= 16; len++) {
+        h->valoff[len] = k - code;
+        for (int i = 0; i < nodes[len]; i++, code++, k++) {
+            h->vals[k] = vals[k];
+            if (len > JDEC_LUT_BITS)
+                continue;
+
+            // every index starting with the code
+            int shift = JDEC_LUT_BITS - len;
+            for (int j = 0; j < 1 << shift; j++)
+                h->lut[code << shift | j] = len << 8 | vals[k];
+        }
+        h->maxcode[len] = nodes[len] ? code - 1 : -1;
+        // the codes of a length must fit in it
+        if (code > 1 << len)
+            return -1;
+        code <<= 1;
+    }
+    h->ready = 1;
+    return 0;
+}
+
+static void br_init(BitReader *br, const uint8_t *p, const uint8_t *end)
+{
+    br->p = p;
+    br->end = end;
+    br->acc = 0;
+    br->bits = 0;
+    br->marker = 0;
+}
+
+// the zero byte test on `~word`
+static inline int has_ff_byte(uint64_t word)
+{
+    return ((~word - 0x0101010101010101ull) & word & 0x8080808080808080ull) !=
+           0;
+}
+
+// top up to at least 57 bits, dropping the stuffed zero after every 0xFF
+static void br_fill(BitReader *br)
+{
+    // whole bytes at once while there is neither stuffing nor a marker
+    if (!br->marker && br->end - br->p >= 8) {
+        uint64_t word;
+        memcpy(&word, br->p, 8);
+        word = __builtin_bswap64(word);
+        if (!has_ff_byte(word)) {
+            int n = (64 - br->bits) >> 3;
+            br->acc |= word >> (64 - 8 * n) << (64 - 8 * n - br->bits);
+            br->p += n;
+            br->bits += 8 * n;
+            return;
+        }
+    }
+
+    while (br->bits <= 56) {
+        uint32_t byte = 0;
+
+        if (!br->marker && br->p < br->end) {
+            byte = *br->p;
+            if (byte != 0xFF) {
+                br->p++;
+            } else if (br->p + 1 < br->end && br->p[1] == 0) {
+                br->p += 2;
+            } else {
+                br->marker = 1;
+                byte = 0;
+            }
+        }
+        br->acc |= (uint64_t)byte << (56 - br->bits);
+        br->bits += 8;
+    }
+}
+
+static inline void br_skip(BitReader *br, int n)
+{
+    br->acc <<= n;
+    br->bits -= n;
+}
+
+// the next `n` (1..16) bits as a signed amplitude of category `n`
+static inline int br_extend(BitReader *br, int n)
+{
+    int v = (int)(br->acc >> (64 - n));
+    br_skip(br, n);
+    return v < 1 << (n - 1) ? v - (1 << n) + 1 : v;
+}
+
+// a symbol followed by up to 16 more bits is always buffered
+static inline int huff_decode(BitReader *br, const JdecHuff *h)
+{
+    if (br->bits < 32)
+        br_fill(br);
+
+    uint32_t e = h->lut[br->acc >> (64 - JDEC_LUT_BITS)];
+    if (e) {
+        br_skip(br, e >> 8);
+        return e & 0xFF;
+    }
+
+    for (int len = JDEC_LUT_BITS + 1; len <= 16; len++) {
+        int32_t code = (int32_t)(br->acc >> (64 - len));
+        if (code <= h->maxcode[len]) {
+            br_skip(br, len);
+            return h->vals[h->valoff[len] + code];
+        }
+    }
+    return -1;
+}
+
+// skip the padding bits and the RSTn marker ending a restart interval
+static int br_restart(BitReader *br)
+{
+    const uint8_t *p = br->p;
+
+    while (p + 1 < br->end && !(p[0] == 0xFF && p[1] >= (JPEG_RST0 & 0xFF) &&
+                                 p[1] <= (JPEG_RST7 & 0xFF)))
+        p++;
+    if (p + 1 >= br->end)
+        return -1;
+    br_init(br, p + 2, br->end);
+    return 0;
+}
+
+static void store_blk(uint8_t *dst, size_t stride, const xReal *blk)
+{
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+            int v = (int)(blk[i * 8 + j] + 128.5f);
+            dst[i * stride + j] = v < 0 ? 0 : v > 255 ? 255 : v;
+        }
+    }
+}
+
+// `pred` is the DC predictor of the component
+static int decode_blk(BitReader *br, const JdecComp *c, int16_t *pred,
+                      uint8_t *dst)
+{
+    xReal blk[64];
+    int s = huff_decode(br, c->dc), last = 0;
+
+    if (s < 0 || s > 11)
+        return -1;
+    *pred += s ? br_extend(br, s) : 0;
+
+    memset(blk, 0, sizeof(blk));
+    blk[0] = *pred;
+    for (int k = 1; k < 64; k++) {
+        int rs = huff_decode(br, c->ac);
+        if (rs < 0)
+            return -1;
+
+        int r = rs >> 4;
+        s = rs & 15;
+        if (s == 0) {
+            if (r != 15)
+                break;
+            k += 15;
+            continue;
+        }
+        k += r;
+        if (k > 63)
+            return -1;
+        blk[jpec_zz[k]] = br_extend(br, s);
+        last = k;
+    }
+
+    // flat blocks are common and need no transform
+    if (last == 0) {
+        int v = (int)(*pred * c->dc_gain + 128.5f);
+        memset(dst, v < 0 ? 0 : v > 255 ? 255 : v, 8);
+        for (int i = 1; i < 8; i++)
+            memcpy(dst + i * c->stride, dst, 8);
+        return 0;
+    }
+
+    dct8_inv(blk, blk, c->scale);
+    store_blk(dst, c->stride, blk);
+    return 0;
+}
+
+// the coefficients are the quantized JPEG DCT F(u, v) / q(u, v), while the
+// inverse kernel takes the normalized `mat_dct_blks` coefficients which are
+// F / (2 * C(u) * C(v)). both factors go into the kernel's input scale
+static void comp_scale(JdecComp *c, const uint8_t *q)
+{
+    dct8_inv_scale(c->scale, 1.f / 8.f);
+    for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+            double a = (u ? M_SQRT1_2 : 1.0) * (v ? M_SQRT1_2 : 1.0);
+            c->scale[v * 8 + u] *= q[v * 8 + u] * a;
+        }
+    }
+    c->dc_gain = q[0] / 8.f;
+}
+
+// the MCUs `[first, first + count)` in raster order of a scan `mx` MCUs
+// wide, with predictors `pred` which start at 0
+static int decode_mcus(JdecComp **comps, int ns, BitReader *br, size_t mx,
+                       size_t first, size_t count)
+{
+    int16_t pred[3] = {0};
+
+    for (size_t m = first; m < first + count; m++) {
+        size_t x = m % mx, y = m / mx;
+
+        for (int i = 0; i < ns; i++) {
+            JdecComp *c = comps[i];
+            int hf = ns > 1 ? c->hf : 1, vf = ns > 1 ? c->vf : 1;
+
+            for (int v = 0; v < vf; v++) {
+                for (int h = 0; h < hf; h++) {
+                    size_t bx = x * hf + h, by = y * vf + v;
+                    uint8_t *dst = c->plane + by * 8 * c->stride + bx * 8;
+                    if (decode_blk(br, c, &pred[i], dst) < 0)
+                        return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// the restart intervals of a scan, each starting after an RSTn marker
+typedef struct SegJob {
+    JdecComp **comps;
+    int ns;
+    size_t mx, total, interval;
+    const uint8_t **start, *end;
+    int *err;
+} SegJob;
+
+static void seg_task(void *arg, size_t begin, size_t end, int worker)
+{
+    SegJob *job = arg;
+
+    for (size_t k = begin; k < end; k++) {
+        size_t first = k * job->interval;
+        size_t count = job->total - first < job->interval ? job->total - first
+                                                          : job->interval;
+        BitReader br;
+
+        br_init(&br, job->start[k], job->end);
+        job->err[k] = decode_mcus(job->comps, job->ns, &br, job->mx, first,
+                                  count);
+    }
+}
+
+// the start of every interval and the end of the entropy coded data, which
+// is where the first marker other than RSTn is. -1 unless there are
+// exactly `nseg` intervals
+static int find_segments(const uint8_t *p, const uint8_t *end,
+                         const uint8_t **start, size_t nseg,
+                         const uint8_t **data_end)
+{
+    size_t n = 1;
+
+    start[0] = p;
+    while ((p = memchr(p, 0xFF, end - p)) != NULL && p + 1 < end) {
+        if (p[1] == 0) {
+            p += 2;
+            continue;
+        }
+        if (p[1] < (JPEG_RST0 & 0xFF) || p[1] > (JPEG_RST7 & 0xFF))
+            break;
+        if (n == nseg)
+            return -1;
+        p += 2;
+        start[n++] = p;
+    }
+    *data_end = p && p + 1 < end ? p : end;
+    return n == nseg ? 0 : -1;
+}
+
+// the intervals of a scan are independent once their starts are known, so
+// with a pool they are found first and decoded in parallel
+static int decode_scan_mt(Jdec *d, JdecComp **comps, int ns, size_t mx,
+                          size_t total)
+{
+    size_t interval = d->jpeg.restart_interval;
+    size_t nseg = (total + interval - 1) / interval;
+    const uint8_t **start = malloc(sizeof(const uint8_t *) * nseg);
+    int *err = calloc(nseg, sizeof(int));
+    SegJob job = {comps, ns, mx, total, interval, start, d->end, err};
+    const uint8_t *data_end;
+    int ret = find_segments(d->p, d->end, start, nseg, &data_end);
+
+    if (ret == 0) {
+        pool_for(d->pool, nseg, 1, seg_task, &job);
+        for (size_t k = 0; k < nseg; k++)
+            ret |= err[k];
+        d->p = data_end;
+    }
+
+    free(start);
+    free(err);
+    return ret < 0 ? -1 : 0;
+}
+
+static int decode_scan(Jdec *d, JdecComp **comps, int ns)
+{
+    BitReader br;
+    size_t interval = d->jpeg.restart_interval;
+    size_t mx = d->mx, my = d->my;
+
+    // a single component scan isn't interleaved, its MCU is one block
+    if (ns == 1) {
+        JdecComp *c = comps[0];
+        size_t w = (d->jpeg.frame.line_width * c->hf + d->hmax - 1) / d->hmax;
+        size_t h = (d->jpeg.frame.line_height * c->vf + d->vmax - 1) / d->vmax;
+        mx = (w + 7) / 8;
+        my = (h + 7) / 8;
+    }
+
+    size_t total = mx * my;
+    if (interval == 0 || interval > total)
+        interval = total;
+
+    // whatever the parallel path can't make sense of, e.g. missing RSTn
+    // markers, is left to the serial one
+    if (pool_size(d->pool) > 1 && interval < total &&
+        decode_scan_mt(d, comps, ns, mx, total) == 0)
+        return 0;
+
+    br_init(&br, d->p, d->end);
+    for (size_t first = 0; first < total; first += interval) {
+        if (first > 0 && br_restart(&br) < 0)
+            return -1;
+
+        size_t count = total - first < interval ? total - first : interval;
+        if (decode_mcus(comps, ns, &br, mx, first, count) < 0)
+            return -1;
+    }
+
+    // continue at the marker after the entropy coded data
+    const uint8_t *p = br.p;
+    while (p + 1 < d->end &&
+           !(p[0] == 0xFF && p[1] != 0 &&
+             (p[1] < (JPEG_RST0 & 0xFF) || p[1] > (JPEG_RST7 & 0xFF))))
+        p++;
+    d->p = p;
+    return 0;
+}
+
+static int parse_dqt(Jdec *d, const uint8_t *seg, size_t len)
+{
+    struct JPEG *jpeg = &d->jpeg;
+
+    while (len > 0) {
+        int pq = seg[0] >> 4, tq = seg[0] & 15;
+        if (pq != 0 || tq > 3 || len < 65)
+            return -1;
+        for (int i = 0; i < 64; i++)
+            jpeg->quantize_tbls[tq][jpec_zz[i]] = seg[1 + i];
+        if (jpeg->quantize_tables < tq + 1)
+            jpeg->quantize_tables = tq + 1;
+        seg += 65;
+        len -= 65;
+    }
+    return 0;
+}
+
+// the table specs keep pointing into the input
+static int parse_dht(Jdec *d, const uint8_t *seg, size_t len)
+{
+    struct JPEG *jpeg = &d->jpeg;
+
+    while (len > 0) {
+        if (len < 17)
+            return -1;
+
+        int tc = seg[0] >> 4, th = seg[0] & 15;
+        size_t n = 0;
+        for (int i = 1; i <= 16; i++)
+            n += seg[i];
+        if (tc > 1 || th > 3 || n > 256 || len < 17 + n)
+            return -1;
+        if (huff_build(&d->huff[tc][th], seg, seg + 17) < 0)
+            return -1;
+
+        struct HuffTableSpec spec = {tc, th, seg, seg + 17};
+        int i = 0;
+        while (i < jpeg->huffman_tables &&
+               (jpeg->huffman_tbls[i].cls != tc ||
+                jpeg->huffman_tbls[i].idx != th))
+            i++;
+        jpeg->huffman_tbls[i] = spec;
+        if (i == jpeg->huffman_tables)
+            jpeg->huffman_tables++;
+
+        seg += 17 + n;
+        len -= 17 + n;
+    }
+    return 0;
+}
+
+static int parse_frame(Jdec *d, uint16_t marker, const uint8_t *seg,
+                       size_t len)
+{
+    struct FrameHeader *frame = &d->jpeg.frame;
+
+    if (d->ncomp || len < 6)
+        return -1;
+
+    frame->start_marker = marker;
+    frame->header_len = len + 2;
+    frame->sample_precision = seg[0];
+    frame->line_height = get16(seg + 1);
+    frame->line_width = get16(seg + 3);
+    frame->components = seg[5];
+    if (frame->sample_precision != 8 || frame->line_height == 0 ||
+        frame->line_width == 0 ||
+        (frame->components != 1 && frame->components != 3) ||
+        len < 6 + 3 * frame->components)
+        return -1;
+
+    d->ncomp = frame->components;
+    d->hmax = d->vmax = 1;
+    for (int i = 0; i < d->ncomp; i++) {
+        const uint8_t *p = seg + 6 + 3 * i;
+        JdecComp *c = &d->comp[i];
+
+        frame->comp_params[i].idx = c->id = p[0];
+        frame->comp_params[i].h_smaple_factor = c->hf = p[1] >> 4;
+        frame->comp_params[i].v_sample_factor = c->vf = p[1] & 15;
+        frame->comp_params[i].quantize_table_idx = c->tq = p[2];
+        if (c->hf < 1 || c->hf > 4 || c->vf < 1 || c->vf > 4 || c->tq > 3)
+            return -1;
+        d->hmax = c->hf > d->hmax ? c->hf : d->hmax;
+        d->vmax = c->vf > d->vmax ? c->vf : d->vmax;
+    }
+
+    d->mx = (frame->line_width + 8 * d->hmax - 1) / (8 * d->hmax);
+    d->my = (frame->line_height + 8 * d->vmax - 1) / (8 * d->vmax);
+    for (int i = 0; i < d->ncomp; i++) {
+        JdecComp *c = &d->comp[i];
+
+        // upsampling is by whole factors only
+        if (d->hmax % c->hf || d->vmax % c->vf)
+            return -1;
+        c->stride = d->mx * c->hf * 8;
+        c->rows = d->my * c->vf * 8;
+        c->plane = calloc(c->stride, c->rows);
+    }
+    return 0;
+}
+
+static int parse_scan(Jdec *d, const uint8_t *seg, size_t len)
+{
+    struct ScanHeader *scan = &d->jpeg.scan;
+    JdecComp *comps[3];
+
+    if (d->ncomp == 0 || len < 1)
+        return -1;
+
+    scan->start_marker = JPEG_SOS;
+    scan->header_len = len + 2;
+    scan->components = seg[0];
+    if (scan->components < 1 || scan->components > d->ncomp ||
+        len < 4 + 2 * scan->components)
+        return -1;
+
+    for (int i = 0; i < scan->components; i++) {
+        const uint8_t *p = seg + 1 + 2 * i;
+        int td = p[1] >> 4, ta = p[1] & 15, k = 0;
+
+        while (k < d->ncomp && d->comp[k].id != p[0])
+            k++;
+        if (k == d->ncomp || td > 3 || ta > 3 || !d->huff[0][td].ready ||
+            !d->huff[1][ta].ready)
+            return -1;
+
+        scan->comp_params[i].idx = p[0];
+        scan->comp_params[i].dc_tbl_idx = td;
+        scan->comp_params[i].ac_tbl_idx = ta;
+        comps[i] = &d->comp[k];
+        comps[i]->dc = &d->huff[0][td];
+        comps[i]->ac = &d->huff[1][ta];
+        comp_scale(comps[i], d->jpeg.quantize_tbls[comps[i]->tq]);
+    }
+
+    const uint8_t *p = seg + 1 + 2 * scan->components;
+    scan->start_spectral = p[0];
+    scan->endof_spectral = p[1];
+    scan->ah = p[2] >> 4;
+    scan->al = p[2] & 15;
+    if (scan->start_spectral != 0 || scan->endof_spectral != 63 ||
+        p[2] != 0)
+        return -1;
+
+    return decode_scan(d, comps, scan->components);
+}
+
+typedef struct OutJob {
+    const Jdec *d;
+    PixelBuffer *pxb;
+} OutJob;
+
+static void output_task(void *arg, size_t begin, size_t end, int worker)
+{
+    const OutJob *job = arg;
+    const Jdec *d = job->d;
+    PixelBuffer *pxb = job->pxb;
+    size_t w = pxb->w;
+    uint8_t *up = malloc(w * 3);
+    const uint8_t *rows[3];
+
+    for (size_t y = begin; y < end; y++) {
+        uint8_t *dst = pxb->plane[0] + y * pxb->stride[0];
+
+        // nearest neighbour upsampling of the subsampled components
+        for (int i = 0; i < d->ncomp; i++) {
+            const JdecComp *c = &d->comp[i];
+            size_t sx = d->hmax / c->hf, sy = d->vmax / c->vf;
+            const uint8_t *row = c->plane + y / sy * c->stride;
+
+            rows[i] = row;
+            if (sx > 1) {
+                uint8_t *out = up + i * w;
+                for (size_t x = 0; x < w; row++)
+                    for (size_t k = 0; k < sx && x < w; k++)
+                        out[x++] = *row;
+                rows[i] = up + i * w;
+            }
+        }
+
+        if (d->ncomp == 3) {
+            ycbcr_to_rgb(UPSAMPLE_NEAREST, 1, 1, w, 1, rows[0], w, rows[1],
+                         rows[2], w, dst, w * 3, 3);
+        } else {
+            pxb_planes_to_rgb24(rows[0], rows[0], rows[0], w, dst);
+        }
+    }
+
+    free(up);
+}
+
+static PixelBuffer *jdec_output(Jdec *d)
+{
+    size_t w = d->jpeg.frame.line_width, h = d->jpeg.frame.line_height;
+    const JdecComp *c = d->comp;
+
+    // full resolution luma with 4:4:4, 4:2:2 or 4:2:0 chroma is upsampled
+    // with libjpeg's default triangle filter while converting
+    if (d->ncomp == 3 && c[0].hf == d->hmax && c[0].vf == d->vmax &&
+        c[1].hf == c[2].hf && c[1].vf == c[2].vf &&
+        c[1].stride == c[2].stride &&
+        d->hmax / c[1].hf <= 2 && d->vmax / c[1].vf <= 2 &&
+        d->hmax % c[1].hf == 0 && d->vmax % c[1].vf == 0)
+        return ycbcr_to_pxb(d->pool, UPSAMPLE_FANCY, d->hmax / c[1].hf,
+                            d->vmax / c[1].vf, w, h, c[0].plane, c[0].stride,
+                            c[1].plane, c[2].plane, c[1].stride);
+
+    PixelBuffer *pxb = pxb_new(FMT_RGB24, w, h, NULL);
+    OutJob job = {d, pxb};
+
+    pool_for(d->pool, h, 16, output_task, &job);
+    return pxb;
+}
+
+PixelBuffer *jdec_decode_mem(const uint8_t *data, size_t size)
+{
+    return jdec_decode_mem_mt(NULL, data, size);
+}
+
+PixelBuffer *jdec_decode_mem_mt(xPool *pool, const uint8_t *data, size_t size)
+{
+    Jdec *d = calloc(1, sizeof(Jdec));
+    PixelBuffer *pxb = NULL;
+    int ret = 0, done = 0;
+
+    d->pool = pool;
+
+    d->p = data;
+    d->end = data + size;
+    if (size < 2 || get16(data) != JPEG_SOI)
+        ret = -1;
+    d->p += 2;
+
+    while (ret == 0 && !done) {
+        // markers may be preceded by any number of 0xFF fill bytes
+        while (d->p + 1 < d->end && d->p[0] == 0xFF && d->p[1] == 0xFF)
+            d->p++;
+        if (d->p + 1 >= d->end || d->p[0] != 0xFF) {
+            ret = -1;
+            break;
+        }
+
+        uint16_t marker = get16(d->p);
+        d->p += 2;
+        if (marker == JPEG_EOI) {
+            done = 1;
+            break;
+        }
+        if (marker >= JPEG_RST0 && marker <= JPEG_RST7)
+            continue;
+
+        if (d->p + 2 > d->end || get16(d->p) < 2 ||
+            d->p + get16(d->p) > d->end) {
+            ret = -1;
+            break;
+        }
+        const uint8_t *seg = d->p + 2;
+        size_t len = get16(d->p) - 2;
+        d->p += len + 2;
+
+        switch (marker) {
+        case JPEG_SOF0:
+        case JPEG_SOF1:
+            ret = parse_frame(d, marker, seg, len);
+            break;
+        case JPEG_DHT:
+            ret = parse_dht(d, seg, len);
+            break;
+        case JPEG_DQT:
+            ret = parse_dqt(d, seg, len);
+            break;
+        case JPEG_DRI:
+            ret = len < 2 ? -1 : 0;
+            if (ret == 0)
+                d->jpeg.restart_interval = get16(seg);
+            break;
+        case JPEG_SOS:
+            ret = parse_scan(d, seg, len);
+            break;
+        default:
+            // other frame types are not supported, APPn, COM etc skipped
+            if ((marker & 0xFFF0) == 0xFFC0 && marker != 0xFFC4 &&
+                marker != 0xFFC8 && marker != 0xFFCC)
+                ret = -1;
+            break;
+        }
+    }
+
+    if (ret == 0 && done && d->ncomp)
+        pxb = jdec_output(d);
+
+    for (int i = 0; i < d->ncomp; i++)
+        free(d->comp[i].plane);
+    free(d);
+    return pxb;
+}
+
+PixelBuffer *jdec_decode_file(const char *name)
+{
+    FILE *f = fopen(name, "rb");
+    if (f == NULL)
+        return NULL;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *data = size > 0 ? malloc(size) : NULL;
+    PixelBuffer *pxb = NULL;
+    if (data && fread(data, 1, size, f) == (size_t)size)
+        pxb = jdec_decode_mem(data, size);
+
+    free(data);
+    fclose(f);
+    return pxb;
+}
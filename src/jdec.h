@@ -0,0 +1,28 @@
+#ifndef _JDEC_H_
+#define _JDEC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pool.h"
+#include "pxb.h"
+
+// bits of the first level Huffman lookup, longer codes take the slow path
+#define JDEC_LUT_BITS 9
+
+// decode a baseline (or extended 8-bit Huffman) sequential JPEG with 1 or 3
+// components into a FMT_RGB24 buffer, grayscale is replicated into r, g and
+// b. NULL on malformed or unsupported input, e.g. progressive files
+PixelBuffer *jdec_decode_mem(const uint8_t *data, size_t size);
+// the same with the restart intervals of a scan, if it has them, and the
+// colour conversion spread over the workers of `pool`
+PixelBuffer *jdec_decode_mem_mt(xPool *pool, const uint8_t *data, size_t size);
+PixelBuffer *jdec_decode_file(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,868 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "enc.h"
+#include "hdr.h"
+#include "huff.h"
+#include "jpg.h"
+#include "ppm.h"
+#include "prog.h"
+#include "yuv.h"
+
+// the symbols of one component go to a bit writer, are only counted while
+// gathering statistics or are held for the scans of a progressive file
+typedef struct JpgComp {
+    xBitWriter *bw;
+    const xHuffTable *dc, *ac;
+    uint32_t *dc_freq, *ac_freq;
+    xProgComp *coefs;
+    int16_t last_dc;
+} JpgComp;
+
+// what it takes to code MCU rows independently, one per thread: the block
+// encoders, a colour converted strip and the output
+typedef struct JpgCtx {
+    xEncoder *enc[3];
+    JpgComp comp[3];
+    xBitWriter bw;
+    // one MCU row of every component, padded to whole MCUs
+    uint8_t *planes[3];
+    // the statistics of a gathering pass, in the order of
+    // `jpeg.huffman_tbls`
+    uint32_t freq[4][256];
+} JpgCtx;
+
+struct xJpgWriter {
+    struct JPEG jpeg;
+    xJpgOptions opt;
+    size_t w, h;
+    int ncomp;
+    // the headers are out
+    int started;
+    // MCU height in pixels, MCUs per row and MCU rows
+    size_t mcu_h, mx, my;
+    // MCU rows per restart interval, 0 for none
+    size_t band;
+    // rows coded so far
+    size_t rows;
+
+    xHuffTable huff[4];
+    // the optimized tables built from the statistics
+    uint8_t nodes[4][17], vals[4][256];
+
+    // the script and the coefficients of a progressive file
+    const xProgScan *scans;
+    int nscans;
+    xProgComp coefs[3];
+
+    // the serial path codes with `ctx[0]`, worker `i` of a pool with
+    // `ctx[i]`
+    JpgCtx **ctx;
+    int nctx;
+    size_t strides[3];
+    // input rows of an MCU row passed in pieces
+    uint8_t *pending;
+    size_t npending;
+
+    xJpgWrite write;
+    void *payload;
+};
+
+void jpg_quality_tbl(uint8_t *out, const uint8_t *base, int quality)
+{
+    quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+    for (int i = 0; i < 64; i++) {
+        int q = (base[i] * scale + 50) / 100;
+        out[i] = q < 1 ? 1 : q > 255 ? 255 : q;
+    }
+}
+
+static uint8_t *put16(uint8_t *p, unsigned v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+    return p + 2;
+}
+
+static uint8_t *put_app0(uint8_t *p)
+{
+    static const uint8_t jfif[] = {'J', 'F', 'I', 'F', 0, 1, 1, 0,
+                                   0,   1,   0,   1,   0, 0};
+
+    p = put16(p, JPEG_APP0);
+    p = put16(p, 2 + sizeof(jfif));
+    memcpy(p, jfif, sizeof(jfif));
+    return p + sizeof(jfif);
+}
+
+static uint8_t *put_dqt(uint8_t *p, const struct JPEG *jpeg)
+{
+    p = put16(p, JPEG_DQT);
+    p = put16(p, 2 + 65 * jpeg->quantize_tables);
+    for (int t = 0; t < jpeg->quantize_tables; t++) {
+        *p++ = t;
+        for (int i = 0; i < 64; i++)
+            *p++ = jpeg->quantize_tbls[t][jpec_zz[i]];
+    }
+    return p;
+}
+
+static uint8_t *put_dht(uint8_t *p, const struct JPEG *jpeg)
+{
+    uint8_t *len = p + 2;
+
+    p = put16(p, JPEG_DHT) + 2;
+    for (int t = 0; t < jpeg->huffman_tables; t++) {
+        const struct HuffTableSpec *spec = &jpeg->huffman_tbls[t];
+        int n = 0;
+
+        *p++ = spec->cls << 4 | spec->idx;
+        for (int i = 1; i <= 16; i++) {
+            *p++ = spec->nodes[i];
+            n += spec->nodes[i];
+        }
+        memcpy(p, spec->vals, n);
+        p += n;
+    }
+    put16(len, p - len);
+    return p;
+}
+
+static uint8_t *put_frame(uint8_t *p, const struct FrameHeader *frame)
+{
+    p = put16(p, frame->start_marker);
+    p = put16(p, frame->header_len);
+    *p++ = frame->sample_precision;
+    p = put16(p, frame->line_height);
+    p = put16(p, frame->line_width);
+    *p++ = frame->components;
+    for (int i = 0; i < frame->components; i++) {
+        const struct ComponentParam *c = &frame->comp_params[i];
+        *p++ = c->idx;
+        *p++ = c->h_smaple_factor << 4 | c->v_sample_factor;
+        *p++ = c->quantize_table_idx;
+    }
+    return p;
+}
+
+static uint8_t *put_dri(uint8_t *p, const struct JPEG *jpeg)
+{
+    p = put16(p, JPEG_DRI);
+    p = put16(p, 4);
+    return put16(p, jpeg->restart_interval);
+}
+
+static uint8_t *put_scan(uint8_t *p, const struct ScanHeader *scan)
+{
+    p = put16(p, scan->start_marker);
+    p = put16(p, scan->header_len);
+    *p++ = scan->components;
+    for (int i = 0; i < scan->components; i++) {
+        const struct ScanComponentParam *c = &scan->comp_params[i];
+        *p++ = c->idx;
+        *p++ = c->dc_tbl_idx << 4 | c->ac_tbl_idx;
+    }
+    *p++ = scan->start_spectral;
+    *p++ = scan->endof_spectral;
+    *p++ = scan->ah << 4 | scan->al;
+    return p;
+}
+
+// the frame, scan and tables of a baseline file, component 0 is luma and
+// the others share the chroma tables
+static void jpeg_init(struct JPEG *jpeg, size_t w, size_t h, int ncomp,
+                      int quality, size_t restart_interval)
+{
+    struct FrameHeader *frame = &jpeg->frame;
+    struct ScanHeader *scan = &jpeg->scan;
+
+    memset(jpeg, 0, sizeof(*jpeg));
+    frame->start_marker = JPEG_SOF0;
+    frame->header_len = 8 + 3 * ncomp;
+    frame->sample_precision = 8;
+    frame->line_height = h;
+    frame->line_width = w;
+    frame->components = ncomp;
+
+    scan->start_marker = JPEG_SOS;
+    scan->header_len = 6 + 2 * ncomp;
+    scan->components = ncomp;
+    scan->start_spectral = 0;
+    scan->endof_spectral = 63;
+
+    for (int i = 0; i < ncomp; i++) {
+        int chroma = i > 0;
+        int factor = ncomp > 1 && !chroma ? 2 : 1;
+
+        frame->comp_params[i].idx = i + 1;
+        frame->comp_params[i].h_smaple_factor = factor;
+        frame->comp_params[i].v_sample_factor = factor;
+        frame->comp_params[i].quantize_table_idx = chroma;
+        scan->comp_params[i].idx = i + 1;
+        scan->comp_params[i].dc_tbl_idx = chroma;
+        scan->comp_params[i].ac_tbl_idx = chroma;
+    }
+
+    jpeg->quantize_tables = ncomp > 1 ? 2 : 1;
+    jpg_quality_tbl(jpeg->quantize_tbls[0], jpec_qzr, quality);
+    jpg_quality_tbl(jpeg->quantize_tbls[1], jpec_chroma_qzr, quality);
+
+    jpeg->restart_interval = restart_interval;
+    jpeg->huffman_tables = ncomp > 1 ? 4 : 2;
+    jpeg->huffman_tbls[0] = (struct HuffTableSpec){0, 0, jpec_dc_nodes,
+                                                   jpec_dc_vals};
+    jpeg->huffman_tbls[1] = (struct HuffTableSpec){1, 0, jpec_ac_nodes,
+                                                   jpec_ac_vals};
+    jpeg->huffman_tbls[2] = (struct HuffTableSpec){0, 1, jpec_chroma_dc_nodes,
+                                                   jpec_chroma_dc_vals};
+    jpeg->huffman_tbls[3] = (struct HuffTableSpec){1, 1, jpec_chroma_ac_nodes,
+                                                   jpec_chroma_ac_vals};
+}
+
+static void huff_sink(size_t bx, size_t by, int16_t dc, xRLETable tbl,
+                      void *payload)
+{
+    JpgComp *comp = payload;
+
+    if (comp->coefs)
+        prog_store_blk(comp->coefs, bx, by, dc, tbl);
+    else if (comp->dc_freq)
+        huff_count_blk(comp->dc_freq, comp->ac_freq, dc, &comp->last_dc, tbl);
+    else
+        huff_encode_blk(comp->bw, comp->dc, comp->ac, dc, &comp->last_dc,
+                        tbl);
+}
+
+static JpgCtx *ctx_new(xJpgWriter *jw)
+{
+    const struct JPEG *jpeg = &jw->jpeg;
+    JpgCtx *ctx = calloc(1, sizeof(JpgCtx));
+
+    bw_init(&ctx->bw, jw->mx * 64 * jw->ncomp);
+    for (int i = 0; i < jw->ncomp; i++) {
+        const struct ComponentParam *c = &jpeg->frame.comp_params[i];
+        const struct ScanComponentParam *s = &jpeg->scan.comp_params[i];
+        JpgComp *comp = &ctx->comp[i];
+
+        comp->bw = &ctx->bw;
+        comp->dc = &jw->huff[2 * s->dc_tbl_idx];
+        comp->ac = &jw->huff[2 * s->ac_tbl_idx + 1];
+        if (jw->scans)
+            comp->coefs = &jw->coefs[i];
+        if (jw->opt.optimize && !jw->started) {
+            comp->dc_freq = ctx->freq[2 * s->dc_tbl_idx];
+            comp->ac_freq = ctx->freq[2 * s->ac_tbl_idx + 1];
+        }
+        ctx->enc[i] = enc_new(jpeg->quantize_tbls[c->quantize_table_idx],
+                              huff_sink, comp);
+        ctx->planes[i] = malloc(jw->strides[i] * 8 * c->v_sample_factor);
+    }
+    return ctx;
+}
+
+static void ctx_free(JpgCtx *ctx)
+{
+    for (int i = 0; i < 3; i++) {
+        enc_free(ctx->enc[i]);
+        free(ctx->planes[i]);
+    }
+    bw_free(&ctx->bw);
+    free(ctx);
+}
+
+// a context for each of `n` workers
+static void ctx_reserve(xJpgWriter *jw, int n)
+{
+    if (n <= jw->nctx)
+        return;
+    jw->ctx = realloc(jw->ctx, sizeof(JpgCtx *) * n);
+    for (int i = jw->nctx; i < n; i++)
+        jw->ctx[i] = ctx_new(jw);
+    jw->nctx = n;
+}
+
+// hand the whole bytes coded so far to the callback, the pending bits stay
+static int drain(xJpgWriter *jw, xBitWriter *bw)
+{
+    int ret = 0;
+
+    if (bw->size > 0)
+        ret = jw->write(bw->buf, bw->size, jw->payload);
+    bw->size = 0;
+    return ret < 0 ? -1 : 0;
+}
+
+void jpg_writer_free(xJpgWriter *jw)
+{
+    if (jw == NULL)
+        return;
+    for (int i = 0; i < jw->nctx; i++)
+        ctx_free(jw->ctx[i]);
+    for (int i = 0; i < 3; i++)
+        cpl_free(jw->coefs[i].cpl);
+    free(jw->ctx);
+    free(jw->pending);
+    free(jw);
+}
+
+xJpgWriter *jpg_writer_new(size_t w, size_t h, int ncomp,
+                           const xJpgOptions *opt, xJpgWrite write,
+                           void *payload)
+{
+    if (w == 0 || h == 0 || w > 0xFFFF || h > 0xFFFF ||
+        (ncomp != 1 && ncomp != 3))
+        return NULL;
+
+    xJpgWriter *jw = calloc(1, sizeof(xJpgWriter));
+    struct JPEG *jpeg = &jw->jpeg;
+
+    jw->opt = opt ? *opt : JPG_OPTIONS_DEFAULT;
+    jw->w = w;
+    jw->h = h;
+    jw->ncomp = ncomp;
+    jw->mcu_h = ncomp > 1 ? 16 : 8;
+    jw->mx = (w + jw->mcu_h - 1) / jw->mcu_h;
+    jw->my = (h + jw->mcu_h - 1) / jw->mcu_h;
+
+    if (jw->opt.progressive) {
+        jw->scans = jw->opt.scans;
+        jw->nscans = jw->opt.nscans;
+        if (jw->scans == NULL)
+            jw->scans = prog_default_script(ncomp, &jw->nscans);
+        if (prog_check_script(jw->scans, jw->nscans, ncomp) < 0) {
+            free(jw);
+            return NULL;
+        }
+        // every scan gets its own optimized tables anyway, the restart
+        // intervals aren't supported
+        jw->opt.optimize = 0;
+        jw->opt.restart_rows = 0;
+    }
+
+    // the interval is counted in MCUs and has to fit 16 bits
+    jw->band = jw->opt.restart_rows > 0 ? jw->opt.restart_rows : 0;
+    if (jw->band * jw->mx > 0xFFFF)
+        jw->band = 0xFFFF / jw->mx;
+
+    jpeg_init(jpeg, w, h, ncomp, jw->opt.quality, jw->band * jw->mx);
+    for (int i = 0; i < ncomp; i++)
+        jw->strides[i] = jw->mx * 8 * jpeg->frame.comp_params[i].h_smaple_factor;
+
+    if (jw->scans) {
+        const struct FrameHeader *frame = &jpeg->frame;
+        size_t hmax = frame->comp_params[0].h_smaple_factor;
+        size_t vmax = frame->comp_params[0].v_sample_factor;
+
+        jpeg->frame.start_marker = JPEG_SOF2;
+        for (int i = 0; i < ncomp; i++) {
+            const struct ComponentParam *c = &frame->comp_params[i];
+            xProgComp *p = &jw->coefs[i];
+
+            p->hf = c->h_smaple_factor;
+            p->vf = c->v_sample_factor;
+            p->cw = ((w * p->hf + hmax - 1) / hmax + 7) / 8;
+            p->ch = ((h * p->vf + vmax - 1) / vmax + 7) / 8;
+            p->cpl = cpl_calloc(jw->mx * p->hf * 8, jw->my * p->vf * 8);
+        }
+    }
+
+    jw->write = write;
+    jw->payload = payload;
+    jw->pending = malloc(w * ncomp * jw->mcu_h);
+    ctx_reserve(jw, 1);
+    return jw;
+}
+
+// build the optimized tables from the statistics of the first pass, if
+// any, and write the headers
+static int start(xJpgWriter *jw)
+{
+    struct JPEG *jpeg = &jw->jpeg;
+
+    if (jw->opt.optimize) {
+        if (jw->rows != jw->h)
+            return -1;
+        for (int t = 0; t < jpeg->huffman_tables; t++) {
+            uint32_t freq[256] = {0};
+            for (int k = 0; k < jw->nctx; k++)
+                for (int i = 0; i < 256; i++)
+                    freq[i] += jw->ctx[k]->freq[t][i];
+
+            huff_spec_from_freq(jw->nodes[t], jw->vals[t], freq);
+            jpeg->huffman_tbls[t].nodes = jw->nodes[t];
+            jpeg->huffman_tbls[t].vals = jw->vals[t];
+        }
+        for (int k = 0; k < jw->nctx; k++) {
+            for (int i = 0; i < jw->ncomp; i++) {
+                JpgComp *comp = &jw->ctx[k]->comp[i];
+                comp->dc_freq = comp->ac_freq = NULL;
+                comp->last_dc = 0;
+            }
+        }
+        jw->rows = 0;
+    }
+
+    for (int i = 0; i < jpeg->huffman_tables; i++)
+        huff_table_from_spec(&jw->huff[i], jpeg->huffman_tbls[i].nodes,
+                             jpeg->huffman_tbls[i].vals);
+
+    uint8_t hdr[2048], *p = hdr;
+    p = put16(p, JPEG_SOI);
+    p = put_app0(p);
+    p = put_dqt(p, jpeg);
+    p = put_frame(p, &jpeg->frame);
+    // the tables and headers of progressive scans go out with each scan
+    if (jw->scans == NULL) {
+        p = put_dht(p, jpeg);
+        if (jpeg->restart_interval)
+            p = put_dri(p, jpeg);
+        p = put_scan(p, &jpeg->scan);
+    }
+
+    jw->started = 1;
+    return jw->write(hdr, p - hdr, jw->payload) < 0 ? -1 : 0;
+}
+
+// replicate the last column of the `w*h` samples up to `stride` and the last
+// row down to `ph`
+static void pad_plane(uint8_t *plane, size_t stride, size_t w, size_t h,
+                      size_t ph)
+{
+    for (size_t y = 0; y < h; y++)
+        memset(plane + y * stride + w, plane[y * stride + w - 1], stride - w);
+    for (size_t y = h; y < ph; y++)
+        memcpy(plane + y * stride, plane + (h - 1) * stride, stride);
+}
+
+// colour convert and code the `rows` rows of MCU row `my`, 16 or 8 rows
+// but fewer in the last one
+static void code_mcu_row(const xJpgWriter *jw, JpgCtx *ctx,
+                         const uint8_t *src, size_t stride, size_t rows,
+                         size_t my)
+{
+    const struct FrameHeader *frame = &jw->jpeg.frame;
+
+    if (jw->ncomp == 1) {
+        for (size_t y = 0; y < rows; y++)
+            memcpy(ctx->planes[0] + y * jw->strides[0], src + y * stride,
+                   jw->w);
+    } else {
+        rgb24_to_ycbcr420(YCC_JFIF, jw->w, rows, src, stride, ctx->planes[0],
+                          jw->strides[0], ctx->planes[1], ctx->planes[2],
+                          jw->strides[1]);
+    }
+
+    // a component has `ceil(w * H / Hmax)` samples per row, luma has the
+    // largest factors
+    size_t hmax = frame->comp_params[0].h_smaple_factor;
+    size_t vmax = frame->comp_params[0].v_sample_factor;
+    for (int i = 0; i < jw->ncomp; i++) {
+        const struct ComponentParam *c = &frame->comp_params[i];
+        size_t cw = (jw->w * c->h_smaple_factor + hmax - 1) / hmax;
+        size_t ch = (rows * c->v_sample_factor + vmax - 1) / vmax;
+
+        pad_plane(ctx->planes[i], jw->strides[i], cw, ch,
+                  8 * c->v_sample_factor);
+    }
+
+    for (size_t m = 0; m < jw->mx; m++) {
+        for (int i = 0; i < jw->ncomp; i++) {
+            const struct ComponentParam *c = &frame->comp_params[i];
+            size_t hf = c->h_smaple_factor, vf = c->v_sample_factor;
+
+            for (size_t v = 0; v < vf; v++) {
+                for (size_t h = 0; h < hf; h++) {
+                    size_t bx = m * hf + h;
+                    const uint8_t *blk =
+                        ctx->planes[i] + v * 8 * jw->strides[i] + bx * 8;
+                    enc_blk(ctx->enc[i], blk, jw->strides[i], bx, my * vf + v);
+                }
+            }
+        }
+    }
+}
+
+// code an MCU row on the serial path, after the last row of a restart
+// interval the output is padded and the RSTn marker follows
+static int next_mcu_row(xJpgWriter *jw, const uint8_t *src, size_t stride,
+                        size_t rows)
+{
+    JpgCtx *ctx = jw->ctx[0];
+    size_t my = jw->rows / jw->mcu_h;
+
+    code_mcu_row(jw, ctx, src, stride, rows, my);
+    jw->rows += rows;
+
+    if (jw->band && (my + 1) % jw->band == 0 && jw->rows < jw->h) {
+        if (jw->started)
+            bw_marker(&ctx->bw, JPEG_RST0 + my / jw->band % 8);
+        for (int i = 0; i < jw->ncomp; i++)
+            ctx->comp[i].last_dc = 0;
+    }
+    return drain(jw, &ctx->bw);
+}
+
+static int feed_rows(xJpgWriter *jw, const uint8_t *src, size_t stride,
+                     size_t rows)
+{
+    size_t pitch = jw->w * jw->ncomp;
+
+    if (jw->rows + jw->npending + rows > jw->h)
+        return -1;
+
+    while (rows > 0) {
+        // the rows of the current MCU row, fewer at the bottom
+        size_t need = jw->h - jw->rows < jw->mcu_h ? jw->h - jw->rows
+                                                   : jw->mcu_h;
+
+        if (jw->npending == 0 && rows >= need) {
+            if (next_mcu_row(jw, src, stride, need) < 0)
+                return -1;
+            src += need * stride;
+            rows -= need;
+            continue;
+        }
+
+        size_t n = need - jw->npending < rows ? need - jw->npending : rows;
+        for (size_t y = 0; y < n; y++)
+            memcpy(jw->pending + (jw->npending + y) * pitch, src + y * stride,
+                   pitch);
+        jw->npending += n;
+        src += n * stride;
+        rows -= n;
+
+        if (jw->npending == need) {
+            jw->npending = 0;
+            if (next_mcu_row(jw, jw->pending, pitch, need) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+int jpg_writer_gather(xJpgWriter *jw, const uint8_t *src, size_t stride,
+                      size_t rows)
+{
+    if (!jw->opt.optimize || jw->started)
+        return -1;
+    return feed_rows(jw, src, stride, rows);
+}
+
+int jpg_write_rows(xJpgWriter *jw, const uint8_t *src, size_t stride,
+                   size_t rows)
+{
+    if (!jw->started && start(jw) < 0)
+        return -1;
+    return feed_rows(jw, src, stride, rows);
+}
+
+// count the symbols of a progressive scan, then write its tables and header
+// and code it
+static int write_scan(xJpgWriter *jw, const xProgScan *scan)
+{
+    struct JPEG *jpeg = &jw->jpeg;
+    struct ScanHeader *sh = &jpeg->scan;
+    xBitWriter *bw = &jw->ctx[0]->bw;
+    uint32_t freq[2][256] = {{0}}, *dc_freq[3];
+    const xHuffTable *dc[3];
+    // the tables are chosen by component like the sequential ones, DC
+    // refinement scans need none
+    int cls = scan->ss > 0, ntbl = 0;
+
+    for (int i = 0; i < scan->ncomp; i++) {
+        int t = scan->comp[i] > 0;
+        dc_freq[i] = freq[t];
+        dc[i] = &jw->huff[t];
+        sh->comp_params[i].idx = scan->comp[i] + 1;
+        sh->comp_params[i].dc_tbl_idx = cls ? 0 : t;
+        sh->comp_params[i].ac_tbl_idx = cls ? t : 0;
+    }
+    sh->components = scan->ncomp;
+    sh->header_len = 6 + 2 * scan->ncomp;
+    sh->start_spectral = scan->ss;
+    sh->endof_spectral = scan->se;
+    sh->ah = scan->ah;
+    sh->al = scan->al;
+
+    if (cls || scan->ah == 0) {
+        prog_count_scan(scan, jw->coefs, dc_freq, freq[scan->comp[0] > 0]);
+        for (int t = 0; t < 2; t++) {
+            uint32_t total = 0;
+            for (int i = 0; i < 256; i++)
+                total += freq[t][i];
+            if (total == 0)
+                continue;
+
+            huff_spec_from_freq(jw->nodes[t], jw->vals[t], freq[t]);
+            huff_table_from_spec(&jw->huff[t], jw->nodes[t], jw->vals[t]);
+            jpeg->huffman_tbls[ntbl++] =
+                (struct HuffTableSpec){cls, t, jw->nodes[t], jw->vals[t]};
+        }
+    }
+    jpeg->huffman_tables = ntbl;
+
+    uint8_t hdr[1024], *p = hdr;
+    if (ntbl)
+        p = put_dht(p, jpeg);
+    p = put_scan(p, sh);
+    if (jw->write(hdr, p - hdr, jw->payload) < 0)
+        return -1;
+
+    prog_encode_scan(bw, scan, jw->coefs, dc, &jw->huff[scan->comp[0] > 0]);
+    return drain(jw, bw);
+}
+
+int jpg_writer_finish(xJpgWriter *jw)
+{
+    uint8_t eoi[2];
+
+    if (!jw->started || jw->rows != jw->h)
+        return -1;
+
+    for (int s = 0; s < jw->nscans; s++)
+        if (write_scan(jw, &jw->scans[s]) < 0)
+            return -1;
+
+    bw_flush(&jw->ctx[0]->bw);
+    if (drain(jw, &jw->ctx[0]->bw) < 0)
+        return -1;
+    put16(eoi, JPEG_EOI);
+    return jw->write(eoi, 2, jw->payload) < 0 ? -1 : 0;
+}
+
+// restart intervals of a whole image coded in parallel, each into its own
+// bit writer, or only counted when `out` is NULL
+typedef struct JpgJob {
+    xJpgWriter *jw;
+    const uint8_t *src;
+    size_t stride;
+    // the first interval of the batch and one output for each
+    size_t band0;
+    xBitWriter *out;
+} JpgJob;
+
+static void band_task(void *arg, size_t begin, size_t end, int worker)
+{
+    JpgJob *job = arg;
+    xJpgWriter *jw = job->jw;
+    JpgCtx *ctx = jw->ctx[worker];
+
+    for (size_t b = begin; b < end; b++) {
+        size_t my0 = (job->band0 + b) * jw->band;
+        size_t my1 = my0 + jw->band < jw->my ? my0 + jw->band : jw->my;
+
+        for (int i = 0; i < jw->ncomp; i++) {
+            ctx->comp[i].bw = job->out ? &job->out[b] : &ctx->bw;
+            ctx->comp[i].last_dc = 0;
+        }
+        for (size_t my = my0; my < my1; my++) {
+            size_t y = my * jw->mcu_h;
+            size_t rows = jw->h - y < jw->mcu_h ? jw->h - y : jw->mcu_h;
+            code_mcu_row(jw, ctx, job->src + y * job->stride, job->stride,
+                         rows, my);
+        }
+        if (job->out)
+            bw_flush(&job->out[b]);
+    }
+}
+
+// the intervals are coded in batches of a few per worker, then written out
+// in order with the RSTn markers between them
+static int write_bands_mt(xPool *pool, xJpgWriter *jw, const uint8_t *src,
+                          size_t stride)
+{
+    size_t nbands = (jw->my + jw->band - 1) / jw->band;
+    size_t batch = 4 * pool_size(pool);
+    JpgJob job = {jw, src, stride, 0, NULL};
+    int ret = 0;
+
+    ctx_reserve(jw, pool_size(pool));
+    if (jw->opt.optimize) {
+        pool_for(pool, nbands, 1, band_task, &job);
+        jw->rows = jw->h;
+    }
+    if (start(jw) < 0)
+        return -1;
+
+    job.out = malloc(sizeof(xBitWriter) * batch);
+    for (size_t i = 0; i < batch; i++)
+        bw_init(&job.out[i], jw->band * jw->mx * 64);
+
+    for (job.band0 = 0; job.band0 < nbands && ret == 0; job.band0 += batch) {
+        size_t n = nbands - job.band0 < batch ? nbands - job.band0 : batch;
+
+        for (size_t i = 0; i < n; i++)
+            bw_reset(&job.out[i]);
+        pool_for(pool, n, 1, band_task, &job);
+
+        for (size_t i = 0; i < n && ret == 0; i++) {
+            size_t band = job.band0 + i;
+            if (band + 1 < nbands)
+                bw_marker(&job.out[i], JPEG_RST0 + band % 8);
+            ret = drain(jw, &job.out[i]);
+        }
+    }
+
+    for (size_t i = 0; i < batch; i++)
+        bw_free(&job.out[i]);
+    free(job.out);
+    jw->rows = jw->h;
+    return ret;
+}
+
+int jpg_write_pxb_mt(xPool *pool, const PixelBuffer *pxb,
+                     const xJpgOptions *opt, xJpgWrite write, void *payload)
+{
+    if (pxb->fmt != FMT_RGB24 && pxb->fmt != FMT_GRAY8)
+        return -1;
+
+    // luma alone is a single component frame, no colour conversion
+    int ncomp = pxb->fmt == FMT_GRAY8 ? 1 : 3;
+    xJpgWriter *jw =
+        jpg_writer_new(pxb->w, pxb->h, ncomp, opt, write, payload);
+    if (jw == NULL)
+        return -1;
+
+    const uint8_t *src = pxb->plane[0];
+    size_t stride = pxb->stride[0];
+    int ret = 0;
+
+    if (pool_size(pool) > 1 && jw->band) {
+        ret = write_bands_mt(pool, jw, src, stride);
+    } else {
+        if (jw->opt.optimize)
+            ret = jpg_writer_gather(jw, src, stride, pxb->h);
+        if (ret == 0)
+            ret = jpg_write_rows(jw, src, stride, pxb->h);
+    }
+    if (ret == 0)
+        ret = jpg_writer_finish(jw);
+    jpg_writer_free(jw);
+    return ret;
+}
+
+int jpg_write_pxb(const PixelBuffer *pxb, const xJpgOptions *opt,
+                  xJpgWrite write, void *payload)
+{
+    return jpg_write_pxb_mt(NULL, pxb, opt, write, payload);
+}
+
+static int file_write(const uint8_t *data, size_t size, void *payload)
+{
+    return fwrite(data, 1, size, payload) == size ? 0 : -1;
+}
+
+int jpg_write_file(const PixelBuffer *pxb, const xJpgOptions *opt,
+                   const char *name)
+{
+    FILE *f = fopen(name, "wb");
+    if (f == NULL)
+        return -1;
+
+    int ret = jpg_write_pxb(pxb, opt, file_write, f);
+    if (fclose(f) != 0)
+        ret = -1;
+    return ret;
+}
+
+// a strip is an MCU row of the colour or grayscale writer
+static int write_strips(xJpgWriter *jw, xPpmReader *r, uint8_t *strip,
+                        int (*fn)(xJpgWriter *, const uint8_t *, size_t,
+                                  size_t))
+{
+    size_t stride = fmt_get_row_size(r->fmt, 0, r->w);
+
+    while (r->rows < r->h) {
+        long n = ppm_reader_read(r, strip, stride, jw->mcu_h);
+        if (n <= 0 || fn(jw, strip, stride, n) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int jpg_write_ppm(const char *ppm, const xJpgOptions *opt, xJpgWrite write,
+                  void *payload)
+{
+    xPpmReader *r = ppm_reader_open(ppm);
+    if (r == NULL)
+        return -1;
+
+    int ncomp = r->fmt == FMT_GRAY8 ? 1 : 3;
+    xJpgWriter *jw = jpg_writer_new(r->w, r->h, ncomp, opt, write, payload);
+    if (jw == NULL) {
+        ppm_reader_close(r);
+        return -1;
+    }
+
+    uint8_t *strip = malloc(fmt_get_row_size(r->fmt, 0, r->w) * jw->mcu_h);
+    int ret = 0;
+    // the statistics of an optimized file take a first read of the file
+    if (jw->opt.optimize) {
+        ret = write_strips(jw, r, strip, jpg_writer_gather);
+        if (ret == 0)
+            ret = ppm_reader_rewind(r);
+    }
+    if (ret == 0)
+        ret = write_strips(jw, r, strip, jpg_write_rows);
+    if (ret == 0)
+        ret = jpg_writer_finish(jw);
+
+    free(strip);
+    jpg_writer_free(jw);
+    ppm_reader_close(r);
+    return ret;
+}
+
+int jpg_write_ppm_file(const char *ppm, const xJpgOptions *opt,
+                       const char *name)
+{
+    FILE *f = fopen(name, "wb");
+    if (f == NULL)
+        return -1;
+
+    int ret = jpg_write_ppm(ppm, opt, file_write, f);
+    if (fclose(f) != 0)
+        ret = -1;
+    return ret;
+}
+
+typedef struct MemSink {
+    uint8_t *buf;
+    size_t size, cap;
+} MemSink;
+
+static int mem_write(const uint8_t *data, size_t size, void *payload)
+{
+    MemSink *mem = payload;
+
+    if (mem->size + size > mem->cap) {
+        size_t cap = mem->cap ? mem->cap : 4096;
+        while (mem->size + size > cap)
+            cap *= 2;
+        uint8_t *buf = realloc(mem->buf, cap);
+        if (buf == NULL)
+            return -1;
+        mem->buf = buf;
+        mem->cap = cap;
+    }
+    memcpy(mem->buf + mem->size, data, size);
+    mem->size += size;
+    return 0;
+}
+
+int jpg_write_mem(const PixelBuffer *pxb, const xJpgOptions *opt,
+                  uint8_t **out, size_t *size)
+{
+    MemSink mem = {0};
+
+    if (jpg_write_pxb(pxb, opt, mem_write, &mem) < 0) {
+        free(mem.buf);
+        return -1;
+    }
+    *out = mem.buf;
+    *size = mem.size;
+    return 0;
+}
@@ -0,0 +1,94 @@
+#ifndef _JPG_H_
+#define _JPG_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pool.h"
+#include "prog.h"
+#include "pxb.h"
+
+// receives the encoded file in order, a negative return aborts the encoding
+typedef int (*xJpgWrite)(const uint8_t *data, size_t size, void *payload);
+
+typedef struct xJpgOptions {
+    // 1..100, scales the Annex K quantization tables
+    int quality;
+    // code with Huffman tables built for the image instead of the Annex K
+    // ones, which takes a first pass over the image to gather statistics
+    int optimize;
+    // MCU rows per restart interval, 0 for none. the intervals are coded
+    // independently, which lets `jpg_write_pxb_mt` and the decoder split the
+    // entropy coding across threads at a cost of a few bytes per interval
+    int restart_rows;
+    // a progressive (SOF2) file coded in the `nscans` scans of `scans`, or
+    // libjpeg's default script when NULL. the quantized coefficients of the
+    // whole image are held until `jpg_writer_finish` writes the scans, each
+    // with its own optimized tables, so `optimize` and `restart_rows` don't
+    // apply
+    int progressive;
+    const xProgScan *scans;
+    int nscans;
+} xJpgOptions;
+
+// quality 75 with the standard tables, sequential without restart markers
+#define JPG_OPTIONS_DEFAULT ((xJpgOptions){75, 0, 0, 0, NULL, 0})
+
+// baseline sequential JFIF writer. the rows are colour converted and coded
+// one MCU row at a time and every finished row goes out through the write
+// callback, so neither the planes nor the bitstream are held in memory
+typedef struct xJpgWriter xJpgWriter;
+
+// scale a quantization table for `quality` 1..100 the way libjpeg does
+void jpg_quality_tbl(uint8_t *out, const uint8_t *base, int quality);
+
+// a `w*h` image of `ncomp` channels, 1 for grayscale or 3 for rgb which is
+// coded as YCbCr 4:2:0. `opt` may be NULL for the defaults
+xJpgWriter *jpg_writer_new(size_t w, size_t h, int ncomp,
+                           const xJpgOptions *opt, xJpgWrite write,
+                           void *payload);
+void jpg_writer_free(xJpgWriter *jw);
+// the first pass of an optimized writer: gather the symbol statistics of
+// every row, in as many calls as `jpg_write_rows` takes. nothing is written
+int jpg_writer_gather(xJpgWriter *jw, const uint8_t *src, size_t stride,
+                      size_t rows);
+// code the next `rows` rows of `stride` bytes at `src`, any row count works
+// but whole MCU rows (16 for rgb, 8 for grayscale) are coded without a copy.
+// the headers go out with the first rows, an optimized writer fails unless
+// the whole image was gathered. a progressive writer only keeps the
+// coefficients
+int jpg_write_rows(xJpgWriter *jw, const uint8_t *src, size_t stride,
+                   size_t rows);
+// write the end of the stream, or all the scans of a progressive one. fails
+// when rows are missing
+int jpg_writer_finish(xJpgWriter *jw);
+
+// a whole FMT_RGB24 or FMT_GRAY8 buffer through the write callback, both
+// passes of an optimized writer run over it
+int jpg_write_pxb(const PixelBuffer *pxb, const xJpgOptions *opt,
+                  xJpgWrite write, void *payload);
+// the same with the restart intervals coded on the workers of `pool`, the
+// output is identical. serial without restart markers or with a NULL pool
+int jpg_write_pxb_mt(xPool *pool, const PixelBuffer *pxb,
+                     const xJpgOptions *opt, xJpgWrite write, void *payload);
+int jpg_write_file(const PixelBuffer *pxb, const xJpgOptions *opt,
+                   const char *name);
+// a P6 or P5 file, or its ASCII P3 or P2, streamed through the writer an MCU
+// row at a time, rgb or grayscale as the file is. the memory taken grows
+// with the width alone, a progressive file holds the coefficients of the
+// whole image though. an optimized writer reads the file twice
+int jpg_write_ppm(const char *ppm, const xJpgOptions *opt, xJpgWrite write,
+                  void *payload);
+int jpg_write_ppm_file(const char *ppm, const xJpgOptions *opt,
+                       const char *name);
+// `*out` is malloc'ed and owned by the caller
+int jpg_write_mem(const PixelBuffer *pxb, const xJpgOptions *opt,
+                  uint8_t **out, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
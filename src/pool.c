@@ -0,0 +1,234 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blk.h"
+#include "pool.h"
+
+// the chunks `[lo, hi)` still to run, padded so neighbours don't share a
+// cache line
+typedef struct Deque {
+    pthread_mutex_t lock;
+    size_t lo, hi;
+} __attribute__((aligned(64))) Deque;
+
+typedef struct Worker {
+    xPool *pool;
+    int id;
+    void *scratch;
+    size_t scratch_size;
+} __attribute__((aligned(64))) Worker;
+
+struct xPool {
+    int nthreads;
+    pthread_t *threads;
+    Worker *workers;
+    Deque *deques;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    // bumped for every job, workers sleep until it changes
+    unsigned long gen;
+    int running;
+    int quit;
+
+    // the current job
+    xTaskFn fn;
+    void *arg;
+    size_t n, grain;
+};
+
+static int pop_front(Deque *dq, size_t *chunk)
+{
+    int ok = 0;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->lo < dq->hi) {
+        *chunk = dq->lo++;
+        ok = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return ok;
+}
+
+// move the back half of a victim's chunks to `id`'s own deque and take the
+// first of them
+static int steal(xPool *pool, int id, size_t *chunk)
+{
+    for (int i = 1; i < pool->nthreads; i++) {
+        Deque *victim = &pool->deques[(id + i) % pool->nthreads];
+        size_t lo, hi;
+
+        pthread_mutex_lock(&victim->lock);
+        hi = victim->hi;
+        lo = hi - (victim->hi - victim->lo) / 2;
+        if (victim->lo < victim->hi && lo == hi)
+            lo--;
+        victim->hi = lo;
+        pthread_mutex_unlock(&victim->lock);
+
+        if (lo == hi)
+            continue;
+
+        Deque *own = &pool->deques[id];
+        pthread_mutex_lock(&own->lock);
+        own->lo = lo + 1;
+        own->hi = hi;
+        pthread_mutex_unlock(&own->lock);
+
+        *chunk = lo;
+        return 1;
+    }
+    return 0;
+}
+
+static void run_job(xPool *pool, int id)
+{
+    size_t chunk;
+
+    while (pop_front(&pool->deques[id], &chunk) || steal(pool, id, &chunk)) {
+        size_t begin = chunk * pool->grain;
+        size_t end = begin + pool->grain < pool->n ? begin + pool->grain
+                                                   : pool->n;
+        pool->fn(pool->arg, begin, end, id);
+    }
+}
+
+static void *worker_main(void *_worker)
+{
+    Worker *worker = _worker;
+    xPool *pool = worker->pool;
+    unsigned long gen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->gen == gen && !pool->quit)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->quit) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        gen = pool->gen;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_job(pool, worker->id);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+xPool *pool_new(int nthreads)
+{
+    if (nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0)
+        nthreads = 1;
+
+    xPool *pool = calloc(1, sizeof(xPool));
+    pool->nthreads = nthreads;
+    pool->threads = calloc(nthreads, sizeof(pthread_t));
+    pool->workers = aligned_alloc(64, sizeof(Worker) * nthreads);
+    pool->deques = aligned_alloc(64, sizeof(Deque) * nthreads);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int i = 0; i < nthreads; i++) {
+        pool->workers[i] = (Worker){pool, i, NULL, 0};
+        pool->deques[i].lo = pool->deques[i].hi = 0;
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+    }
+
+    // worker 0 is whoever calls `pool_for`
+    for (int i = 1; i < nthreads; i++)
+        pthread_create(&pool->threads[i], NULL, worker_main,
+                       &pool->workers[i]);
+
+    return pool;
+}
+
+void pool_free(xPool *pool)
+{
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    for (int i = 0; i < pool->nthreads; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->workers[i].scratch);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+
+    free(pool->deques);
+    free(pool->workers);
+    free(pool->threads);
+    free(pool);
+}
+
+int pool_size(const xPool *pool) { return pool ? pool->nthreads : 1; }
+
+void pool_for(xPool *pool, size_t n, size_t grain, xTaskFn fn, void *arg)
+{
+    if (n == 0)
+        return;
+    if (grain == 0)
+        grain = 1;
+
+    size_t nchunks = (n + grain - 1) / grain;
+    if (pool == NULL || pool->nthreads == 1 || nchunks == 1) {
+        fn(arg, 0, n, 0);
+        return;
+    }
+
+    // contiguous shares to start with, so neighbouring chunks usually run
+    // on the same worker
+    int nthreads = pool->nthreads;
+    for (int i = 0; i < nthreads; i++) {
+        pool->deques[i].lo = nchunks * i / nthreads;
+        pool->deques[i].hi = nchunks * (i + 1) / nthreads;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->n = n;
+    pool->grain = grain;
+    pool->running = nthreads - 1;
+    pool->gen++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_job(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void *pool_scratch(xPool *pool, int worker, size_t size)
+{
+    Worker *w = &pool->workers[worker];
+
+    if (w->scratch_size < size) {
+        size = (size + BLK_ALIGN - 1) / BLK_ALIGN * BLK_ALIGN;
+        free(w->scratch);
+        w->scratch = aligned_alloc(BLK_ALIGN, size);
+        w->scratch_size = size;
+    }
+    return w->scratch;
+}
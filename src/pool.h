@@ -0,0 +1,33 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stddef.h>
+
+// a fixed set of worker threads running data-parallel loops. every worker
+// owns a deque of chunks, takes from its front and, once empty, steals half
+// of what is left at the back of another worker's deque
+typedef struct xPool xPool;
+
+// runs items `[begin, end)` on worker `worker` in `[0, pool_size)`
+typedef void (*xTaskFn)(void *arg, size_t begin, size_t end, int worker);
+
+// `nthreads` workers including the calling thread, 0 for one per online cpu
+xPool *pool_new(int nthreads);
+void pool_free(xPool *pool);
+// 1 for a NULL pool
+int pool_size(const xPool *pool);
+// run `fn` over `[0, n)` in chunks of `grain` items and wait for all of
+// them, the calling thread works as worker 0. not reentrant, `fn` must not
+// call `pool_for` on the same pool
+void pool_for(xPool *pool, size_t n, size_t grain, xTaskFn fn, void *arg);
+// a `BLK_ALIGN` aligned scratch buffer of at least `size` bytes private to
+// `worker`, kept until the pool is freed
+void *pool_scratch(xPool *pool, int worker, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,8 +1,18 @@
-#include <assert.h>
+#include <ctype.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#if !defined(NO_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#define PPM_X86
+#include <immintrin.h>
+#endif
+
+#include "cpu.h"
 #include "ppm.h"
 
 static int ppm_fmt_pix_bits_tbl[] = {
@@ -52,42 +62,347 @@ void ppm_dump_header(const PPM *ppm)
     printf("data:  [%d]\n", ppm->data ? ppm->height * ppm->pitch : -1);
 }
 
+// the samples of an ASCII (P2, P3) payload, parsed a chunk of the file at a
+// time: a number or a comment may go on into the next chunk
+struct xPpmAscii {
+    // what's left of the current chunk
+    const uint8_t *p, *end;
+    // no chunk follows, a number at the end of this one is whole
+    int eof;
+    unsigned maxval;
+    // 2 bytes per sample, big-endian as in a binary payload
+    int wide;
+    // the number or comment cut by the end of the last chunk
+    unsigned val;
+    int digits, comment;
+    // a sample past `maxval` or a byte that doesn't belong
+    int error;
+};
+
+// the reads of a file's text
+#define PPM_CHUNK 65536
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PPM_SWAR
+#endif
+
+static inline int is_blank(uint8_t c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+#ifdef PPM_SWAR
+#define SWAR_LOW 0x0101010101010101ull
+#define SWAR_HIGH 0x8080808080808080ull
+
+// the high bit of every byte of `x` that is `c` < 0x80 or more, borrows
+// can't cross bytes
+static inline uint64_t swar_ge(uint64_t x, uint8_t c)
+{
+    return (((x | SWAR_HIGH) - c * SWAR_LOW) | x) & SWAR_HIGH;
+}
+
+// the high bit of every byte that isn't an ascii digit, or is a blank
+static inline uint64_t swar_nondigits(uint64_t x)
+{
+    return swar_ge(x ^ 0x30 * SWAR_LOW, 10);
+}
+
+static inline uint64_t swar_blanks(uint64_t x)
+{
+    uint64_t space = ~swar_ge(x ^ ' ' * SWAR_LOW, 1) & SWAR_HIGH;
+    return (swar_ge(x, '\t') & ~swar_ge(x, '\r' + 1)) | space;
+}
+
+// the high bits of the bytes of `x` as the 8 bits of a byte
+static inline unsigned swar_bits(uint64_t x)
+{
+    return ((x >> 7) * 0x0102040810204080ull) >> 56;
+}
+
+// the value of the `len` < 8 digits at the start of `x`: shifted up past
+// zeros, then pairs, quads and octets of digits are combined in parallel
+static inline unsigned swar_value(uint64_t x, int len)
+{
+    x = (x & 0x0F0F0F0F0F0F0F0Full) << (64 - 8 * len);
+    x = (x * 10 + (x >> 8)) & 0x00FF00FF00FF00FFull;
+    x = (x * 100 + (x >> 16)) & 0x0000FFFF0000FFFFull;
+    return (x * 10000 + (x >> 32)) & 0xFFFFFFFF;
+}
+
+// the same for `len` <= 4 digits, e.g. any sample of 8 bits
+static inline unsigned swar_value4(uint64_t x, int len)
+{
+    uint32_t y = ((uint32_t)x & 0x0F0F0F0F) << (32 - 8 * len);
+    y = (y * 10 + (y >> 8)) & 0x00FF00FF;
+    return (y * 100 + (y >> 16)) & 0xFFFF;
+}
+
+// the 64 bytes at `p` as a bit each: the digits, and what's neither a digit
+// nor a blank
+static void classify_swar(const uint8_t *p, uint64_t *digits, uint64_t *other)
+{
+    uint64_t d = 0, o = 0;
+
+    for (int i = 0; i < 8; i++) {
+        uint64_t x, nd;
+        memcpy(&x, p + i * 8, 8);
+        nd = swar_nondigits(x);
+        d |= (uint64_t)swar_bits(~nd & SWAR_HIGH) << (i * 8);
+        o |= (uint64_t)swar_bits(nd & ~swar_blanks(x)) << (i * 8);
+    }
+    *digits = d;
+    *other = o;
+}
+
+#ifdef PPM_X86
+// 16 bytes at a time, a byte is in a range when subtracting its start leaves
+// it unsigned no more than the range's length
+static void classify_sse2(const uint8_t *p, uint64_t *digits, uint64_t *other)
+{
+    uint64_t d = 0, o = 0;
+
+    for (int i = 0; i < 4; i++) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(p + i * 16));
+        __m128i t = _mm_sub_epi8(x, _mm_set1_epi8('0'));
+        __m128i u = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+        __m128i dig = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(9)), t);
+        __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(u, _mm_set1_epi8(4)), u);
+        __m128i sp = _mm_cmpeq_epi8(x, _mm_set1_epi8(' '));
+        __m128i known = _mm_or_si128(dig, _mm_or_si128(ctl, sp));
+
+        d |= (uint64_t)_mm_movemask_epi8(dig) << (i * 16);
+        o |= (uint64_t)(~_mm_movemask_epi8(known) & 0xFFFF) << (i * 16);
+    }
+    *digits = d;
+    *other = o;
+}
+#endif
+
+static void (*classify)(const uint8_t *, uint64_t *, uint64_t *);
+
+static void ppm_dispatch(void)
+{
+    if (classify)
+        return;
+
+    classify = classify_swar;
+#ifdef PPM_X86
+    if (cpu_get_features() & CPU_SSE2)
+        classify = classify_sse2;
+#endif
+}
+#endif
+
+static inline uint8_t *put_sample(int wide, uint8_t *out, unsigned v)
+{
+    if (wide)
+        *out++ = v >> 8;
+    *out++ = v;
+    return out;
+}
+
+#ifdef PPM_SWAR
+// the numbers of the current chunk 64 bytes at a time: the bytes are told
+// apart into bit masks first, with SSE2 when the cpu has it, so the numbers
+// found in them can be read in parallel, an 8-byte load each. a comment, a
+// byte that doesn't belong, a number of 8 digits or more or past `maxval` is
+// left to `ascii_parse` and so is the end of the chunk. kept in locals: the
+// stores to `out` could alias the parser's fields
+static size_t ascii_swar(xPpmAscii *a, uint8_t *out, size_t n)
+{
+    const uint8_t *p = a->p, *end = a->end;
+    // past the last number read, it may go on into the next block
+    const uint8_t *next = p;
+    unsigned maxval = a->maxval;
+    int wide = a->wide;
+    uint64_t carry = 0;
+    size_t k = 0;
+
+    ppm_dispatch();
+    // the load of a number starting in the block may go 8 bytes past it
+    while (end - p >= 64 + 8) {
+        uint64_t digits, other;
+        classify(p, &digits, &other);
+
+        // the numbers starting in the block before anything else
+        uint64_t starts = digits & ~(digits << 1 | carry);
+        if (other)
+            starts &= (other & -other) - 1;
+        for (; starts; starts &= starts - 1) {
+            int i = __builtin_ctzll(starts);
+            const uint8_t *q = p + i;
+            uint64_t x;
+            memcpy(&x, q, 8);
+            // the digits up to the end of the block, the load tells the
+            // length of a longer number or one going on into the next
+            int len = __builtin_ctzll(~(digits >> i) | 1ull << 63);
+            unsigned v;
+            if (len <= 4 && i + len < 64) {
+                v = swar_value4(x, len);
+            } else {
+                uint64_t nd = swar_nondigits(x);
+                if (nd == 0) {
+                    next = q;
+                    goto stop;
+                }
+                len = __builtin_ctzll(nd) / 8;
+                v = swar_value(x, len);
+            }
+            if (v > maxval) {
+                next = q;
+                goto stop;
+            }
+            out = put_sample(wide, out, v);
+            next = q + len;
+            // nothing reads on after the last sample, what ends it is
+            // checked here as the byte loop would
+            if (++k == n) {
+                a->error = !is_blank(*next) && *next != '#';
+                goto stop;
+            }
+        }
+        if (other) {
+            p += __builtin_ctzll(other);
+            break;
+        }
+        carry = digits >> 63;
+        p += 64;
+    }
+    // the block's blanks up to where it stopped are skipped
+    if (p > next)
+        next = p;
+
+stop:
+    a->p = next;
+    return k;
+}
+#endif
+
+// up to `n` samples to `out` from the current chunk, fewer when it runs out
+// first. runs of plain numbers go to `ascii_swar`, the rest is read a byte
+// at a time
+static size_t ascii_parse(xPpmAscii *a, uint8_t *out, size_t n)
+{
+    size_t k = 0;
+
+    while (k < n && !a->error) {
+#ifdef PPM_SWAR
+        if (a->digits == 0 && !a->comment) {
+            size_t m = ascii_swar(a, out, n - k);
+            out += m * (a->wide ? 2 : 1);
+            k += m;
+            if (k == n)
+                break;
+        }
+#endif
+        if (a->p == a->end) {
+            if (a->eof && a->digits) {
+                out = put_sample(a->wide, out, a->val);
+                k++;
+                a->val = a->digits = 0;
+            }
+            break;
+        }
+
+        uint8_t c = *a->p++;
+        if (a->comment) {
+            a->comment = c != '\n';
+        } else if (c >= '0' && c <= '9') {
+            a->val = a->val * 10 + c - '0';
+            a->digits++;
+            a->error = a->val > a->maxval;
+        } else {
+            if (a->digits) {
+                out = put_sample(a->wide, out, a->val);
+                k++;
+                a->val = a->digits = 0;
+            }
+            if (c == '#')
+                a->comment = 1;
+            else if (!is_blank(c))
+                a->error = 1;
+        }
+    }
+    return k;
+}
+
+// `n` samples to `out` from the text of `f`, the chunks read to `buf`
+static int ascii_read(xPpmAscii *a, FILE *f, uint8_t *buf, uint8_t *out,
+                      size_t n)
+{
+    while (n > 0) {
+        size_t k = ascii_parse(a, out, n);
+
+        out += k * (a->wide ? 2 : 1);
+        n -= k;
+        if (a->error || (n > 0 && a->eof))
+            return -1;
+        if (n > 0) {
+            size_t len = fread(buf, 1, PPM_CHUNK, f);
+            a->p = buf;
+            a->end = buf + len;
+            a->eof = len < PPM_CHUNK;
+        }
+    }
+    return 0;
+}
+
+static int is_ascii(char magic) { return magic == '2' || magic == '3'; }
+
+// the next header field after whitespace and comments
+static int header_int(FILE *f, int *v)
+{
+    int c;
+
+    while ((c = fgetc(f)) != EOF) {
+        if (c == '#') {
+            while ((c = fgetc(f)) != EOF && c != '\n')
+                ;
+        } else if (!is_blank(c)) {
+            break;
+        }
+    }
+    if (c == EOF || ungetc(c, f) == EOF)
+        return -1;
+    return fscanf(f, "%d", v) == 1 ? 0 : -1;
+}
+
 // read header from file, data is not touched
 // return negative value if error occurs
 int ppm_read_header(FILE *f, PPM *ppm)
 {
-    char ch;
-    int nread;
+    int ch;
 
-    nread = fread(ppm->magic, 1, 2, f);
-    assert(nread == 2);
-
-    if (ppm->magic[0] != 'P' || (ppm->magic[1] < '1' && ppm->magic[1] > '6')) {
+    if (fread(ppm->magic, 1, 2, f) != 2)
         return -1;
-    }
 
-    nread = fread(&ch, 1, 1, f);
-    assert(nread == 1);
-    if (ch != '\n') {
+    if (ppm->magic[0] != 'P' || ppm->magic[1] < '1' || ppm->magic[1] > '6') {
         return -1;
     }
 
-    int n = fscanf(f, "%d%d", &ppm->width, &ppm->height);
-    assert(n == 2);
+    if (!is_blank(fgetc(f)) || header_int(f, &ppm->width) < 0 ||
+        header_int(f, &ppm->height) < 0 || ppm->width <= 0 ||
+        ppm->height <= 0)
+        return -1;
 
     if (ppm->magic[1] != '1' && ppm->magic[1] != '4') {
-        n = fscanf(f, "%d", &ppm->colors);
-        assert(n == 1);
+        if (header_int(f, &ppm->colors) < 0)
+            return -1;
     }
 
     if (ppm->colors <= 0 || ppm->colors > 65535) {
         return -1;
     }
 
-    nread = fread(&ch, 1, 1, f);
-    assert(ch == '\n' && nread == 1);
+    // a single whitespace before the pixels
+    ch = fgetc(f);
+    if (!is_blank(ch))
+        return -1;
 
-    ppm->pitch = (ppm->colors > 255 ? 2 : 1) * 3 * ppm->width;
+    // a graymap has a sample per pixel, a pixmap three
+    int samples = ppm->magic[1] == '2' || ppm->magic[1] == '5' ? 1 : 3;
+    ppm->pitch = (ppm->colors > 255 ? 2 : 1) * samples * ppm->width;
 
     return 0;
 }
@@ -96,7 +411,7 @@ int ppm_read_header(FILE *f, PPM *ppm)
 // must be called after ppm_read_header cause of file cursor
 int ppm_read_data(FILE *f, PPM *ppm)
 {
-    int nsize = ppm->height * ppm->pitch;
+    size_t nsize = (size_t)ppm->height * ppm->pitch;
 
     ppm->data = malloc(nsize);
     if (ppm->data == NULL) {
@@ -104,10 +419,22 @@ int ppm_read_data(FILE *f, PPM *ppm)
         return -1;
     }
 
-    int nread = fread(ppm->data, 1, nsize, f);
-    assert(nread == nsize);
+    // the text of P2 and P3 to the samples a binary file would have
+    if (is_ascii(ppm->magic[1])) {
+        xPpmAscii a = {.maxval = ppm->colors, .wide = ppm->colors > 255};
+        uint8_t *buf = malloc(PPM_CHUNK);
+        if (buf == NULL)
+            return -1;
+        int bps = a.wide ? 2 : 1, ret = ascii_read(&a, f, buf, ppm->data,
+                                                   nsize / bps);
+        free(buf);
+        return ret;
+    }
 
-    return nread;
+    if (fread(ppm->data, 1, nsize, f) != nsize)
+        return -1;
+
+    return 0;
 }
 
 PPM *ppm_read_file(const char *name)
@@ -131,6 +458,7 @@ PPM *ppm_read_file(const char *name)
     if (ret < 0)
         goto FAIL;
     ppm_dump_header(ppm);
+    fclose(fp);
 
     return ppm;
 
@@ -154,10 +482,246 @@ int ppm_write_file(PPM *ppm, const char *name)
     if (ppm->magic[1] != '1' && ppm->magic[1] != '4') {
         fprintf(fp, "%d\n", ppm->colors);
     }
+    if (is_ascii(ppm->magic[1])) {
+        // the samples in lines of at most 70 characters
+        int bps = ppm->colors > 255 ? 2 : 1, col = 0;
+        size_t n = (size_t)ppm->pitch * ppm->height / bps;
+
+        for (size_t i = 0; i < n && ret >= 0; i++) {
+            const uint8_t *v = ppm->data + i * bps;
+            unsigned val = bps == 2 ? v[0] << 8 | v[1] : v[0];
+            char num[8];
+            int len = snprintf(num, sizeof(num), "%u", val);
+
+            if (col > 0 && col + 1 + len > 70) {
+                ret = fputc('\n', fp) == EOF ? -1 : 0;
+                col = 0;
+            } else if (col > 0) {
+                ret = fputc(' ', fp) == EOF ? -1 : 0;
+                col++;
+            }
+            ret = fwrite(num, 1, len, fp) == len ? ret : -1;
+            col += len;
+        }
+        if (ret >= 0 && fputc('\n', fp) == EOF)
+            ret = -1;
+        if (fclose(fp) != 0)
+            ret = -1;
+        return ret < 0 ? -1 : 0;
+    }
+
     ret = fwrite(ppm->data, sizeof(uint8_t), ppm->pitch * ppm->height, fp);
-    assert(ret == ppm->pitch * ppm->height);
 
-    fflush(fp);
     fclose(fp);
+    return ret == ppm->pitch * ppm->height ? 0 : -1;
+}
+
+// the next header number after whitespace and comments, -1 if there's none
+// or it's past 65535 * 65535
+static long header_num(const uint8_t *p, size_t len, size_t *pos)
+{
+    size_t i = *pos;
+    long n = 0;
+
+    while (i < len && (isspace(p[i]) || p[i] == '#')) {
+        if (p[i] == '#')
+            while (i < len && p[i] != '\n')
+                i++;
+        else
+            i++;
+    }
+    if (i == len || !isdigit(p[i]))
+        return -1;
+    for (; i < len && isdigit(p[i]); i++) {
+        n = n * 10 + p[i] - '0';
+        if (n > 65535L * 65535)
+            return -1;
+    }
+    *pos = i;
+    return n;
+}
+
+typedef struct PpmMap {
+    void *addr;
+    size_t len;
+} PpmMap;
+
+static void ppm_unmap(void *opaque)
+{
+    PpmMap *map = opaque;
+
+    munmap(map->addr, map->len);
+    free(map);
+}
+
+// the header of a P6 or P5 file, or their ASCII P3 or P2, with 8-bit
+// samples at the start of the `len` bytes at `p`. `*pos` is where the pixels
+// start and `*maxval` their maximum. -1 if it isn't one, or the pixels of a
+// binary file don't all fit `len` when `whole`
+static int parse_header(const uint8_t *p, size_t len, int whole,
+                        PixelFormat *fmt, size_t *w, size_t *h,
+                        unsigned *max, size_t *pos)
+{
+    long width = -1, height = -1, maxval = -1;
+    size_t i = 2;
+
+    if (len > 2 && p[0] == 'P' && p[1] >= '2' && p[1] <= '6' && p[1] != '4') {
+        *fmt = p[1] == '5' || p[1] == '2' ? FMT_GRAY8 : FMT_RGB24;
+        width = header_num(p, len, &i);
+        height = header_num(p, len, &i);
+        maxval = header_num(p, len, &i);
+    }
+
+    // a single whitespace ends the header, 16-bit samples aren't supported
+    if (width <= 0 || height <= 0 || maxval <= 0 || maxval > 255 ||
+        i == len || !isspace(p[i]))
+        return -1;
+    i++;
+    if (whole && !is_ascii(p[1]) &&
+        (len - i) / fmt_get_row_size(*fmt, 0, width) < height)
+        return -1;
+
+    *w = width;
+    *h = height;
+    *max = maxval;
+    *pos = i;
     return 0;
 }
+
+PixelBuffer *ppm_map_file(const char *name)
+{
+    int fd = open(name, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    uint8_t *p = MAP_FAILED;
+    size_t len = 0;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        len = st.st_size;
+        // private, so writing to the pixels copies the pages they're on
+        // instead of changing the file
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    // the mapping holds on to the file by itself
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    PixelFormat fmt;
+    size_t w, h, pos;
+    unsigned maxval;
+    if (parse_header(p, len, 1, &fmt, &w, &h, &maxval, &pos) < 0) {
+        munmap(p, len);
+        return NULL;
+    }
+
+    // the payload is read once front to back, the kernel can read ahead and
+    // drop the pages behind
+    madvise(p, len, MADV_SEQUENTIAL);
+
+    // text is parsed to a buffer of its own, the mapping goes right after
+    if (is_ascii(p[1])) {
+        xPpmAscii a = {.p = p + pos, .end = p + len, .eof = 1,
+                       .maxval = maxval};
+        PixelBuffer *pxb = pxb_new(fmt, w, h, NULL);
+        size_t row = fmt_get_row_size(fmt, 0, w);
+
+        for (size_t y = 0; y < h && pxb; y++) {
+            // the byte ending the last sample may be the one that's wrong
+            if (ascii_parse(&a, pxb->plane[0] + y * pxb->stride[0], row) <
+                    row ||
+                a.error) {
+                pxb_free(pxb);
+                pxb = NULL;
+            }
+        }
+        munmap(p, len);
+        return pxb;
+    }
+
+    PpmMap *map = malloc(sizeof(PpmMap));
+    map->addr = p;
+    map->len = len;
+    return pxb_wrap(fmt, w, h, (uint8_t *[]){p + pos},
+                    (size_t[]){fmt_get_row_size(fmt, 0, w)}, ppm_unmap, map);
+}
+
+// headers longer than this, i.e. with long comments, aren't read
+#define PPM_MAX_HEADER 4096
+
+xPpmReader *ppm_reader_open(const char *name)
+{
+    FILE *f = fopen(name, "rb");
+    if (f == NULL)
+        return NULL;
+
+    uint8_t hdr[PPM_MAX_HEADER];
+    size_t len = fread(hdr, 1, sizeof(hdr), f);
+    xPpmReader *r = calloc(1, sizeof(xPpmReader));
+    unsigned maxval;
+    size_t pos;
+
+    r->f = f;
+    if (parse_header(hdr, len, 0, &r->fmt, &r->w, &r->h, &maxval, &pos) <
+            0 ||
+        fseek(f, pos, SEEK_SET) < 0) {
+        ppm_reader_close(r);
+        return NULL;
+    }
+    r->offset = pos;
+    if (is_ascii(hdr[1])) {
+        r->ascii = calloc(1, sizeof(xPpmAscii));
+        r->chunk = malloc(PPM_CHUNK);
+        if (r->ascii == NULL || r->chunk == NULL) {
+            ppm_reader_close(r);
+            return NULL;
+        }
+        r->ascii->maxval = maxval;
+    }
+    // read ahead of the strips, the file is only read front to back
+    posix_fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL);
+    return r;
+}
+
+void ppm_reader_close(xPpmReader *r)
+{
+    if (r == NULL)
+        return;
+    fclose(r->f);
+    free(r->ascii);
+    free(r->chunk);
+    free(r);
+}
+
+long ppm_reader_read(xPpmReader *r, uint8_t *dst, size_t stride, size_t rows)
+{
+    size_t row = fmt_get_row_size(r->fmt, 0, r->w);
+
+    if (rows > r->h - r->rows)
+        rows = r->h - r->rows;
+    if (r->ascii) {
+        for (size_t y = 0; y < rows; y++)
+            if (ascii_read(r->ascii, r->f, r->chunk, dst + y * stride, row) <
+                0)
+                return -1;
+    } else if (stride == row) {
+        // packed rows are read in one go
+        if (fread(dst, row, rows, r->f) != rows)
+            return -1;
+    } else {
+        for (size_t y = 0; y < rows; y++)
+            if (fread(dst + y * stride, 1, row, r->f) != row)
+                return -1;
+    }
+    r->rows += rows;
+    return rows;
+}
+
+int ppm_reader_rewind(xPpmReader *r)
+{
+    r->rows = 0;
+    if (r->ascii)
+        *r->ascii = (xPpmAscii){.maxval = r->ascii->maxval};
+    return fseek(r->f, r->offset, SEEK_SET);
+}
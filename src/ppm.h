@@ -7,6 +7,8 @@ extern "C" {
 #include <stdint.h>
 #include <stdio.h>
 
+#include "pxb.h"
+
 /*
 P6
 # comment
@@ -15,7 +17,7 @@ P6
 0x00 0x00 0x00
 */
 
-// P1-P3 not test yet
+// P2, P3, P5 and P6 are read, the bitmaps P1 and P4 aren't
 typedef enum PPM_FMT {
     PPM_FMT_P1 = 1, // bitmap ASCII
     PPM_FMT_P2,     // graymap ASCII
@@ -46,6 +48,39 @@ int ppm_read_header(FILE *f, PPM *ppm);
 int ppm_read_data(FILE *f, PPM *ppm);
 PPM *ppm_read_file(const char *name);
 int ppm_write_file(PPM *ppm, const char *name);
+// a binary P6 or P5 file with 8-bit samples as a FMT_RGB24 or FMT_GRAY8
+// buffer over its memory mapped pixels, the rows packed as in the file. it
+// is unmapped with the last view of it, and writes don't reach the file.
+// their ASCII P3 and P2 are parsed to a buffer of its own. NULL if it can't
+// be mapped or isn't one
+PixelBuffer *ppm_map_file(const char *name);
+
+// the state of the text parser of an ASCII payload
+typedef struct xPpmAscii xPpmAscii;
+
+// the same files read a strip of rows at a time, for images too large to
+// hold. the memory taken is the caller's strip
+typedef struct xPpmReader {
+    FILE *f;
+    PixelFormat fmt;
+    size_t w, h;
+    // rows read so far
+    size_t rows;
+    // where the pixels start
+    long offset;
+    // the parser and the chunk of text of an ASCII file, NULL for binary
+    xPpmAscii *ascii;
+    uint8_t *chunk;
+} xPpmReader;
+
+// NULL if the file can't be read or isn't one
+xPpmReader *ppm_reader_open(const char *name);
+void ppm_reader_close(xPpmReader *r);
+// read the next `rows` rows, fewer at the end, to `dst` rows `stride` bytes
+// apart. the rows read, or negative on a read error
+long ppm_reader_read(xPpmReader *r, uint8_t *dst, size_t stride, size_t rows);
+// back to the first row, for a second pass
+int ppm_reader_rewind(xPpmReader *r);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,307 @@
+#include <string.h>
+
+#include "prog.h"
+
+// clang-format off
+static const xProgScan script_ycc[] = {
+    {3, {0, 1, 2}, 0, 0, 0, 1},
+    {1, {0}, 1, 5, 0, 2},
+    {1, {2}, 1, 63, 0, 1},
+    {1, {1}, 1, 63, 0, 1},
+    {1, {0}, 6, 63, 0, 2},
+    {1, {0}, 1, 63, 2, 1},
+    {3, {0, 1, 2}, 0, 0, 1, 0},
+    {1, {2}, 1, 63, 1, 0},
+    {1, {1}, 1, 63, 1, 0},
+    {1, {0}, 1, 63, 1, 0},
+};
+
+static const xProgScan script_gray[] = {
+    {1, {0}, 0, 0, 0, 1},
+    {1, {0}, 1, 5, 0, 2},
+    {1, {0}, 6, 63, 0, 2},
+    {1, {0}, 1, 63, 2, 1},
+    {1, {0}, 0, 0, 1, 0},
+    {1, {0}, 1, 63, 1, 0},
+};
+// clang-format on
+
+// the correction bits of a refinement scan wait for the next symbol, they
+// are forced out with the EOB run before the buffer could overflow
+#define MAX_CORR_BITS 1000
+
+// the state of a scan being coded, or only counted when `bw` is NULL
+typedef struct ProgCoder {
+    xBitWriter *bw;
+    const xHuffTable *dc[3], *ac;
+    uint32_t *dc_freq[3], *ac_freq;
+    int ss, se, ah, al;
+    int16_t last_dc[3];
+    // blocks ending in zeros since the last symbol, and their correction
+    // bits
+    unsigned eobrun;
+    uint8_t be[MAX_CORR_BITS];
+    size_t nbe;
+} ProgCoder;
+
+const xProgScan *prog_default_script(int ncomp, int *nscans)
+{
+    if (ncomp == 1) {
+        *nscans = sizeof(script_gray) / sizeof(script_gray[0]);
+        return script_gray;
+    }
+    *nscans = sizeof(script_ycc) / sizeof(script_ycc[0]);
+    return script_ycc;
+}
+
+int prog_check_script(const xProgScan *scans, int nscans, int ncomp)
+{
+    // the lowest bit coded so far of every coefficient, -1 for none
+    int8_t done[3][64];
+
+    memset(done, -1, sizeof(done));
+    for (int s = 0; s < nscans; s++) {
+        const xProgScan *scan = &scans[s];
+
+        if (scan->ncomp < 1 || scan->ncomp > ncomp || scan->ss < 0 ||
+            scan->ss > scan->se || scan->se > 63 ||
+            (scan->ss == 0) != (scan->se == 0) ||
+            (scan->ss > 0 && scan->ncomp > 1) || scan->al < 0 ||
+            scan->al > 13 || (scan->ah && scan->ah != scan->al + 1))
+            return -1;
+
+        for (int i = 0; i < scan->ncomp; i++) {
+            int c = scan->comp[i];
+
+            if (c < 0 || c >= ncomp || (i > 0 && c <= scan->comp[i - 1]))
+                return -1;
+            // AC bits only follow the DC ones
+            if (scan->ss > 0 && done[c][0] < 0)
+                return -1;
+            for (int k = scan->ss; k <= scan->se; k++) {
+                if (done[c][k] != (scan->ah ? scan->ah : -1))
+                    return -1;
+                done[c][k] = scan->al;
+            }
+        }
+    }
+    return 0;
+}
+
+void prog_store_blk(xProgComp *comp, size_t bx, size_t by, int16_t dc,
+                    xRLETable tbl)
+{
+    int16_t *blk = cpl_get_blk(comp->cpl, bx, by);
+    size_t n = rtb_get_size(tbl), k = 1;
+
+    memset(blk, 0, sizeof(int16_t) * 64);
+    blk[0] = dc;
+    for (size_t i = 0; i < n; i++) {
+        if (tbl[i].rs.nbits == 0) {
+            // ZRL, or EOB
+            if (tbl[i].rs.zeros != 15)
+                break;
+            k += 16;
+            continue;
+        }
+        k += tbl[i].rs.zeros;
+        blk[jpec_zz[k++]] = tbl[i].amp;
+    }
+}
+
+// the magnitude category, i.e. the bit length of `|n|`
+static inline int category(int n)
+{
+    int m = n < 0 ? -n : n;
+    return m == 0 ? 0 : 32 - __builtin_clz(m);
+}
+
+static inline void emit_sym(ProgCoder *pc, const xHuffTable *t,
+                            uint32_t *freq, int sym, int amp, int nbits)
+{
+    if (pc->bw)
+        huff_encode_sym(pc->bw, t, sym, amp, nbits);
+    else
+        freq[sym]++;
+}
+
+static void emit_corr_bits(ProgCoder *pc, const uint8_t *bits, size_t n)
+{
+    if (pc->bw)
+        for (size_t i = 0; i < n; i++)
+            huff_encode_bits(pc->bw, 1, bits[i]);
+}
+
+// the pending EOB run as EOBn with its low bits, then the correction bits
+// of its blocks
+static void emit_eobrun(ProgCoder *pc)
+{
+    if (pc->eobrun == 0)
+        return;
+
+    int nbits = category(pc->eobrun) - 1;
+    emit_sym(pc, pc->ac, pc->ac_freq, nbits << 4, pc->eobrun, nbits);
+    pc->eobrun = 0;
+    emit_corr_bits(pc, pc->be, pc->nbe);
+    pc->nbe = 0;
+}
+
+static void dc_first(ProgCoder *pc, int i, const int16_t *blk)
+{
+    int v = blk[0] >> pc->al, diff = v - pc->last_dc[i];
+    int nbits = category(diff);
+
+    pc->last_dc[i] = v;
+    emit_sym(pc, pc->dc[i], pc->dc_freq[i], nbits, diff, nbits);
+}
+
+static void dc_refine(ProgCoder *pc, int i, const int16_t *blk)
+{
+    if (pc->bw)
+        huff_encode_bits(pc->bw, 1, (blk[0] >> pc->al) & 1);
+}
+
+static void ac_first(ProgCoder *pc, int i, const int16_t *blk)
+{
+    int r = 0;
+
+    for (int k = pc->ss; k <= pc->se; k++) {
+        int c = blk[jpec_zz[k]];
+        int v = c < 0 ? -(-c >> pc->al) : c >> pc->al;
+
+        if (v == 0) {
+            r++;
+            continue;
+        }
+        emit_eobrun(pc);
+        for (; r > 15; r -= 16)
+            emit_sym(pc, pc->ac, pc->ac_freq, 0xF0, 0, 0);
+
+        int nbits = category(v);
+        emit_sym(pc, pc->ac, pc->ac_freq, r << 4 | nbits, v, nbits);
+        r = 0;
+    }
+
+    if (r > 0 && ++pc->eobrun == 0x7FFF)
+        emit_eobrun(pc);
+}
+
+// G.1.2.3: coefficients that were already nonzero only get a correction
+// bit, newly nonzero ones are coded as `(run, 1)` and their sign. the
+// correction bits of skipped coefficients go out after the next symbol
+static void ac_refine(ProgCoder *pc, int i, const int16_t *blk)
+{
+    int mag[64], eob = 0, r = 0;
+    // this block's correction bits follow the pending ones until a symbol
+    // takes them
+    size_t br0 = pc->nbe, br = 0;
+
+    for (int k = pc->ss; k <= pc->se; k++) {
+        int c = blk[jpec_zz[k]] < 0 ? -blk[jpec_zz[k]] : blk[jpec_zz[k]];
+        mag[k] = c >> pc->al;
+        if (mag[k] == 1)
+            eob = k;
+    }
+
+    for (int k = pc->ss; k <= pc->se; k++) {
+        if (mag[k] == 0) {
+            r++;
+            continue;
+        }
+        // a run past the last newly nonzero coefficient goes into the EOB
+        while (r > 15 && k <= eob) {
+            emit_eobrun(pc);
+            emit_sym(pc, pc->ac, pc->ac_freq, 0xF0, 0, 0);
+            r -= 16;
+            emit_corr_bits(pc, pc->be + br0, br);
+            br0 = br = 0;
+        }
+        if (mag[k] > 1) {
+            pc->be[br0 + br++] = mag[k] & 1;
+            continue;
+        }
+
+        emit_eobrun(pc);
+        emit_sym(pc, pc->ac, pc->ac_freq, r << 4 | 1,
+                 blk[jpec_zz[k]] < 0 ? -1 : 1, 1);
+        emit_corr_bits(pc, pc->be + br0, br);
+        br0 = br = 0;
+        r = 0;
+    }
+
+    if (r > 0 || br > 0) {
+        pc->eobrun++;
+        pc->nbe += br;
+        if (pc->eobrun == 0x7FFF || pc->nbe > MAX_CORR_BITS - 64 + 1)
+            emit_eobrun(pc);
+    }
+}
+
+static void code_scan(ProgCoder *pc, const xProgScan *scan,
+                      const xProgComp *comps)
+{
+    void (*code_blk)(ProgCoder *, int, const int16_t *);
+
+    pc->ss = scan->ss;
+    pc->se = scan->se;
+    pc->ah = scan->ah;
+    pc->al = scan->al;
+    if (scan->ss == 0)
+        code_blk = scan->ah ? dc_refine : dc_first;
+    else
+        code_blk = scan->ah ? ac_refine : ac_first;
+
+    if (scan->ncomp == 1) {
+        // not interleaved, the blocks of the component alone in raster order
+        const xProgComp *c = &comps[scan->comp[0]];
+
+        for (size_t by = 0; by < c->ch; by++)
+            for (size_t bx = 0; bx < c->cw; bx++)
+                code_blk(pc, 0, cpl_get_blk(c->cpl, bx, by));
+    } else {
+        const xProgComp *c0 = &comps[scan->comp[0]];
+        size_t mx = c0->cpl->bw / c0->hf, my = c0->cpl->bh / c0->vf;
+
+        for (size_t y = 0; y < my; y++) {
+            for (size_t x = 0; x < mx; x++) {
+                for (int i = 0; i < scan->ncomp; i++) {
+                    const xProgComp *c = &comps[scan->comp[i]];
+
+                    for (int v = 0; v < c->vf; v++) {
+                        for (int h = 0; h < c->hf; h++) {
+                            size_t bx = x * c->hf + h, by = y * c->vf + v;
+                            code_blk(pc, i, cpl_get_blk(c->cpl, bx, by));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    emit_eobrun(pc);
+}
+
+void prog_count_scan(const xProgScan *scan, const xProgComp *comps,
+                     uint32_t *dc_freq[3], uint32_t *ac_freq)
+{
+    ProgCoder pc = {0};
+
+    for (int i = 0; i < 3; i++)
+        pc.dc_freq[i] = dc_freq[i];
+    pc.ac_freq = ac_freq;
+    code_scan(&pc, scan, comps);
+}
+
+void prog_encode_scan(xBitWriter *bw, const xProgScan *scan,
+                      const xProgComp *comps, const xHuffTable *dc[3],
+                      const xHuffTable *ac)
+{
+    ProgCoder pc = {0};
+
+    pc.bw = bw;
+    for (int i = 0; i < 3; i++)
+        pc.dc[i] = dc[i];
+    pc.ac = ac;
+    code_scan(&pc, scan, comps);
+    bw_flush(bw);
+}
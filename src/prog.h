@@ -0,0 +1,58 @@
+#ifndef _PROG_H_
+#define _PROG_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stddef.h>
+#include <stdint.h>
+
+#include "coef.h"
+#include "huff.h"
+#include "rle.h"
+
+// a scan of a progressive script (JPEG Annex G): the components `comp[0]`
+// .. `comp[ncomp - 1]`, 0 being luma, the spectral band `[ss, se]` in
+// zigzag order and the successive approximation bit positions. a DC scan
+// (`ss == se == 0`) may interleave components, an AC scan has one
+typedef struct xProgScan {
+    int ncomp;
+    int comp[3];
+    int ss, se, ah, al;
+} xProgScan;
+
+// a component of a progressive image, its quantized coefficients are held
+// for all the scans
+typedef struct xProgComp {
+    // covers whole MCUs, of which the component has `cw*ch` blocks
+    xCoefPlane *cpl;
+    size_t cw, ch;
+    // the sampling factors
+    int hf, vf;
+} xProgComp;
+
+// the `jpeg_simple_progression` script of libjpeg for 1 or 3 components,
+// spectral selection and 2 bits of successive approximation
+const xProgScan *prog_default_script(int ncomp, int *nscans);
+// 0 if every scan is well formed and codes bits no earlier scan did, in an
+// order a decoder can follow (G.1.1.1)
+int prog_check_script(const xProgScan *scans, int nscans, int ncomp);
+
+// store the symbols of block `(bx, by)` as the `xEncSink` gets them
+void prog_store_blk(xProgComp *comp, size_t bx, size_t by, int16_t dc,
+                    xRLETable tbl);
+
+// gather the symbols of `scan` over `comps`, indexed by component, into
+// the DC frequencies of each scan component or the AC ones
+void prog_count_scan(const xProgScan *scan, const xProgComp *comps,
+                     uint32_t *dc_freq[3], uint32_t *ac_freq);
+// code `scan` through the DC tables of each scan component or the AC
+// table. the bits are flushed at the end
+void prog_encode_scan(xBitWriter *bw, const xProgScan *scan,
+                      const xProgComp *comps, const xHuffTable *dc[3],
+                      const xHuffTable *ac);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,82 +1,849 @@
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if !defined(NO_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#define PXB_X86
+#include "swizzle.h"
+#endif
+
+#include "cpu.h"
 #include "pxb.h"
 
-size_t fmt_get_size(PixelFormat fmt, size_t w, size_t h)
-{
+// where a channel's samples are: their plane and byte offset in a sample
+typedef struct ChanPos {
+    Channel chan;
+    int plane, offset;
+} ChanPos;
+
+// the planes of a format, each with its bytes per sample and the log2 of
+// its subsampling across and down
+typedef struct FmtLayout {
+    int nplanes;
+    int bpp[PXB_MAX_PLANES];
+    int sx[PXB_MAX_PLANES], sy[PXB_MAX_PLANES];
+    int nchans;
+    ChanPos chans[4];
+} FmtLayout;
+
+#define YUV_PLANAR(SX, SY)                                                     \
+    {3, {1, 1, 1}, {0, SX, SX}, {0, SY, SY}, 3,                                \
+     {{CHAN_Y, 0, 0}, {CHAN_U, 1, 0}, {CHAN_V, 2, 0}}}
 
+static const FmtLayout layout_yuv420 = YUV_PLANAR(1, 1);
+static const FmtLayout layout_yuv422p = YUV_PLANAR(1, 0);
+static const FmtLayout layout_yuv444p = YUV_PLANAR(0, 0);
+static const FmtLayout layout_gray8 = {1, {1}, {0}, {0}, 1, {{CHAN_Y, 0, 0}}};
+static const FmtLayout layout_nv12 = {
+    2, {1, 2}, {0, 1}, {0, 1}, 3,
+    {{CHAN_Y, 0, 0}, {CHAN_U, 1, 0}, {CHAN_V, 1, 1}}};
+static const FmtLayout layout_rgb24 = {
+    1, {3}, {0}, {0}, 3, {{CHAN_R, 0, 0}, {CHAN_G, 0, 1}, {CHAN_B, 0, 2}}};
+static const FmtLayout layout_rgba32 = {
+    1, {4}, {0}, {0}, 4,
+    {{CHAN_R, 0, 0}, {CHAN_G, 0, 1}, {CHAN_B, 0, 2}, {CHAN_A, 0, 3}}};
+static const FmtLayout layout_bgra32 = {
+    1, {4}, {0}, {0}, 4,
+    {{CHAN_B, 0, 0}, {CHAN_G, 0, 1}, {CHAN_R, 0, 2}, {CHAN_A, 0, 3}}};
+
+static const FmtLayout *fmt_layout(PixelFormat fmt)
+{
     switch (fmt) {
     case FMT_YUV420:
-        return w * h * 3 / 2;
+        return &layout_yuv420;
     case FMT_RGB24:
-        return w * h * 3;
+        return &layout_rgb24;
+    case FMT_GRAY8:
+        return &layout_gray8;
+    case FMT_YUV422P:
+        return &layout_yuv422p;
+    case FMT_YUV444P:
+        return &layout_yuv444p;
+    case FMT_NV12:
+        return &layout_nv12;
+    case FMT_RGBA32:
+        return &layout_rgba32;
+    case FMT_BGRA32:
+        return &layout_bgra32;
     default:
-        return w * h * 3 / 2;
+        return &layout_yuv420;
     }
 }
 
-size_t fmt_get_pitch(PixelFormat fmt, size_t w, size_t h)
+static size_t align_up(size_t n) { return (n + PXB_ALIGN - 1) & -PXB_ALIGN; }
+
+int fmt_get_planes(PixelFormat fmt) { return fmt_layout(fmt)->nplanes; }
+
+int fmt_get_bpp(PixelFormat fmt, int i) { return fmt_layout(fmt)->bpp[i]; }
+
+size_t fmt_get_row_size(PixelFormat fmt, int i, size_t w)
 {
-    switch (fmt) {
-    case FMT_YUV420:
-        return w;
-    case FMT_RGB24:
-        return w * 3;
-    default:
-        return w;
+    const FmtLayout *l = fmt_layout(fmt);
+    return ((w + (1 << l->sx[i]) - 1) >> l->sx[i]) * l->bpp[i];
+}
+
+size_t fmt_get_rows(PixelFormat fmt, int i, size_t h)
+{
+    const FmtLayout *l = fmt_layout(fmt);
+    return (h + (1 << l->sy[i]) - 1) >> l->sy[i];
+}
+
+size_t fmt_get_pitch(PixelFormat fmt, int i, size_t w)
+{
+    return align_up(fmt_get_row_size(fmt, i, w));
+}
+
+size_t fmt_get_size(PixelFormat fmt, size_t w, size_t h)
+{
+    size_t size = 0;
+
+    for (int i = 0; i < fmt_get_planes(fmt); i++)
+        size += fmt_get_row_size(fmt, i, w) * fmt_get_rows(fmt, i, h);
+    return size;
+}
+
+struct xPxbStore {
+    int refs;
+    // the owner of wrapped planes, NULL when they follow the header
+    void (*release)(void *);
+    void *opaque;
+};
+
+// the header is padded so the planes that follow it stay aligned
+static xPxbStore *store_new(size_t size)
+{
+    xPxbStore *store = aligned_alloc(PXB_ALIGN, align_up(sizeof(xPxbStore)) +
+                                                    align_up(size));
+    store->refs = 1;
+    store->release = NULL;
+    return store;
+}
+
+static uint8_t *store_data(xPxbStore *store)
+{
+    return (uint8_t *)store + align_up(sizeof(xPxbStore));
+}
+
+static void store_unref(xPxbStore *store)
+{
+    if (__atomic_sub_fetch(&store->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    if (store->release)
+        store->release(store->opaque);
+    free(store);
+}
+
+static PixelBuffer *pxb_alloc(PixelFormat fmt, size_t w, size_t h)
+{
+    size_t offset[PXB_MAX_PLANES], size = 0;
+    int nplanes = fmt_get_planes(fmt);
+
+    for (int i = 0; i < nplanes; i++) {
+        offset[i] = size;
+        size += fmt_get_pitch(fmt, i, w) * fmt_get_rows(fmt, i, h);
     }
+
+    PixelBuffer *pxb = malloc(sizeof(PixelBuffer));
+    pxb->fmt = fmt;
+    pxb->w = w;
+    pxb->h = h;
+    pxb->size = size;
+    pxb->store = store_new(size);
+    pxb->buf = store_data(pxb->store);
+    pxb->nplanes = nplanes;
+    for (int i = 0; i < PXB_MAX_PLANES; i++) {
+        pxb->plane[i] = i < nplanes ? pxb->buf + offset[i] : NULL;
+        pxb->stride[i] = i < nplanes ? fmt_get_pitch(fmt, i, w) : 0;
+    }
+
+    for (int i = 0; i < nplanes; i++) {
+        size_t row = fmt_get_row_size(fmt, i, w), pad = pxb->stride[i] - row;
+
+        if (pad == 0)
+            continue;
+        for (size_t y = 0; y < fmt_get_rows(fmt, i, h); y++)
+            memset(pxb->plane[i] + y * pxb->stride[i] + row, 0, pad);
+    }
+    return pxb;
 }
 
 PixelBuffer *pxb_new(PixelFormat fmt, size_t w, size_t h, const uint8_t *buf)
 {
-    size_t size = fmt_get_size(fmt, w, h);
-    PixelBuffer *pxb = malloc(sizeof(PixelBuffer) + size);
+    if (buf == NULL)
+        return pxb_alloc(fmt, w, h);
+
+    const uint8_t *planes[PXB_MAX_PLANES];
+    size_t strides[PXB_MAX_PLANES];
+    for (int i = 0; i < fmt_get_planes(fmt); i++) {
+        planes[i] = buf;
+        strides[i] = fmt_get_row_size(fmt, i, w);
+        buf += strides[i] * fmt_get_rows(fmt, i, h);
+    }
+    return pxb_import(fmt, w, h, planes, strides);
+}
+
+PixelBuffer *pxb_import(PixelFormat fmt, size_t w, size_t h,
+                        const uint8_t *const planes[],
+                        const size_t strides[])
+{
+    PixelBuffer *pxb = pxb_alloc(fmt, w, h);
+
+    for (int i = 0; i < pxb->nplanes; i++) {
+        size_t row = fmt_get_row_size(fmt, i, w);
+
+        for (size_t y = 0; y < fmt_get_rows(fmt, i, h); y++)
+            memcpy(pxb->plane[i] + y * pxb->stride[i],
+                   planes[i] + y * strides[i], row);
+    }
+    return pxb;
+}
+
+PixelBuffer *pxb_wrap(PixelFormat fmt, size_t w, size_t h,
+                      uint8_t *const planes[], const size_t strides[],
+                      void (*release)(void *), void *opaque)
+{
+    PixelBuffer *pxb = malloc(sizeof(PixelBuffer));
+    xPxbStore *store = malloc(sizeof(xPxbStore));
+    uint8_t *end = NULL;
+
+    store->refs = 1;
+    store->release = release;
+    store->opaque = opaque;
+
     pxb->fmt = fmt;
     pxb->w = w;
     pxb->h = h;
-    pxb->size = size;
+    pxb->store = store;
+    pxb->buf = NULL;
+    pxb->nplanes = fmt_get_planes(fmt);
+    // `buf` and `size` span the planes from the first byte of the lowest to
+    // the last row of the highest
+    for (int i = 0; i < PXB_MAX_PLANES; i++) {
+        pxb->plane[i] = i < pxb->nplanes ? planes[i] : NULL;
+        pxb->stride[i] = i < pxb->nplanes ? strides[i] : 0;
+        if (i >= pxb->nplanes)
+            continue;
 
-    if (buf) {
-        memcpy(pxb->buf, buf, size);
+        size_t rows = fmt_get_rows(fmt, i, h);
+        uint8_t *last = planes[i] + (rows - 1) * strides[i] +
+                        fmt_get_row_size(fmt, i, w);
+        if (pxb->buf == NULL || planes[i] < pxb->buf)
+            pxb->buf = planes[i];
+        if (last > end)
+            end = last;
     }
+    pxb->size = end - pxb->buf;
     return pxb;
 }
 
-void pxb_free(PixelBuffer *pxb) { free(pxb); }
+void pxb_free(PixelBuffer *pxb)
+{
+    if (pxb == NULL)
+        return;
+    store_unref(pxb->store);
+    free(pxb);
+}
 
 PixelBuffer *pxb_copy(const PixelBuffer *src, int mask)
 {
-    PixelBuffer *pxb = malloc(sizeof(PixelBuffer) + src->size);
-    memcpy(pxb, src, sizeof(PixelBuffer) + src->size);
+    PixelBuffer *pxb = pxb_import(src->fmt, src->w, src->h,
+                                  (const uint8_t *const *)src->plane,
+                                  src->stride);
 
-    pxb_remove_channels(pxb, mask ^ pxb->fmt);
+    pxb_remove_channels(pxb, ~mask & FMT_CHANNELS(pxb->fmt));
     return pxb;
 }
 
+PixelBuffer *pxb_view(const PixelBuffer *pxb)
+{
+    PixelBuffer *view = malloc(sizeof(PixelBuffer));
+
+    *view = *pxb;
+    __atomic_add_fetch(&pxb->store->refs, 1, __ATOMIC_RELAXED);
+    return view;
+}
+
+PixelBuffer *pxb_plane_view(const PixelBuffer *pxb, int i)
+{
+    if (i < 0 || i >= pxb->nplanes)
+        return NULL;
+    if (pxb->nplanes == 1)
+        return pxb_view(pxb);
+    if (fmt_get_bpp(pxb->fmt, i) != 1)
+        return NULL;
+
+    PixelBuffer *view = pxb_view(pxb);
+    view->fmt = FMT_GRAY8;
+    view->w = fmt_get_row_size(pxb->fmt, i, pxb->w);
+    view->h = fmt_get_rows(pxb->fmt, i, pxb->h);
+    view->nplanes = 1;
+    view->plane[0] = pxb->plane[i];
+    view->stride[0] = pxb->stride[i];
+    for (int k = 1; k < PXB_MAX_PLANES; k++) {
+        view->plane[k] = NULL;
+        view->stride[k] = 0;
+    }
+    return view;
+}
+
+PixelBuffer *pxb_crop(const PixelBuffer *pxb, size_t x, size_t y, size_t w,
+                      size_t h)
+{
+    const FmtLayout *l = fmt_layout(pxb->fmt);
+
+    if (x > pxb->w || w > pxb->w - x || y > pxb->h || h > pxb->h - y)
+        return NULL;
+    for (int i = 0; i < l->nplanes; i++)
+        if (x & ((1 << l->sx[i]) - 1) || y & ((1 << l->sy[i]) - 1))
+            return NULL;
+
+    PixelBuffer *view = pxb_view(pxb);
+    view->w = w;
+    view->h = h;
+    for (int i = 0; i < l->nplanes; i++)
+        view->plane[i] += (y >> l->sy[i]) * view->stride[i] +
+                          (x >> l->sx[i]) * l->bpp[i];
+    return view;
+}
+
+int pxb_is_shared(const PixelBuffer *pxb)
+{
+    return __atomic_load_n(&pxb->store->refs, __ATOMIC_ACQUIRE) > 1;
+}
+
+void pxb_make_writable(PixelBuffer *pxb)
+{
+    if (!pxb_is_shared(pxb))
+        return;
+
+    PixelBuffer *own = pxb_copy(pxb, FMT_CHANNELS(pxb->fmt));
+    xPxbStore *shared = pxb->store;
+
+    *pxb = *own;
+    free(own);
+    store_unref(shared);
+}
+
 void pxb_remove_channels(PixelBuffer *pxb, int mask)
 {
-    switch (pxb->fmt) {
-    case FMT_YUV420:
-        if (mask & CHAN_Y)
-            memset(pxb->buf + pxb->size * 0 / 6, 128, pxb->size * 4 / 6);
-        if (mask & CHAN_U)
-            memset(pxb->buf + pxb->size * 4 / 6, 128, pxb->size * 1 / 6);
-        if (mask & CHAN_V)
-            memset(pxb->buf + pxb->size * 5 / 6, 128, pxb->size * 1 / 6);
-        break;
-    case FMT_RGB24:
-        // TODO: simd? endian?
-        for (int i = 0; i < pxb->size / 3; i++) {
-            if (mask & CHAN_R)
-                memset(pxb->buf + i * 3 + 0, 0, 1);
-            if (mask & CHAN_G)
-                memset(pxb->buf + i * 3 + 1, 0, 1);
-            if (mask & CHAN_B)
-                memset(pxb->buf + i * 3 + 2, 0, 1);
+    const FmtLayout *l = fmt_layout(pxb->fmt);
+
+    for (int c = 0; c < l->nchans; c++) {
+        const ChanPos *pos = &l->chans[c];
+        if (!(mask & pos->chan))
+            continue;
+
+        int i = pos->plane, bpp = l->bpp[i];
+        uint8_t fill = pos->chan & (CHAN_Y | CHAN_U | CHAN_V) ? 128
+                       : pos->chan == CHAN_A                  ? 255
+                                                              : 0;
+        size_t row = fmt_get_row_size(pxb->fmt, i, pxb->w);
+        size_t rows = fmt_get_rows(pxb->fmt, i, pxb->h);
+
+        uint8_t keep[4] = {0xFF, 0xFF, 0xFF, 0xFF}, set[4] = {0};
+        keep[pos->offset] = 0;
+        set[pos->offset] = fill;
+
+        for (size_t y = 0; y < rows; y++) {
+            uint8_t *p = pxb->plane[i] + y * pxb->stride[i];
+
+            if (bpp == 1)
+                memset(p, fill, row);
+            else
+                pxb_mask_row(p, row / bpp, bpp, keep, set);
+        }
+    }
+}
+
+// the row kernels, byte `i` of a masked row has the masks of its offset in a
+// sample, which repeat every 48 bytes for any sample size up to 4
+static void mask_scalar(uint8_t *p, size_t i, size_t len, int bpp,
+                        const uint8_t *keep, const uint8_t *set)
+{
+    for (; i < len; i++)
+        p[i] = (p[i] & keep[i % bpp]) | set[i % bpp];
+}
+
+static void rgb_to_planes_scalar(const uint8_t *src, size_t i, size_t n,
+                                 uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    for (; i < n; i++) {
+        r[i] = src[i * 3];
+        g[i] = src[i * 3 + 1];
+        b[i] = src[i * 3 + 2];
+    }
+}
+
+static void planes_to_rgb_scalar(const uint8_t *r, const uint8_t *g,
+                                 const uint8_t *b, size_t i, size_t n,
+                                 uint8_t *dst)
+{
+    for (; i < n; i++) {
+        dst[i * 3] = r[i];
+        dst[i * 3 + 1] = g[i];
+        dst[i * 3 + 2] = b[i];
+    }
+}
+
+static void u8_to_f32_scalar(const uint8_t *src, size_t i, size_t n,
+                             float *dst)
+{
+    for (; i < n; i++)
+        dst[i] = src[i];
+}
+
+// NaN fails both comparisons and goes to 0 like in the vector kernels,
+// `lrintf` rounds half to even like `cvtps2dq`
+static void f32_to_u8_scalar(const float *src, size_t i, size_t n,
+                             uint8_t *dst)
+{
+    for (; i < n; i++) {
+        float x = src[i] > 0 ? (src[i] < 255 ? src[i] : 255) : 0;
+        dst[i] = lrintf(x);
+    }
+}
+
+static inline int sat(int x, int lo, int hi)
+{
+    return x < lo ? lo : x > hi ? hi : x;
+}
+
+static void u8_to_s16_scalar(const uint8_t *src, size_t i, size_t n,
+                             int16_t *dst, int16_t offset)
+{
+    for (; i < n; i++)
+        dst[i] = sat(src[i] + offset, INT16_MIN, INT16_MAX);
+}
+
+static void s16_to_u8_scalar(const int16_t *src, size_t i, size_t n,
+                             uint8_t *dst, int16_t offset)
+{
+    for (; i < n; i++)
+        dst[i] = sat(src[i] + offset, 0, 255);
+}
+
+#ifdef PXB_X86
+static void mask_sse2(uint8_t *p, size_t len, int bpp, const uint8_t *keep,
+                      const uint8_t *set)
+{
+    uint8_t k[48], s[48];
+    __m128i vk[3], vs[3];
+    size_t i = 0;
+
+    for (int j = 0; j < 48; j++) {
+        k[j] = keep[j % bpp];
+        s[j] = set[j % bpp];
+    }
+    for (int j = 0; j < 3; j++) {
+        vk[j] = _mm_loadu_si128((const __m128i *)(k + j * 16));
+        vs[j] = _mm_loadu_si128((const __m128i *)(s + j * 16));
+    }
+
+    for (; i + 48 <= len; i += 48) {
+        UNROLL
+        for (int j = 0; j < 3; j++) {
+            __m128i *q = (__m128i *)(p + i + j * 16);
+            __m128i v = _mm_loadu_si128(q);
+            _mm_storeu_si128(q, _mm_or_si128(_mm_and_si128(v, vk[j]), vs[j]));
         }
-        break;
-    default:
-        break;
     }
+    mask_scalar(p, i, len, bpp, keep, set);
+}
+
+static void rgb_to_planes_sse2(const uint8_t *src, size_t n, uint8_t *r,
+                               uint8_t *g, uint8_t *b)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m128i v[6];
+        deinterleave_sse2(src + i * 3, v);
+        UNROLL
+        for (int h = 0; h < 2; h++) {
+            _mm_storeu_si128((__m128i *)(r + i + h * 16), v[h]);
+            _mm_storeu_si128((__m128i *)(g + i + h * 16), v[h + 2]);
+            _mm_storeu_si128((__m128i *)(b + i + h * 16), v[h + 4]);
+        }
+    }
+    rgb_to_planes_scalar(src, i, n, r, g, b);
+}
+
+static void planes_to_rgb_sse2(const uint8_t *r, const uint8_t *g,
+                               const uint8_t *b, size_t n, uint8_t *dst)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m128i v[6];
+        UNROLL
+        for (int h = 0; h < 2; h++) {
+            v[h] = _mm_loadu_si128((const __m128i *)(r + i + h * 16));
+            v[h + 2] = _mm_loadu_si128((const __m128i *)(g + i + h * 16));
+            v[h + 4] = _mm_loadu_si128((const __m128i *)(b + i + h * 16));
+        }
+        interleave_sse2(v, dst + i * 3);
+    }
+    planes_to_rgb_scalar(r, g, b, i, n, dst);
+}
+
+static void u8_to_f32_sse2(const uint8_t *src, size_t n, float *dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i w[2] = {_mm_unpacklo_epi8(v, zero),
+                        _mm_unpackhi_epi8(v, zero)};
+        UNROLL
+        for (int h = 0; h < 2; h++) {
+            _mm_storeu_ps(dst + i + h * 8,
+                          _mm_cvtepi32_ps(_mm_unpacklo_epi16(w[h], zero)));
+            _mm_storeu_ps(dst + i + h * 8 + 4,
+                          _mm_cvtepi32_ps(_mm_unpackhi_epi16(w[h], zero)));
+        }
+    }
+    u8_to_f32_scalar(src, i, n, dst);
+}
+
+// clamped before the conversion, which turns what doesn't fit 32 bits into
+// INT_MIN, `maxps` also takes NaN to 0
+static inline __m128i cvt_sse2(const float *p)
+{
+    __m128 x = _mm_max_ps(_mm_loadu_ps(p), _mm_setzero_ps());
+    return _mm_cvtps_epi32(_mm_min_ps(x, _mm_set1_ps(255)));
+}
+
+static void f32_to_u8_sse2(const float *src, size_t n, uint8_t *dst)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i lo = _mm_packs_epi32(cvt_sse2(src + i), cvt_sse2(src + i + 4));
+        __m128i hi =
+            _mm_packs_epi32(cvt_sse2(src + i + 8), cvt_sse2(src + i + 12));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    f32_to_u8_scalar(src, i, n, dst);
+}
+
+static void u8_to_s16_sse2(const uint8_t *src, size_t n, int16_t *dst,
+                           int16_t offset)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i off = _mm_set1_epi16(offset);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_adds_epi16(_mm_unpacklo_epi8(v, zero), off));
+        _mm_storeu_si128((__m128i *)(dst + i + 8),
+                         _mm_adds_epi16(_mm_unpackhi_epi8(v, zero), off));
+    }
+    u8_to_s16_scalar(src, i, n, dst, offset);
+}
+
+static void s16_to_u8_sse2(const int16_t *src, size_t n, uint8_t *dst,
+                           int16_t offset)
+{
+    const __m128i off = _mm_set1_epi16(offset);
+    size_t i = 0;
+
+    // a saturated sum is past 0..255 whenever the exact one is
+    for (; i + 16 <= n; i += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(src + i + 8));
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_packus_epi16(_mm_adds_epi16(lo, off),
+                                          _mm_adds_epi16(hi, off)));
+    }
+    s16_to_u8_scalar(src, i, n, dst, offset);
+}
+
+__attribute__((target("avx2"))) static void
+mask_avx2(uint8_t *p, size_t len, int bpp, const uint8_t *keep,
+          const uint8_t *set)
+{
+    uint8_t k[96], s[96];
+    __m256i vk[3], vs[3];
+    size_t i = 0;
+
+    for (int j = 0; j < 96; j++) {
+        k[j] = keep[j % bpp];
+        s[j] = set[j % bpp];
+    }
+    for (int j = 0; j < 3; j++) {
+        vk[j] = _mm256_loadu_si256((const __m256i *)(k + j * 32));
+        vs[j] = _mm256_loadu_si256((const __m256i *)(s + j * 32));
+    }
+
+    for (; i + 96 <= len; i += 96) {
+        UNROLL
+        for (int j = 0; j < 3; j++) {
+            __m256i *q = (__m256i *)(p + i + j * 32);
+            __m256i v = _mm256_loadu_si256(q);
+            _mm256_storeu_si256(
+                q, _mm256_or_si256(_mm256_and_si256(v, vk[j]), vs[j]));
+        }
+    }
+    mask_scalar(p, i, len, bpp, keep, set);
+}
+
+__attribute__((target("avx2"))) static void
+rgb_to_planes_avx2(const uint8_t *src, size_t n, uint8_t *r, uint8_t *g,
+                   uint8_t *b)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m128i v[6];
+        deinterleave_avx2(src + i * 3, v);
+        UNROLL
+        for (int h = 0; h < 2; h++) {
+            _mm_storeu_si128((__m128i *)(r + i + h * 16), v[h]);
+            _mm_storeu_si128((__m128i *)(g + i + h * 16), v[h + 2]);
+            _mm_storeu_si128((__m128i *)(b + i + h * 16), v[h + 4]);
+        }
+    }
+    rgb_to_planes_scalar(src, i, n, r, g, b);
+}
+
+__attribute__((target("avx2"))) static void
+planes_to_rgb_avx2(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+                   size_t n, uint8_t *dst)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m128i v[6];
+        UNROLL
+        for (int h = 0; h < 2; h++) {
+            v[h] = _mm_loadu_si128((const __m128i *)(r + i + h * 16));
+            v[h + 2] = _mm_loadu_si128((const __m128i *)(g + i + h * 16));
+            v[h + 4] = _mm_loadu_si128((const __m128i *)(b + i + h * 16));
+        }
+        interleave_avx2(v, dst + i * 3);
+    }
+    planes_to_rgb_scalar(r, g, b, i, n, dst);
+}
+
+__attribute__((target("avx2"))) static void
+u8_to_f32_avx2(const uint8_t *src, size_t n, float *dst)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        UNROLL
+        for (int j = 0; j < 4; j++) {
+            __m128i v = _mm_loadl_epi64((const __m128i *)(src + i + j * 8));
+            _mm256_storeu_ps(dst + i + j * 8,
+                             _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v)));
+        }
+    }
+    u8_to_f32_scalar(src, i, n, dst);
+}
+
+__attribute__((target("avx2"))) static inline __m256i cvt_avx2(const float *p)
+{
+    __m256 x = _mm256_max_ps(_mm256_loadu_ps(p), _mm256_setzero_ps());
+    return _mm256_cvtps_epi32(_mm256_min_ps(x, _mm256_set1_ps(255)));
+}
+
+__attribute__((target("avx2"))) static void
+f32_to_u8_avx2(const float *src, size_t n, uint8_t *dst)
+{
+    // the packs interleave the 128-bit lanes by 32-bit groups
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i ab = _mm256_packs_epi32(cvt_avx2(src + i),
+                                        cvt_avx2(src + i + 8));
+        __m256i cd = _mm256_packs_epi32(cvt_avx2(src + i + 16),
+                                        cvt_avx2(src + i + 24));
+        __m256i v = _mm256_packus_epi16(ab, cd);
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_permutevar8x32_epi32(v, order));
+    }
+    f32_to_u8_scalar(src, i, n, dst);
+}
+
+__attribute__((target("avx2"))) static void
+u8_to_s16_avx2(const uint8_t *src, size_t n, int16_t *dst,
+               int16_t offset)
+{
+    const __m256i off = _mm256_set1_epi16(offset);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_adds_epi16(_mm256_cvtepu8_epi16(v), off));
+    }
+    u8_to_s16_scalar(src, i, n, dst, offset);
+}
+
+__attribute__((target("avx2"))) static void
+s16_to_u8_avx2(const int16_t *src, size_t n, uint8_t *dst,
+               int16_t offset)
+{
+    const __m256i off = _mm256_set1_epi16(offset);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(src + i + 16));
+        __m256i v = _mm256_packus_epi16(_mm256_adds_epi16(lo, off),
+                                        _mm256_adds_epi16(hi, off));
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_permute4x64_epi64(v, 0xD8));
+    }
+    s16_to_u8_scalar(src, i, n, dst, offset);
+}
+#endif
+
+static void mask_row_scalar(uint8_t *p, size_t len, int bpp,
+                            const uint8_t *keep, const uint8_t *set)
+{
+    mask_scalar(p, 0, len, bpp, keep, set);
+}
+
+static void rgb_to_planes_row(const uint8_t *src, size_t n, uint8_t *r,
+                              uint8_t *g, uint8_t *b)
+{
+    rgb_to_planes_scalar(src, 0, n, r, g, b);
+}
+
+static void planes_to_rgb_row(const uint8_t *r, const uint8_t *g,
+                              const uint8_t *b, size_t n, uint8_t *dst)
+{
+    planes_to_rgb_scalar(r, g, b, 0, n, dst);
+}
+
+static void u8_to_f32_row(const uint8_t *src, size_t n, float *dst)
+{
+    u8_to_f32_scalar(src, 0, n, dst);
+}
+
+static void f32_to_u8_row(const float *src, size_t n, uint8_t *dst)
+{
+    f32_to_u8_scalar(src, 0, n, dst);
+}
+
+static void u8_to_s16_row(const uint8_t *src, size_t n, int16_t *dst,
+                          int16_t offset)
+{
+    u8_to_s16_scalar(src, 0, n, dst, offset);
+}
+
+static void s16_to_u8_row(const int16_t *src, size_t n, uint8_t *dst,
+                          int16_t offset)
+{
+    s16_to_u8_scalar(src, 0, n, dst, offset);
+}
+
+static struct {
+    const char *isa;
+    void (*mask)(uint8_t *, size_t, int, const uint8_t *, const uint8_t *);
+    void (*rgb_to_planes)(const uint8_t *, size_t, uint8_t *, uint8_t *,
+                          uint8_t *);
+    void (*planes_to_rgb)(const uint8_t *, const uint8_t *, const uint8_t *,
+                          size_t, uint8_t *);
+    void (*u8_to_f32)(const uint8_t *, size_t, float *);
+    void (*f32_to_u8)(const float *, size_t, uint8_t *);
+    void (*u8_to_s16)(const uint8_t *, size_t, int16_t *, int16_t);
+    void (*s16_to_u8)(const int16_t *, size_t, uint8_t *, int16_t);
+} kernels;
+
+// resolved on first use like the dct8 kernels
+static void pxb_dispatch(void)
+{
+    if (kernels.isa)
+        return;
+
+    kernels.mask = mask_row_scalar;
+    kernels.rgb_to_planes = rgb_to_planes_row;
+    kernels.planes_to_rgb = planes_to_rgb_row;
+    kernels.u8_to_f32 = u8_to_f32_row;
+    kernels.f32_to_u8 = f32_to_u8_row;
+    kernels.u8_to_s16 = u8_to_s16_row;
+    kernels.s16_to_u8 = s16_to_u8_row;
+    const char *isa = "scalar";
+#ifdef PXB_X86
+    int features = cpu_get_features();
+    if (features & CPU_AVX2) {
+        isa = "avx2";
+        kernels.mask = mask_avx2;
+        kernels.rgb_to_planes = rgb_to_planes_avx2;
+        kernels.planes_to_rgb = planes_to_rgb_avx2;
+        kernels.u8_to_f32 = u8_to_f32_avx2;
+        kernels.f32_to_u8 = f32_to_u8_avx2;
+        kernels.u8_to_s16 = u8_to_s16_avx2;
+        kernels.s16_to_u8 = s16_to_u8_avx2;
+    } else if (features & CPU_SSE2) {
+        isa = "sse2";
+        kernels.mask = mask_sse2;
+        kernels.rgb_to_planes = rgb_to_planes_sse2;
+        kernels.planes_to_rgb = planes_to_rgb_sse2;
+        kernels.u8_to_f32 = u8_to_f32_sse2;
+        kernels.f32_to_u8 = f32_to_u8_sse2;
+        kernels.u8_to_s16 = u8_to_s16_sse2;
+        kernels.s16_to_u8 = s16_to_u8_sse2;
+    }
+#endif
+    kernels.isa = isa;
+}
+
+const char *pxb_isa(void)
+{
+    pxb_dispatch();
+    return kernels.isa;
+}
+
+void pxb_mask_row(uint8_t *p, size_t n, int bpp, const uint8_t *keep,
+                  const uint8_t *set)
+{
+    pxb_dispatch();
+    kernels.mask(p, n * bpp, bpp, keep, set);
+}
+
+void pxb_rgb24_to_planes(const uint8_t *src, size_t n, uint8_t *r,
+                         uint8_t *g, uint8_t *b)
+{
+    pxb_dispatch();
+    kernels.rgb_to_planes(src, n, r, g, b);
+}
+
+void pxb_planes_to_rgb24(const uint8_t *r, const uint8_t *g,
+                         const uint8_t *b, size_t n, uint8_t *dst)
+{
+    pxb_dispatch();
+    kernels.planes_to_rgb(r, g, b, n, dst);
+}
+
+void pxb_u8_to_f32(const uint8_t *src, size_t n, float *dst)
+{
+    pxb_dispatch();
+    kernels.u8_to_f32(src, n, dst);
+}
+
+void pxb_f32_to_u8(const float *src, size_t n, uint8_t *dst)
+{
+    pxb_dispatch();
+    kernels.f32_to_u8(src, n, dst);
+}
+
+void pxb_u8_to_s16(const uint8_t *src, size_t n, int16_t *dst,
+                   int16_t offset)
+{
+    pxb_dispatch();
+    kernels.u8_to_s16(src, n, dst, offset);
+}
+
+void pxb_s16_to_u8(const int16_t *src, size_t n, uint8_t *dst,
+                   int16_t offset)
+{
+    pxb_dispatch();
+    kernels.s16_to_u8(src, n, dst, offset);
 }
@@ -14,33 +14,138 @@ typedef enum Channel {
     CHAN_R = 0x08,
     CHAN_G = 0x10,
     CHAN_B = 0x20,
+    CHAN_A = 0x40,
 } Channel;
 
-// each format value is bitwise `or`ed channels
+// the channel bits of a format
+#define FMT_CHANNELS(fmt) ((fmt)&0xFF)
+// formats of the same channels differ in their layout bits
+#define FMT_LAYOUT(n) ((n) << 8)
+
+// each format value is bitwise `or`ed channels and a layout
 typedef enum PixelFormat {
+    // planar Y, U and V, the chroma halved in both directions (I420)
     FMT_YUV420 = CHAN_Y | CHAN_U | CHAN_V,
+    // packed r, g, b bytes
     FMT_RGB24 = CHAN_R | CHAN_G | CHAN_B,
+    // luma only
+    FMT_GRAY8 = CHAN_Y,
+    // planar, the chroma halved across
+    FMT_YUV422P = CHAN_Y | CHAN_U | CHAN_V | FMT_LAYOUT(1),
+    // planar, full resolution chroma
+    FMT_YUV444P = CHAN_Y | CHAN_U | CHAN_V | FMT_LAYOUT(2),
+    // a Y plane and a plane of interleaved U, V pairs halved in both
+    // directions
+    FMT_NV12 = CHAN_Y | CHAN_U | CHAN_V | FMT_LAYOUT(3),
+    // packed r, g, b, a and b, g, r, a bytes
+    FMT_RGBA32 = CHAN_R | CHAN_G | CHAN_B | CHAN_A,
+    FMT_BGRA32 = CHAN_R | CHAN_G | CHAN_B | CHAN_A | FMT_LAYOUT(1),
 } PixelFormat;
 
+#define PXB_MAX_PLANES 3
+// the alignment of every plane and row stride
+#define PXB_ALIGN 64
+
+// the planes of a format, 1 to 3
+int fmt_get_planes(PixelFormat fmt);
+// the bytes per sample of plane `i`, e.g. 2 for the U, V pairs of NV12
+int fmt_get_bpp(PixelFormat fmt, int i);
+// the bytes of a row of plane `i` of a `w` pixels wide image and the rows
+// of a `h` pixels high one, subsampled planes round odd sizes up
+size_t fmt_get_row_size(PixelFormat fmt, int i, size_t w);
+size_t fmt_get_rows(PixelFormat fmt, int i, size_t h);
+// the row stride of plane `i`, its row size padded to PXB_ALIGN
+size_t fmt_get_pitch(PixelFormat fmt, int i, size_t w);
+// the bytes of all the planes packed one after the other without padding
 size_t fmt_get_size(PixelFormat fmt, size_t w, size_t h);
-size_t fmt_get_pitch(PixelFormat fmt, size_t w, size_t h);
 
-// a uint8_t 2d pixel buffer
+// the reference counted storage of the planes, shared by a buffer and its
+// views
+typedef struct xPxbStore xPxbStore;
+
+// a uint8_t 2d pixel buffer, or a view of one
 typedef struct PixelBuffer {
     PixelFormat fmt;
     // the width/height in pixels
     size_t w, h;
-    // the buf size in bytes
+    // the rows of plane `i` are `stride[i]` bytes apart, a multiple of
+    // PXB_ALIGN but for wrapped planes. the planes of a new buffer start
+    // PXB_ALIGN aligned, those of a crop are offset by its position
+    int nplanes;
+    uint8_t *plane[PXB_MAX_PLANES];
+    size_t stride[PXB_MAX_PLANES];
+    // the storage the planes are in, `size` bytes at `buf` padding included.
+    // it lives as long as any buffer or view of it, so a view's may cover
+    // more than its pixels
     size_t size;
-    // a continuous array
-    uint8_t buf[0];
+    uint8_t *buf;
+    xPxbStore *store;
 } PixelBuffer;
 
+// the padding at the end of every row is zeroed, so buffers of the same
+// pixels compare equal. `buf`, if not NULL, holds the planes packed as
+// `fmt_get_size` counts them
 PixelBuffer *pxb_new(PixelFormat fmt, size_t w, size_t h, const uint8_t *buf);
+// a copy of planes whose rows are `strides[i]` bytes apart, e.g. the frames
+// of a producer that pads its rows
+PixelBuffer *pxb_import(PixelFormat fmt, size_t w, size_t h,
+                        const uint8_t *const planes[],
+                        const size_t strides[]);
+// a buffer over planes it doesn't own, e.g. a mapped file, without copying
+// them. their rows may have any stride, `release(opaque)` is called when the
+// last buffer or view of them is freed
+PixelBuffer *pxb_wrap(PixelFormat fmt, size_t w, size_t h,
+                      uint8_t *const planes[], const size_t strides[],
+                      void (*release)(void *), void *opaque);
+// a copy in its own storage with the channels out of `mask` removed
 PixelBuffer *pxb_copy(const PixelBuffer *src, int mask);
+// free a buffer or a view, the storage goes with the last of them
 void pxb_free(PixelBuffer *pxb);
+// set the channels of `mask` to 128 for Y, U and V, 0 for r, g, b and 255 for
+// alpha
 void pxb_remove_channels(PixelBuffer *pxb, int mask);
 
+// views share the storage of `pxb` without copying a pixel, and writes
+// through any of them show in all. the whole of `pxb`
+PixelBuffer *pxb_view(const PixelBuffer *pxb);
+// plane `i` as a FMT_GRAY8 buffer of its own size, or the only plane of a
+// packed format as it is. NULL for the interleaved chroma of NV12
+PixelBuffer *pxb_plane_view(const PixelBuffer *pxb, int i);
+// the `w*h` rectangle at `(x, y)`. NULL if it's out of `pxb` or, for
+// subsampled chroma, `x`/`y` isn't on a chroma sample
+PixelBuffer *pxb_crop(const PixelBuffer *pxb, size_t x, size_t y, size_t w,
+                      size_t h);
+// whether other buffers or views share the storage
+int pxb_is_shared(const PixelBuffer *pxb);
+// copy on write: move the pixels of a shared `pxb` to storage of its own, so
+// writing to it leaves the other views alone. nothing to do otherwise
+void pxb_make_writable(PixelBuffer *pxb);
+
+// row kernels over `n` samples, SIMD when the cpu has it with the same
+// results as the scalar ones, see cpu.h
+
+// the name of the vector instruction set the kernels run on
+const char *pxb_isa(void);
+// every byte of `n` samples of `bpp` bytes, 1 to 4, becomes
+// `(b & keep[k]) | set[k]` by its offset `k` in the sample
+void pxb_mask_row(uint8_t *p, size_t n, int bpp, const uint8_t *keep,
+                  const uint8_t *set);
+// packed rgb pixels to planes and back
+void pxb_rgb24_to_planes(const uint8_t *src, size_t n, uint8_t *r,
+                         uint8_t *g, uint8_t *b);
+void pxb_planes_to_rgb24(const uint8_t *r, const uint8_t *g,
+                         const uint8_t *b, size_t n, uint8_t *dst);
+// samples to floats, and floats rounded to the nearest (half to even) and
+// saturated to 0..255, NaN to 0
+void pxb_u8_to_f32(const uint8_t *src, size_t n, float *dst);
+void pxb_f32_to_u8(const float *src, size_t n, uint8_t *dst);
+// samples plus `offset` saturated to int16, e.g. -128 for the level shift
+// of a DCT, and int16 plus `offset` saturated to 0..255
+void pxb_u8_to_s16(const uint8_t *src, size_t n, int16_t *dst,
+                   int16_t offset);
+void pxb_s16_to_u8(const int16_t *src, size_t n, uint8_t *dst,
+                   int16_t offset);
+
 #ifdef __cplusplus
 }
 #endif
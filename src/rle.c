@@ -6,21 +6,22 @@
 const xRLEItem RLE_EOB = {{0, 0}, 0};
 const xRLEItem RLE_ZRL = {{15, 0}, 0};
 
+// the table is prefixed by a `{cap, size}` header
 xRLETable rtb_calloc(size_t cap)
 {
-    xRLETable tbl = calloc(cap, sizeof(xRLEItem) + 2);
-    tbl[0] = *(xRLEItem *)&cap;
-    tbl[1] = (xRLEItem){0};
-    return tbl + 2;
+    size_t *hdr = calloc(1, sizeof(size_t) * 2 + sizeof(xRLEItem) * cap);
+    hdr[0] = cap;
+    hdr[1] = 0;
+    return (xRLETable)(hdr + 2);
 }
 
-void rtb_free(xRLETable tbl) { free(tbl - 2); }
+void rtb_free(xRLETable tbl) { free((size_t *)tbl - 2); }
 
-size_t rtb_get_size(xRLETable tbl) { return *(size_t *)&tbl[-1]; }
+size_t rtb_get_size(xRLETable tbl) { return ((size_t *)tbl)[-1]; }
 
-void rtb_set_size(xRLETable tbl, size_t size) { tbl[-1] = *(xRLEItem *)&size; }
+void rtb_set_size(xRLETable tbl, size_t size) { ((size_t *)tbl)[-1] = size; }
 
-size_t rtb_get_cap(xRLETable tbl) { return *(size_t *)&tbl[-2]; }
+size_t rtb_get_cap(xRLETable tbl) { return ((size_t *)tbl)[-2]; }
 
 void rtb_print(xRLETable rtb, size_t size)
 {
@@ -33,32 +34,43 @@ void rtb_print(xRLETable rtb, size_t size)
     printf("\n");
 }
 
+// the magnitude category, i.e. the bit length of `|n|`
 static size_t calc_msb(int16_t n)
 {
-    if (n < 0)
-        n *= -1;
+    int m = n < 0 ? -n : n;
 #if __GNUC__
-    return n == 0 ? 0 : 16 - __builtin_clz(n);
+    return m == 0 ? 0 : 32 - __builtin_clz(m);
 #else
     int nbits = 0;
-    while (n >>= 1)
+    while (m) {
+        m >>= 1;
         nbits++;
+    }
     return nbits;
 #endif
 }
 
-int rtb_parse(xRLETable tbl, xBlock blk)
+// coefficient `i` of a zigzagged block, int16 from `zz` or else converted
+// from the reals of `f`
+static inline int16_t coef_at(const xReal *f, const int16_t *zz, size_t i)
+{
+    return zz ? zz[i] : (int16_t)f[i];
+}
+
+// the run-length items of the `n` coefficients of a block, the DC one left
+// out. each caller passes NULL for one of `f`/`zz`, so the choice is folded
+// away when inlined
+static inline int rle_parse(xRLETable tbl, const xReal *f, const int16_t *zz,
+                            size_t n)
 {
-    size_t w = blk_get_width(blk);
-    size_t zeros = 0, size = 0, last = w * w - 1;
-    int16_t amp;
+    size_t zeros = 0, size = 0, last = n - 1;
 
-    while (blk[0][last] == 0) {
+    while (last > 0 && coef_at(f, zz, last) == 0) {
         last--;
     }
 
-    for (int i = 1; i <= last; i++) {
-        amp = (int16_t)blk[0][i];
+    for (size_t i = 1; i <= last; i++) {
+        int16_t amp = coef_at(f, zz, i);
         if (amp == 0) {
             zeros++;
         } else {
@@ -66,15 +78,25 @@ int rtb_parse(xRLETable tbl, xBlock blk)
                 tbl[size++] = RLE_ZRL;
                 zeros -= 16;
             }
-            tbl[size++] = (xRLEItem){{zeros & 0x00FF, calc_msb(amp)}, amp};
+            tbl[size++] = (xRLEItem){{zeros, calc_msb(amp)}, amp};
             zeros = 0;
         }
     }
 
-    if (last != w * w - 1) {
+    if (last != n - 1) {
         tbl[size++] = RLE_EOB;
     }
 
     rtb_set_size(tbl, size);
     return size;
 }
+
+int rtb_parse(xRLETable tbl, xBlock blk)
+{
+    return rle_parse(tbl, blk.data, NULL, blk.w * blk.w);
+}
+
+int rtb_parse_i16(xRLETable tbl, const int16_t *zz)
+{
+    return rle_parse(tbl, NULL, zz, 64);
+}
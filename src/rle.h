@@ -35,6 +35,8 @@ void rtb_free(xRLETable);
 // parse a zigzagged block into `tbl`,
 // `tbl` would be overwrited from the beginning
 int rtb_parse(xRLETable tbl, xBlock blk);
+// the same for a zigzagged 8x8 block of int16 coefficients
+int rtb_parse_i16(xRLETable tbl, const int16_t *zz);
 void rtb_print(xRLETable rtb, size_t size);
 
 #ifdef __cplusplus
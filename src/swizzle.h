@@ -0,0 +1,130 @@
+#ifndef _SWIZZLE_H_
+#define _SWIZZLE_H_
+
+// byte shuffles between 32 packed rgb pixels and their 16-byte r0, r1, g0,
+// g1, b0, b1 planes for the x86 kernels, included under their SIMD guard
+#include <immintrin.h>
+#include <stdint.h>
+
+// the small loops over rows, channels and halves of a kernel have to be
+// unrolled for their vectors to stay in registers
+#define UNROLL _Pragma("GCC unroll 8")
+
+// the 32 rgb pixels at `p` into 16 byte planes, five rounds of byte
+// interleaving undo the stride of 3
+static inline void deinterleave_sse2(const uint8_t *p, __m128i *v)
+{
+    UNROLL
+    for (int i = 0; i < 6; i++)
+        v[i] = _mm_loadu_si128((const __m128i *)(p + i * 16));
+    UNROLL
+    for (int round = 0; round < 5; round++) {
+        __m128i t[6];
+        UNROLL
+        for (int i = 0; i < 3; i++) {
+            t[2 * i] = _mm_unpacklo_epi8(v[i], v[i + 3]);
+            t[2 * i + 1] = _mm_unpackhi_epi8(v[i], v[i + 3]);
+        }
+        UNROLL
+        for (int i = 0; i < 6; i++)
+            v[i] = t[i];
+    }
+}
+
+// the 16 byte planes as 32 rgb pixels at `p`, the inverse of
+// `deinterleave_sse2`: five rounds of splitting even and odd bytes
+static inline void interleave_sse2(__m128i *v, uint8_t *p)
+{
+    const __m128i low = _mm_set1_epi16(0xFF);
+
+    UNROLL
+    for (int round = 0; round < 5; round++) {
+        __m128i t[6];
+        UNROLL
+        for (int i = 0; i < 3; i++) {
+            __m128i a = v[i * 2], b = v[i * 2 + 1];
+            t[i] = _mm_packus_epi16(_mm_and_si128(a, low),
+                                    _mm_and_si128(b, low));
+            t[i + 3] = _mm_packus_epi16(_mm_srli_epi16(a, 8),
+                                        _mm_srli_epi16(b, 8));
+        }
+        UNROLL
+        for (int i = 0; i < 6; i++)
+            v[i] = t[i];
+    }
+    UNROLL
+    for (int i = 0; i < 6; i++)
+        _mm_storeu_si128((__m128i *)(p + i * 16), v[i]);
+}
+
+// the `pshufb` masks that gather the r, g or b samples of 16 rgb pixels from
+// each of their three 16-byte thirds, and that place them back, -1 clears a
+// byte
+// clang-format off
+static const int8_t rgb_gather[3][3][16] = {
+    {{0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13}},
+    {{1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14}},
+    {{2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15}},
+};
+
+static const int8_t rgb_shuffle[3][3][16] = {
+    {{0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5},
+     {-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1},
+     {-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1}},
+    {{-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1},
+     {5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10},
+     {-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1}},
+    {{-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1},
+     {-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1},
+     {10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15}},
+};
+// clang-format on
+
+// the or of three vectors shuffled by the masks `m`
+__attribute__((target("avx2"))) static inline __m128i
+shuffle3(__m128i a, __m128i b, __m128i c, const int8_t (*m)[16])
+{
+    __m128i x = _mm_shuffle_epi8(a, _mm_loadu_si128((const __m128i *)m[0]));
+    __m128i y = _mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *)m[1]));
+    __m128i z = _mm_shuffle_epi8(c, _mm_loadu_si128((const __m128i *)m[2]));
+    return _mm_or_si128(_mm_or_si128(x, y), z);
+}
+
+// `deinterleave_sse2` with the SSSE3 byte shuffle, a third of the
+// instructions
+__attribute__((target("avx2"))) static inline void
+deinterleave_avx2(const uint8_t *p, __m128i *v)
+{
+    UNROLL
+    for (int h = 0; h < 2; h++) {
+        __m128i in[3];
+        UNROLL
+        for (int o = 0; o < 3; o++)
+            in[o] = _mm_loadu_si128((const __m128i *)(p + h * 48 + o * 16));
+        UNROLL
+        for (int ch = 0; ch < 3; ch++)
+            v[ch * 2 + h] = shuffle3(in[0], in[1], in[2], rgb_gather[ch]);
+    }
+}
+
+// `interleave_sse2` with the SSSE3 byte shuffle
+__attribute__((target("avx2"))) static inline void
+interleave_avx2(const __m128i *v, uint8_t *p)
+{
+    UNROLL
+    for (int h = 0; h < 2; h++) {
+        UNROLL
+        for (int o = 0; o < 3; o++) {
+            __m128i out = shuffle3(v[h], v[h + 2], v[h + 4], rgb_shuffle[o]);
+            _mm_storeu_si128((__m128i *)(p + h * 48 + o * 16), out);
+        }
+    }
+}
+
+#endif
@@ -1,38 +1,19 @@
 #include <math.h>
 
+#if !defined(NO_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#define YUV_X86
+#include <immintrin.h>
+#endif
+
+#include "cpu.h"
 #include "yuv.h"
 
 #define CLIP(X) ((X) > 255 ? 255 : (X) < 0 ? 0 : X)
 
-// RGB -> YUV
-#define RGB2Y(R, G, B) CLIP(((66 * (R) + 129 * (G) + 25 * (B) + 128) >> 8) + 16)
-#define RGB2U(R, G, B) CLIP(((-38 * (R)-74 * (G) + 112 * (B) + 128) >> 8) + 128)
-#define RGB2V(R, G, B) CLIP(((112 * (R)-94 * (G)-18 * (B) + 128) >> 8) + 128)
-
-// YUV -> RGB
-#define C(Y) ((Y)-16)
-#define D(U) ((U)-128)
-#define E(V) ((V)-128)
-
-#define YUV2R(Y, U, V) CLIP((298 * C(Y) + 409 * E(V) + 128) >> 8)
-#define YUV2G(Y, U, V) CLIP((298 * C(Y) - 100 * D(U) - 208 * E(V) + 128) >> 8)
-#define YUV2B(Y, U, V) CLIP((298 * C(Y) + 516 * D(U) + 128) >> 8)
-
-// RGB -> YCbCr
-#define CRGB2Y(R, G, B) CLIP((19595 * R + 38470 * G + 7471 * B) >> 16)
-#define CRGB2Cb(R, G, B)                                                       \
-    CLIP(                                                                      \
-        (36962 * (B - CLIP((19595 * R + 38470 * G + 7471 * B) >> 16)) >> 16) + \
-        128)
-#define CRGB2Cr(R, G, B)                                                       \
-    CLIP(                                                                      \
-        (46727 * (R - CLIP((19595 * R + 38470 * G + 7471 * B) >> 16)) >> 16) + \
-        128)
-
-// YCbCr -> RGB
-#define CYCbCr2R(Y, Cb, Cr) CLIP(Y + (91881 * Cr >> 16) - 179)
-#define CYCbCr2G(Y, Cb, Cr) CLIP(Y - ((22544 * Cb + 46793 * Cr) >> 16) + 135)
-#define CYCbCr2B(Y, Cb, Cr) CLIP(Y + (116129 * Cb >> 16) - 226)
+// JFIF YCbCr -> RGB, the chroma offsets with 16 fraction bits rounded
+#define JFIF_R(CR) ((91881 * (CR) + 32768) >> 16)
+#define JFIF_G(CB, CR) ((-22554 * (CB)-46802 * (CR) + 32768) >> 16)
+#define JFIF_B(CB) ((116130 * (CB) + 32768) >> 16)
 
 double clamp(double x, double lower, double upper)
 {
@@ -79,25 +60,757 @@ void rgb24_to_yuv444(size_t w, size_t h, uint8_t *src, uint8_t *dst)
 
 void rgb24_to_yuv420(size_t w, size_t h, uint8_t *src, uint8_t *dst)
 {
-    uint8_t *y = dst;
-    uint8_t *u = y + w * h;
-    uint8_t *v = u + w * h / 4;
-    uint8_t *up = u, *vp = v;
-    YUV yuv;
+    size_t cw = (w + 1) / 2, ch = (h + 1) / 2;
+    uint8_t *y = dst, *u = y + w * h, *v = u + cw * ch;
+
+    rgb24_to_ycbcr420(YCC_BT601, w, h, src, w * 3, y, w, u, v, cw);
+}
+
+// RGB -> YCbCr as `(k[0] * R + k[1] * G + k[2] * B + bias) >> shift`, luma
+// with 16 fraction bits and the chroma of a sum of 4 pixels with 18. the
+// bias of the chroma is short of a half so 255 doesn't overflow
+typedef struct YccMatrix {
+    int k[3][3];
+    int bias[3];
+} YccMatrix;
+
+#define CHROMA_BIAS ((128 << 18) + (1 << 17) - 1)
+
+static const YccMatrix matrices[] = {
+    [YCC_JFIF] = {{{19595, 38470, 7471},
+                   {-11059, -21709, 32768},
+                   {32768, -27439, -5329}},
+                  {32768, CHROMA_BIAS, CHROMA_BIAS}},
+    [YCC_BT601] = {{{16829, 33039, 6416},
+                    {-9714, -19070, 28784},
+                    {28784, -24103, -4681}},
+                   {(16 << 16) + 32768, CHROMA_BIAS, CHROMA_BIAS}},
+};
+
+// one pair of rows, `p1` and `y1` are the same as `p0` and `y0` for an odd
+// last row. from column `j` on, which is even
+static void ycc420_scalar(const YccMatrix *m, size_t j, size_t w,
+                          const uint8_t *p0, const uint8_t *p1, uint8_t *y0,
+                          uint8_t *y1, uint8_t *cb, uint8_t *cr)
+{
+    const int *ky = m->k[0], *kb = m->k[1], *kr = m->k[2];
+
+    for (; j < w; j += 2) {
+        size_t k = j + 1 < w ? j + 1 : j;
+        const uint8_t *a = p0 + j * 3, *b = p0 + k * 3;
+        const uint8_t *c = p1 + j * 3, *d = p1 + k * 3;
 
-    for (int i = 0; i < h; ++i) {
-        for (int j = 0; j < w; ++j) {
-            int pos = i * w + j;
+        // the duplicated samples of an odd edge are written twice
+        y0[j] = (ky[0] * a[0] + ky[1] * a[1] + ky[2] * a[2] + m->bias[0]) >> 16;
+        y0[k] = (ky[0] * b[0] + ky[1] * b[1] + ky[2] * b[2] + m->bias[0]) >> 16;
+        y1[j] = (ky[0] * c[0] + ky[1] * c[1] + ky[2] * c[2] + m->bias[0]) >> 16;
+        y1[k] = (ky[0] * d[0] + ky[1] * d[1] + ky[2] * d[2] + m->bias[0]) >> 16;
 
-            yuv =
-                yuv_from_rgb(src[pos * 3], src[pos * 3 + 1], src[pos * 3 + 2]);
+        int r = a[0] + b[0] + c[0] + d[0];
+        int g = a[1] + b[1] + c[1] + d[1];
+        int bl = a[2] + b[2] + c[2] + d[2];
+        cb[j / 2] = (kb[0] * r + kb[1] * g + kb[2] * bl + m->bias[1]) >> 18;
+        cr[j / 2] = (kr[0] * r + kr[1] * g + kr[2] * bl + m->bias[2]) >> 18;
+    }
+}
+
+// a row of pixels being converted to rgb. the chroma of a pixel comes from
+// the nearest chroma row `cb0`/`cr0` and, for the vertical triangle filter,
+// the next nearest `cb1`/`cr1`
+typedef struct RgbRow {
+    const uint8_t *y, *cb0, *cr0, *cb1, *cr1;
+    uint8_t *dst;
+    // pixels and chroma samples of the row
+    size_t w, cw;
+    int sx, bpp;
+    // the 3:1 blend of the chroma rows with the rounding `bias` of 4:4:0,
+    // the horizontal 3:1 blend of the samples
+    int vfancy, bias, hfancy;
+} RgbRow;
+
+// the upsampled chroma of pixel `x`, rounded the way libjpeg does it
+static inline int upsample(const RgbRow *r, const uint8_t *c0,
+                           const uint8_t *c1, size_t x)
+{
+    if (r->sx == 1)
+        return r->vfancy ? (3 * c0[x] + c1[x] + r->bias) >> 2 : c0[x];
+
+    size_t i = x / 2;
+    if (!r->hfancy)
+        return c0[i];
 
-            y[pos] = yuv.y;
+    // the next nearest sample is on the left of an even pixel, on the right
+    // of an odd one, and the edge samples stand in for their missing
+    // neighbours
+    size_t j = x & 1 ? (i + 1 < r->cw ? i + 1 : i) : (i > 0 ? i - 1 : 0);
+    if (!r->vfancy)
+        return (3 * c0[i] + c0[j] + (x & 1 ? 2 : 1)) >> 2;
 
-            if (i % 2 == 0 && j % 2 == 0) {
-                *up++ = yuv.u;
-                *vp++ = yuv.v;
+    int a = 3 * c0[i] + c1[i], b = 3 * c0[j] + c1[j];
+    return (3 * a + b + (x & 1 ? 7 : 8)) >> 4;
+}
+
+// pixels `[x, end)` of the row
+static void rgb_scalar(const RgbRow *r, size_t x, size_t end)
+{
+    for (; x < end; x++) {
+        int l = r->y[x];
+        int u = upsample(r, r->cb0, r->cb1, x) - 128;
+        int v = upsample(r, r->cr0, r->cr1, x) - 128;
+        uint8_t *p = r->dst + x * r->bpp;
+
+        p[0] = CLIP(l + JFIF_R(v));
+        p[1] = CLIP(l + JFIF_G(u, v));
+        p[2] = CLIP(l + JFIF_B(u));
+        if (r->bpp == 4)
+            p[3] = 255;
+    }
+}
+
+static void rgb_row_scalar(const RgbRow *r) { rgb_scalar(r, 0, r->w); }
+
+#ifdef YUV_X86
+#include "swizzle.h"
+
+// every weight is split in two halves that fit 16 bits, one goes with the
+// (r, g), (g, b) or (b, r) pair of `pmaddwd` and the other with the next, so
+// the sums are exactly the scalar ones
+typedef struct YccPairs {
+    int32_t rg[3], gb[3], br[3];
+} YccPairs;
+
+static int32_t pair(int lo, int hi)
+{
+    return (int32_t)((uint32_t)(uint16_t)hi << 16 | (uint16_t)lo);
+}
+
+static void ycc_pairs(YccPairs *pp, const YccMatrix *m)
+{
+    for (int i = 0; i < 3; i++) {
+        const int *k = m->k[i];
+        int r = k[0] / 2, g = k[1] / 2, b = k[2] / 2;
+
+        pp->rg[i] = pair(r, g);
+        pp->gb[i] = pair(k[1] - g, b);
+        pp->br[i] = pair(k[2] - b, k[0] - r);
+    }
+}
+
+// `(k . (r, g, b) + bias) >> shift` of 8 16-bit lanes
+static inline __m128i dot_sse2(__m128i r, __m128i g, __m128i b, __m128i krg,
+                               __m128i kgb, __m128i kbr, __m128i bias,
+                               int shift)
+{
+    __m128i lo = _mm_add_epi32(
+        _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), krg),
+                      _mm_madd_epi16(_mm_unpacklo_epi16(g, b), kgb)),
+        _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(b, r), kbr), bias));
+    __m128i hi = _mm_add_epi32(
+        _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), krg),
+                      _mm_madd_epi16(_mm_unpackhi_epi16(g, b), kgb)),
+        _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(b, r), kbr), bias));
+    return _mm_packs_epi32(_mm_srai_epi32(lo, shift),
+                           _mm_srai_epi32(hi, shift));
+}
+
+// the sums of horizontal pairs of 8 16-bit lanes of two rows, 4 32-bit lanes
+static inline __m128i quad_sse2(__m128i a, __m128i b)
+{
+    return _mm_madd_epi16(_mm_add_epi16(a, b), _mm_set1_epi16(1));
+}
+
+static void ycc420_sse2(const YccMatrix *m, size_t j, size_t w,
+                        const uint8_t *p0, const uint8_t *p1, uint8_t *y0,
+                        uint8_t *y1, uint8_t *cb, uint8_t *cr)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i k[3][3], bias[3];
+    YccPairs pp;
+
+    ycc_pairs(&pp, m);
+    for (int i = 0; i < 3; i++) {
+        k[i][0] = _mm_set1_epi32(pp.rg[i]);
+        k[i][1] = _mm_set1_epi32(pp.gb[i]);
+        k[i][2] = _mm_set1_epi32(pp.br[i]);
+        bias[i] = _mm_set1_epi32(m->bias[i]);
+    }
+
+    for (; j + 32 <= w; j += 32) {
+        // rgb of 32 pixels of both rows as 16-bit lanes, 8 per vector
+        __m128i v[2][6], c[2][3][4];
+        deinterleave_sse2(p0 + j * 3, v[0]);
+        deinterleave_sse2(p1 + j * 3, v[1]);
+        UNROLL
+        for (int row = 0; row < 2; row++) {
+            UNROLL
+            for (int ch = 0; ch < 3; ch++) {
+                UNROLL
+                for (int h = 0; h < 2; h++) {
+                    __m128i bytes = v[row][ch * 2 + h];
+                    c[row][ch][h * 2] = _mm_unpacklo_epi8(bytes, zero);
+                    c[row][ch][h * 2 + 1] = _mm_unpackhi_epi8(bytes, zero);
+                }
             }
         }
+
+        UNROLL
+        for (int row = 0; row < 2; row++) {
+            __m128i (*px)[4] = c[row], y[4];
+            UNROLL
+            for (int i = 0; i < 4; i++)
+                y[i] = dot_sse2(px[0][i], px[1][i], px[2][i], k[0][0],
+                                k[0][1], k[0][2], bias[0], 16);
+
+            uint8_t *dst = (row ? y1 : y0) + j;
+            _mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(y[0], y[1]));
+            _mm_storeu_si128((__m128i *)(dst + 16),
+                             _mm_packus_epi16(y[2], y[3]));
+        }
+
+        // the quad sums of 16 chroma samples, 8 per vector
+        __m128i sum[3][2];
+        UNROLL
+        for (int ch = 0; ch < 3; ch++) {
+            UNROLL
+            for (int h = 0; h < 2; h++) {
+                __m128i lo = quad_sse2(c[0][ch][h * 2], c[1][ch][h * 2]);
+                __m128i hi =
+                    quad_sse2(c[0][ch][h * 2 + 1], c[1][ch][h * 2 + 1]);
+                sum[ch][h] = _mm_packs_epi32(lo, hi);
+            }
+        }
+
+        UNROLL
+        for (int i = 1; i < 3; i++) {
+            __m128i lo = dot_sse2(sum[0][0], sum[1][0], sum[2][0], k[i][0],
+                                  k[i][1], k[i][2], bias[i], 18);
+            __m128i hi = dot_sse2(sum[0][1], sum[1][1], sum[2][1], k[i][0],
+                                  k[i][1], k[i][2], bias[i], 18);
+            _mm_storeu_si128((__m128i *)((i == 1 ? cb : cr) + j / 2),
+                             _mm_packus_epi16(lo, hi));
+        }
+    }
+
+    ycc420_scalar(m, j, w, p0, p1, y0, y1, cb, cr);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+dot_avx2(__m256i r, __m256i g, __m256i b, __m256i krg, __m256i kgb,
+         __m256i kbr, __m256i bias, int shift)
+{
+    __m256i lo = _mm256_add_epi32(
+        _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(r, g), krg),
+                         _mm256_madd_epi16(_mm256_unpacklo_epi16(g, b), kgb)),
+        _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(b, r), kbr),
+                         bias));
+    __m256i hi = _mm256_add_epi32(
+        _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(r, g), krg),
+                         _mm256_madd_epi16(_mm256_unpackhi_epi16(g, b), kgb)),
+        _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(b, r), kbr),
+                         bias));
+    // unpacking and packing within the 128-bit lanes keeps the order
+    return _mm256_packs_epi32(_mm256_srai_epi32(lo, shift),
+                              _mm256_srai_epi32(hi, shift));
+}
+
+// the bytes of two vectors of 16-bit lanes in order
+__attribute__((target("avx2"))) static inline __m256i
+pack_avx2(__m256i a, __m256i b)
+{
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+}
+
+__attribute__((target("avx2"))) static void
+ycc420_avx2(const YccMatrix *m, size_t j, size_t w, const uint8_t *p0,
+            const uint8_t *p1, uint8_t *y0, uint8_t *y1, uint8_t *cb,
+            uint8_t *cr)
+{
+    __m256i k[3][3], bias[3];
+    YccPairs pp;
+
+    ycc_pairs(&pp, m);
+    for (int i = 0; i < 3; i++) {
+        k[i][0] = _mm256_set1_epi32(pp.rg[i]);
+        k[i][1] = _mm256_set1_epi32(pp.gb[i]);
+        k[i][2] = _mm256_set1_epi32(pp.br[i]);
+        bias[i] = _mm256_set1_epi32(m->bias[i]);
+    }
+
+    for (; j + 32 <= w; j += 32) {
+        // rgb of 32 pixels of both rows as 16-bit lanes, 16 per vector
+        __m128i v[2][6];
+        __m256i c[2][3][2];
+        deinterleave_avx2(p0 + j * 3, v[0]);
+        deinterleave_avx2(p1 + j * 3, v[1]);
+        UNROLL
+        for (int row = 0; row < 2; row++)
+            UNROLL
+            for (int ch = 0; ch < 3; ch++)
+                UNROLL
+                for (int h = 0; h < 2; h++)
+                    c[row][ch][h] = _mm256_cvtepu8_epi16(v[row][ch * 2 + h]);
+
+        UNROLL
+        for (int row = 0; row < 2; row++) {
+            __m256i (*px)[2] = c[row], y[2];
+            UNROLL
+            for (int i = 0; i < 2; i++)
+                y[i] = dot_avx2(px[0][i], px[1][i], px[2][i], k[0][0],
+                                k[0][1], k[0][2], bias[0], 16);
+            _mm256_storeu_si256((__m256i *)((row ? y1 : y0) + j),
+                                pack_avx2(y[0], y[1]));
+        }
+
+        // the quad sums of 16 chroma samples, the packing interleaves the
+        // 64-bit halves of the two sums
+        __m256i sum[3];
+        UNROLL
+        for (int ch = 0; ch < 3; ch++) {
+            __m256i s[2];
+            UNROLL
+            for (int h = 0; h < 2; h++)
+                s[h] = _mm256_madd_epi16(
+                    _mm256_add_epi16(c[0][ch][h], c[1][ch][h]),
+                    _mm256_set1_epi16(1));
+            sum[ch] = _mm256_permute4x64_epi64(_mm256_packs_epi32(s[0], s[1]),
+                                               0xD8);
+        }
+
+        UNROLL
+        for (int i = 1; i < 3; i++) {
+            __m256i out = dot_avx2(sum[0], sum[1], sum[2], k[i][0], k[i][1],
+                                   k[i][2], bias[i], 18);
+            _mm_storeu_si128((__m128i *)((i == 1 ? cb : cr) + j / 2),
+                             _mm256_castsi256_si128(pack_avx2(out, out)));
+        }
+    }
+
+    ycc420_scalar(m, j, w, p0, p1, y0, y1, cb, cr);
+}
+// the SIMD kernels convert 32 pixels at a time from `rgb_begin`, as long as
+// the chroma samples they load, neighbours included, are in the row
+static size_t rgb_begin(const RgbRow *r)
+{
+    return r->hfancy && r->w > 2 ? 2 : 0;
+}
+
+static int rgb_fits(const RgbRow *r, size_t x)
+{
+    if (x + 32 > r->w)
+        return 0;
+    return r->sx == 1 || x / 2 + 16 + r->hfancy <= r->cw;
+}
+
+static inline __m128i times3_sse2(__m128i a)
+{
+    return _mm_add_epi16(a, _mm_add_epi16(a, a));
+}
+
+// the upsampled chroma of the 32 pixels from `x` as 16-bit lanes, 8 per
+// vector, the same as `upsample` gives. forced inline, a call from the AVX2
+// kernel would switch between VEX and legacy SSE code
+__attribute__((always_inline)) static inline void
+upsample_sse2(const RgbRow *r, const uint8_t *c0, const uint8_t *c1, size_t x,
+              __m128i *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    if (r->sx == 1) {
+        const __m128i bias = _mm_set1_epi16(r->bias);
+        UNROLL
+        for (int h = 0; h < 2; h++) {
+            __m128i n = _mm_loadu_si128((const __m128i *)(c0 + x + h * 16));
+            out[h * 2] = _mm_unpacklo_epi8(n, zero);
+            out[h * 2 + 1] = _mm_unpackhi_epi8(n, zero);
+            if (!r->vfancy)
+                continue;
+
+            __m128i f = _mm_loadu_si128((const __m128i *)(c1 + x + h * 16));
+            UNROLL
+            for (int i = 0; i < 2; i++) {
+                __m128i fi = i ? _mm_unpackhi_epi8(f, zero)
+                               : _mm_unpacklo_epi8(f, zero);
+                __m128i sum = _mm_add_epi16(times3_sse2(out[h * 2 + i]), fi);
+                out[h * 2 + i] = _mm_srli_epi16(_mm_add_epi16(sum, bias), 2);
+            }
+        }
+        return;
+    }
+
+    const uint8_t *p0 = c0 + x / 2, *p1 = c1 + x / 2;
+    if (!r->hfancy) {
+        __m128i n = _mm_loadu_si128((const __m128i *)p0);
+        __m128i lo = _mm_unpacklo_epi8(n, n), hi = _mm_unpackhi_epi8(n, n);
+        out[0] = _mm_unpacklo_epi8(lo, zero);
+        out[1] = _mm_unpackhi_epi8(lo, zero);
+        out[2] = _mm_unpacklo_epi8(hi, zero);
+        out[3] = _mm_unpackhi_epi8(hi, zero);
+        return;
     }
+
+    // the 16 samples of the pixels, or their column sums with the other row,
+    // and those of their left and right neighbours
+    __m128i cs[3][2];
+    UNROLL
+    for (int d = 0; d < 3; d++) {
+        __m128i n = _mm_loadu_si128((const __m128i *)(p0 + d - 1));
+        cs[d][0] = _mm_unpacklo_epi8(n, zero);
+        cs[d][1] = _mm_unpackhi_epi8(n, zero);
+        if (r->vfancy) {
+            __m128i f = _mm_loadu_si128((const __m128i *)(p1 + d - 1));
+            cs[d][0] = _mm_add_epi16(times3_sse2(cs[d][0]),
+                                     _mm_unpacklo_epi8(f, zero));
+            cs[d][1] = _mm_add_epi16(times3_sse2(cs[d][1]),
+                                     _mm_unpackhi_epi8(f, zero));
+        }
+    }
+
+    __m128i even_bias = _mm_set1_epi16(r->vfancy ? 8 : 1);
+    __m128i odd_bias = _mm_set1_epi16(r->vfancy ? 7 : 2);
+    __m128i shift = _mm_cvtsi32_si128(r->vfancy ? 4 : 2);
+    UNROLL
+    for (int h = 0; h < 2; h++) {
+        __m128i t = times3_sse2(cs[1][h]);
+        __m128i even = _mm_srl_epi16(
+            _mm_add_epi16(_mm_add_epi16(t, cs[0][h]), even_bias), shift);
+        __m128i odd = _mm_srl_epi16(
+            _mm_add_epi16(_mm_add_epi16(t, cs[2][h]), odd_bias), shift);
+        out[h * 2] = _mm_unpacklo_epi16(even, odd);
+        out[h * 2 + 1] = _mm_unpackhi_epi16(even, odd);
+    }
+}
+
+// the offsets of JFIF_R/G/B are whole multiples of the chroma plus a rest
+// that `pmaddwd` takes from (cb, cr) pairs with the same rounding, e.g.
+// 91881 * cr = 65536 * cr + 26345 * cr
+#define RGB_KR pair(0, 26345)
+#define RGB_KG pair(-22554, 18734)
+#define RGB_KB pair(-14942, 0)
+
+static inline __m128i offset_sse2(__m128i lo, __m128i hi, __m128i k)
+{
+    const __m128i half = _mm_set1_epi32(32768);
+    return _mm_packs_epi32(
+        _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lo, k), half), 16),
+        _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(hi, k), half), 16));
+}
+
+// rgb of 8 16-bit lanes of luma and centered chroma
+static inline void rgb_sse2(__m128i y, __m128i u, __m128i v, __m128i *rgb)
+{
+    __m128i lo = _mm_unpacklo_epi16(u, v), hi = _mm_unpackhi_epi16(u, v);
+
+    rgb[0] = _mm_add_epi16(_mm_add_epi16(y, v),
+                           offset_sse2(lo, hi, _mm_set1_epi32(RGB_KR)));
+    rgb[1] = _mm_add_epi16(_mm_sub_epi16(y, v),
+                           offset_sse2(lo, hi, _mm_set1_epi32(RGB_KG)));
+    rgb[2] = _mm_add_epi16(_mm_add_epi16(y, _mm_add_epi16(u, u)),
+                           offset_sse2(lo, hi, _mm_set1_epi32(RGB_KB)));
+}
+
+// the byte planes as 32 rgb or rgba pixels
+static inline void store_sse2(const RgbRow *r, __m128i *v, uint8_t *p)
+{
+    if (r->bpp == 3) {
+        interleave_sse2(v, p);
+        return;
+    }
+
+    const __m128i alpha = _mm_set1_epi8(-1);
+    UNROLL
+    for (int h = 0; h < 2; h++) {
+        __m128i rg[2], ba[2];
+        rg[0] = _mm_unpacklo_epi8(v[h], v[h + 2]);
+        rg[1] = _mm_unpackhi_epi8(v[h], v[h + 2]);
+        ba[0] = _mm_unpacklo_epi8(v[h + 4], alpha);
+        ba[1] = _mm_unpackhi_epi8(v[h + 4], alpha);
+        UNROLL
+        for (int i = 0; i < 2; i++) {
+            __m128i *out = (__m128i *)(p + h * 64 + i * 32);
+            _mm_storeu_si128(out, _mm_unpacklo_epi16(rg[i], ba[i]));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rg[i], ba[i]));
+        }
+    }
+}
+
+static void rgb_row_sse2(const RgbRow *r)
+{
+    const __m128i zero = _mm_setzero_si128(), c128 = _mm_set1_epi16(128);
+    size_t x = rgb_begin(r);
+
+    rgb_scalar(r, 0, x);
+    for (; rgb_fits(r, x); x += 32) {
+        __m128i u[4], v[4], y[4], px[4][3], planes[6];
+
+        upsample_sse2(r, r->cb0, r->cb1, x, u);
+        upsample_sse2(r, r->cr0, r->cr1, x, v);
+        UNROLL
+        for (int h = 0; h < 2; h++) {
+            __m128i l = _mm_loadu_si128((const __m128i *)(r->y + x + h * 16));
+            y[h * 2] = _mm_unpacklo_epi8(l, zero);
+            y[h * 2 + 1] = _mm_unpackhi_epi8(l, zero);
+        }
+        UNROLL
+        for (int i = 0; i < 4; i++)
+            rgb_sse2(y[i], _mm_sub_epi16(u[i], c128),
+                     _mm_sub_epi16(v[i], c128), px[i]);
+        UNROLL
+        for (int ch = 0; ch < 3; ch++)
+            UNROLL
+            for (int h = 0; h < 2; h++)
+                planes[ch * 2 + h] =
+                    _mm_packus_epi16(px[h * 2][ch], px[h * 2 + 1][ch]);
+
+        store_sse2(r, planes, r->dst + x * r->bpp);
+    }
+    rgb_scalar(r, x, r->w);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+offset_avx2(__m256i uv_lo, __m256i uv_hi, __m256i k)
+{
+    const __m256i half = _mm256_set1_epi32(32768);
+    return _mm256_packs_epi32(
+        _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(uv_lo, k), half),
+                          16),
+        _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(uv_hi, k), half),
+                          16));
+}
+
+// the upsampling is as fast in 128-bit lanes, the color math of the 32
+// pixels takes half the instructions in 256-bit ones
+__attribute__((target("avx2"))) static void rgb_row_avx2(const RgbRow *r)
+{
+    const __m256i c128 = _mm256_set1_epi16(128);
+    const __m256i kr = _mm256_set1_epi32(RGB_KR);
+    const __m256i kg = _mm256_set1_epi32(RGB_KG);
+    const __m256i kb = _mm256_set1_epi32(RGB_KB);
+    size_t x = rgb_begin(r);
+
+    rgb_scalar(r, 0, x);
+    for (; rgb_fits(r, x); x += 32) {
+        __m128i cb[4], cr[4], planes[6];
+        __m256i px[3][2];
+
+        upsample_sse2(r, r->cb0, r->cb1, x, cb);
+        upsample_sse2(r, r->cr0, r->cr1, x, cr);
+        UNROLL
+        for (int h = 0; h < 2; h++) {
+            __m256i y = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128((const __m128i *)(r->y + x + h * 16)));
+            __m256i u = _mm256_sub_epi16(
+                _mm256_set_m128i(cb[h * 2 + 1], cb[h * 2]), c128);
+            __m256i v = _mm256_sub_epi16(
+                _mm256_set_m128i(cr[h * 2 + 1], cr[h * 2]), c128);
+            __m256i lo = _mm256_unpacklo_epi16(u, v);
+            __m256i hi = _mm256_unpackhi_epi16(u, v);
+
+            px[0][h] = _mm256_add_epi16(_mm256_add_epi16(y, v),
+                                        offset_avx2(lo, hi, kr));
+            px[1][h] = _mm256_add_epi16(_mm256_sub_epi16(y, v),
+                                        offset_avx2(lo, hi, kg));
+            px[2][h] = _mm256_add_epi16(
+                _mm256_add_epi16(y, _mm256_add_epi16(u, u)),
+                offset_avx2(lo, hi, kb));
+        }
+        UNROLL
+        for (int ch = 0; ch < 3; ch++) {
+            __m256i bytes = pack_avx2(px[ch][0], px[ch][1]);
+            planes[ch * 2] = _mm256_castsi256_si128(bytes);
+            planes[ch * 2 + 1] = _mm256_extracti128_si256(bytes, 1);
+        }
+
+        if (r->bpp == 3)
+            interleave_avx2(planes, r->dst + x * 3);
+        else
+            store_sse2(r, planes, r->dst + x * 4);
+    }
+    rgb_scalar(r, x, r->w);
+}
+#endif
+
+typedef void (*Ycc420Fn)(const YccMatrix *, size_t, size_t, const uint8_t *,
+                         const uint8_t *, uint8_t *, uint8_t *, uint8_t *,
+                         uint8_t *);
+
+typedef void (*RgbRowFn)(const RgbRow *);
+
+static struct {
+    const char *isa;
+    Ycc420Fn ycc420;
+    RgbRowFn rgb_row;
+} kernels;
+
+// resolved on first use like the dct8 kernels
+static void yuv_dispatch(void)
+{
+    if (kernels.ycc420)
+        return;
+
+    const char *isa = "scalar";
+    Ycc420Fn ycc420 = ycc420_scalar;
+    RgbRowFn rgb_row = rgb_row_scalar;
+#ifdef YUV_X86
+    int features = cpu_get_features();
+    if (features & CPU_AVX2) {
+        isa = "avx2", ycc420 = ycc420_avx2, rgb_row = rgb_row_avx2;
+    } else if (features & CPU_SSE2) {
+        isa = "sse2", ycc420 = ycc420_sse2, rgb_row = rgb_row_sse2;
+    }
+#endif
+    kernels.isa = isa;
+    kernels.ycc420 = ycc420;
+    kernels.rgb_row = rgb_row;
+}
+
+const char *yuv_isa(void)
+{
+    yuv_dispatch();
+    return kernels.isa;
+}
+
+void rgb24_to_ycbcr420(xYccRange range, size_t w, size_t h,
+                       const uint8_t *src, size_t stride, uint8_t *y,
+                       size_t ystride, uint8_t *cb, uint8_t *cr,
+                       size_t cstride)
+{
+    const YccMatrix *m = &matrices[range];
+
+    yuv_dispatch();
+    for (size_t i = 0; i < h; i += 2) {
+        const uint8_t *p0 = src + i * stride;
+        const uint8_t *p1 = i + 1 < h ? p0 + stride : p0;
+        uint8_t *y0 = y + i * ystride;
+        uint8_t *y1 = i + 1 < h ? y0 + ystride : y0;
+
+        kernels.ycc420(m, 0, w, p0, p1, y0, y1, cb + i / 2 * cstride,
+                       cr + i / 2 * cstride);
+    }
+}
+
+typedef struct YccJob {
+    xYccRange range;
+    size_t w, h;
+    const uint8_t *src;
+    size_t stride;
+    uint8_t *y;
+    size_t ystride;
+    uint8_t *cb, *cr;
+    size_t cstride;
+} YccJob;
+
+// bands of 16 rows, i.e. 8 chroma rows
+#define YCC_BAND 16
+
+static void ycc_task(void *arg, size_t begin, size_t end, int worker)
+{
+    const YccJob *job = arg;
+    size_t y0 = begin * YCC_BAND;
+    size_t rows = end * YCC_BAND < job->h ? end * YCC_BAND - y0 : job->h - y0;
+
+    rgb24_to_ycbcr420(job->range, job->w, rows, job->src + y0 * job->stride,
+                      job->stride, job->y + y0 * job->ystride, job->ystride,
+                      job->cb + y0 / 2 * job->cstride,
+                      job->cr + y0 / 2 * job->cstride, job->cstride);
+}
+
+void rgb24_to_ycbcr420_mt(xPool *pool, xYccRange range, size_t w, size_t h,
+                          const uint8_t *src, size_t stride, uint8_t *y,
+                          size_t ystride, uint8_t *cb, uint8_t *cr,
+                          size_t cstride)
+{
+    YccJob job = {range, w, h, src, stride, y, ystride, cb, cr, cstride};
+
+    pool_for(pool, (h + YCC_BAND - 1) / YCC_BAND, 1, ycc_task, &job);
+}
+
+typedef struct RgbJob {
+    xUpsample up;
+    int sx, sy;
+    size_t w, h;
+    const uint8_t *y;
+    size_t ystride;
+    const uint8_t *cb, *cr;
+    size_t cstride;
+    uint8_t *dst;
+    size_t dstride;
+    int bpp;
+} RgbJob;
+
+// rows `[y0, y1)`, the filter reaches for the chroma rows of the neighbours
+static void rgb_rows(const RgbJob *job, size_t y0, size_t y1)
+{
+    size_t ch = (job->h + job->sy - 1) / job->sy;
+    int fancy = job->up == UPSAMPLE_FANCY;
+    RgbRow r = {0};
+
+    r.w = job->w;
+    r.cw = (job->w + job->sx - 1) / job->sx;
+    r.sx = job->sx;
+    r.bpp = job->bpp;
+    r.vfancy = fancy && job->sy == 2;
+    r.hfancy = fancy && job->sx == 2;
+
+    for (size_t i = y0; i < y1; i++) {
+        size_t cy = i / job->sy, far = cy;
+        int lower = job->sy == 2 && (i & 1);
+
+        // the next nearest chroma row is above the upper pixel row of a
+        // pair and below the lower one, the edge rows stand in for missing
+        // ones
+        if (r.vfancy)
+            far = lower ? (cy + 1 < ch ? cy + 1 : cy) : (cy > 0 ? cy - 1 : 0);
+        r.bias = lower ? 2 : 1;
+        r.y = job->y + i * job->ystride;
+        r.cb0 = job->cb + cy * job->cstride;
+        r.cr0 = job->cr + cy * job->cstride;
+        r.cb1 = job->cb + far * job->cstride;
+        r.cr1 = job->cr + far * job->cstride;
+        r.dst = job->dst + i * job->dstride;
+        kernels.rgb_row(&r);
+    }
+}
+
+void ycbcr_to_rgb(xUpsample up, int sx, int sy, size_t w, size_t h,
+                  const uint8_t *y, size_t ystride, const uint8_t *cb,
+                  const uint8_t *cr, size_t cstride, uint8_t *dst,
+                  size_t dstride, int bpp)
+{
+    RgbJob job = {up, sx, sy, w, h, y, ystride, cb, cr, cstride,
+                  dst, dstride, bpp};
+
+    yuv_dispatch();
+    rgb_rows(&job, 0, h);
+}
+
+static void rgb_task(void *arg, size_t begin, size_t end, int worker)
+{
+    const RgbJob *job = arg;
+    size_t y1 = end * YCC_BAND < job->h ? end * YCC_BAND : job->h;
+
+    rgb_rows(job, begin * YCC_BAND, y1);
+}
+
+void ycbcr_to_rgb_mt(xPool *pool, xUpsample up, int sx, int sy, size_t w,
+                     size_t h, const uint8_t *y, size_t ystride,
+                     const uint8_t *cb, const uint8_t *cr, size_t cstride,
+                     uint8_t *dst, size_t dstride, int bpp)
+{
+    RgbJob job = {up, sx, sy, w, h, y, ystride, cb, cr, cstride,
+                  dst, dstride, bpp};
+
+    yuv_dispatch();
+    pool_for(pool, (h + YCC_BAND - 1) / YCC_BAND, 1, rgb_task, &job);
+}
+
+PixelBuffer *ycbcr_to_pxb(xPool *pool, xUpsample up, int sx, int sy,
+                          size_t w, size_t h, const uint8_t *y,
+                          size_t ystride, const uint8_t *cb,
+                          const uint8_t *cr, size_t cstride)
+{
+    PixelBuffer *pxb = pxb_new(FMT_RGB24, w, h, NULL);
+
+    ycbcr_to_rgb_mt(pool, up, sx, sy, w, h, y, ystride, cb, cr, cstride,
+                    pxb->plane[0], pxb->stride[0], 3);
+    return pxb;
 }
@@ -7,6 +7,9 @@ extern "C" {
 #include <stddef.h>
 #include <stdint.h>
 
+#include "pool.h"
+#include "pxb.h"
+
 typedef struct {
     uint8_t y, u, v;
 } YUV;
@@ -18,8 +21,63 @@ typedef struct {
 YUV yuv_from_rgb(uint8_t r, uint8_t g, uint8_t b);
 
 void rgb24_to_yuv444(size_t w, size_t h, uint8_t *src, uint8_t *dst);
+// studio range planar I420: `w*h` luma samples then `(w+1)/2 * (h+1)/2` of U
+// and of V
 void rgb24_to_yuv420(size_t w, size_t h, uint8_t *src, uint8_t *dst);
 
+typedef enum xYccRange {
+    // JFIF full range, Y, Cb and Cr in 0..255
+    YCC_JFIF,
+    // BT.601 studio range, Y in 16..235 and Cb, Cr in 16..240
+    YCC_BT601,
+} xYccRange;
+
+// the name of the vector instruction set the converters run on
+const char *yuv_isa(void);
+
+// YCbCr 4:2:0 of the `w*h` rgb pixels at `src` in 16-bit fixed point, two
+// rows at a time, every chroma sample is the average of a 2x2 quad. `cb`/`cr`
+// get `(w+1)/2 * (h+1)/2` samples, an odd last column/row is averaged with
+// itself. the SIMD kernels give the same samples as the scalar one
+void rgb24_to_ycbcr420(xYccRange range, size_t w, size_t h,
+                       const uint8_t *src, size_t stride, uint8_t *y,
+                       size_t ystride, uint8_t *cb, uint8_t *cr,
+                       size_t cstride);
+// the same in bands of rows on the workers of `pool`
+void rgb24_to_ycbcr420_mt(xPool *pool, xYccRange range, size_t w, size_t h,
+                          const uint8_t *src, size_t stride, uint8_t *y,
+                          size_t ystride, uint8_t *cb, uint8_t *cr,
+                          size_t cstride);
+
+typedef enum xUpsample {
+    // every chroma sample covers its `sx*sy` pixels
+    UPSAMPLE_NEAREST,
+    // the triangle filter of libjpeg's "fancy" upsampling, a 3:1 blend of the
+    // nearest and the next nearest sample in each subsampled direction
+    UPSAMPLE_FANCY,
+} xUpsample;
+
+// `w*h` pixels of `bpp` 3 (rgb) or 4 (rgba with an opaque alpha) bytes from
+// JFIF full range YCbCr planes, the chroma subsampled `sx` times across and
+// `sy` times down, 1 or 2, i.e. 4:4:4, 4:2:2 or 4:2:0 with `(w+sx-1)/sx *
+// (h+sy-1)/sy` samples. the chroma is upsampled in the same pass, a row at a
+// time, and the SIMD kernels give the same pixels as the scalar one
+void ycbcr_to_rgb(xUpsample up, int sx, int sy, size_t w, size_t h,
+                  const uint8_t *y, size_t ystride, const uint8_t *cb,
+                  const uint8_t *cr, size_t cstride, uint8_t *dst,
+                  size_t dstride, int bpp);
+// the same in bands of rows on the workers of `pool`
+void ycbcr_to_rgb_mt(xPool *pool, xUpsample up, int sx, int sy, size_t w,
+                     size_t h, const uint8_t *y, size_t ystride,
+                     const uint8_t *cb, const uint8_t *cr, size_t cstride,
+                     uint8_t *dst, size_t dstride, int bpp);
+// a new FMT_RGB24 buffer of the planes, see `ycbcr_to_rgb`. `pool` may be
+// NULL
+PixelBuffer *ycbcr_to_pxb(xPool *pool, xUpsample up, int sx, int sy,
+                          size_t w, size_t h, const uint8_t *y,
+                          size_t ystride, const uint8_t *cb,
+                          const uint8_t *cr, size_t cstride);
+
 #ifdef __cplusplus
 }
 #endif
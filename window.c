@@ -3,19 +3,74 @@
 static inline uint32_t get_fmt(PixelFormat fmt)
 {
     switch (fmt) {
-    case FMT_YUV420:
-        return SDL_PIXELFORMAT_IYUV;
     case FMT_RGB24:
         return SDL_PIXELFORMAT_RGB24;
+    case FMT_NV12:
+        return SDL_PIXELFORMAT_NV12;
+    case FMT_RGBA32:
+        return SDL_PIXELFORMAT_RGBA32;
+    case FMT_BGRA32:
+        return SDL_PIXELFORMAT_BGRA32;
     default:
+        // the planar yuv formats SDL lacks are shown as I420
         return SDL_PIXELFORMAT_IYUV;
     }
 }
 
+// gray, 4:2:2 or 4:4:4 planes as I420, the chroma by its nearest samples
+static PixelBuffer *to_i420(const PixelBuffer *pxb)
+{
+    PixelBuffer *out = pxb_new(FMT_YUV420, pxb->w, pxb->h, NULL);
+    size_t cw = fmt_get_row_size(FMT_YUV420, 1, pxb->w);
+    size_t ch = fmt_get_rows(FMT_YUV420, 1, pxb->h);
+
+    for (size_t y = 0; y < pxb->h; y++)
+        memcpy(out->plane[0] + y * out->stride[0],
+               pxb->plane[0] + y * pxb->stride[0], pxb->w);
+    if (pxb->fmt == FMT_GRAY8) {
+        pxb_remove_channels(out, CHAN_U | CHAN_V);
+        return out;
+    }
+
+    int sx = pxb->fmt == FMT_YUV444P ? 2 : 1;
+    for (int i = 1; i < 3; i++)
+        for (size_t y = 0; y < ch; y++)
+            for (size_t x = 0; x < cw; x++)
+                out->plane[i][y * out->stride[i] + x] =
+                    pxb->plane[i][y * 2 * pxb->stride[i] + x * sx];
+    return out;
+}
+
+static void update_texture(SDL_Texture *texture, const SDL_Rect *rect,
+                           const PixelBuffer *pxb)
+{
+    switch (pxb->fmt) {
+    case FMT_YUV420:
+        SDL_UpdateYUVTexture(texture, rect, pxb->plane[0], pxb->stride[0],
+                             pxb->plane[1], pxb->stride[1], pxb->plane[2],
+                             pxb->stride[2]);
+        break;
+    case FMT_NV12:
+        SDL_UpdateNVTexture(texture, rect, pxb->plane[0], pxb->stride[0],
+                            pxb->plane[1], pxb->stride[1]);
+        break;
+    case FMT_GRAY8:
+    case FMT_YUV422P:
+    case FMT_YUV444P: {
+        PixelBuffer *i420 = to_i420(pxb);
+        update_texture(texture, rect, i420);
+        pxb_free(i420);
+        break;
+    }
+    default:
+        SDL_UpdateTexture(texture, rect, pxb->plane[0], pxb->stride[0]);
+        break;
+    }
+}
+
 PreviewWindow *create_preview_window(const char *title, PixelBuffer *pxb)
 {
     uint32_t format = get_fmt(pxb->fmt);
-    size_t pitch = fmt_get_pitch(pxb->fmt, pxb->w, pxb->h);
     SDL_Rect rect = {.w = pxb->w, .h = pxb->h};
 
     PreviewWindow *win = malloc(sizeof(PreviewWindow));
@@ -27,7 +82,7 @@ PreviewWindow *create_preview_window(const char *title, PixelBuffer *pxb)
     SDL_Texture *texture = SDL_CreateTexture(
         renderer, format, SDL_TEXTUREACCESS_STATIC, rect.w, rect.h);
 
-    SDL_UpdateTexture(texture, &rect, pxb->buf, pitch);
+    update_texture(texture, &rect, pxb);
     SDL_RenderCopy(renderer, texture, NULL, NULL);
 
     SDL_RenderPresent(renderer);